@@ -3,43 +3,1131 @@
 #include <cstddef>
 #include "exception.hpp"
 #include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <chrono>
+#include <type_traits>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 namespace sjtu {
-	//B+树索引存储地址
+	//B+树索引默认存储地址（重做日志存放在地址后加.log的文件中）
 	constexpr char BPTREE_ADDRESS[128] = "mybptree.sjtu";
-	template <class Key, class Value, class Compare = std::less<Key> >
+	//存储地址的最大长度
+	constexpr int BPTREE_ADDRESS_SIZE = 256;
+	//多棵树的目录文件名
+	constexpr char BPTREE_CATALOG_NAME[16] = "catalog.sjtu";
+	//持久化模式
+	enum DurabilityMode {
+		//每次修改后立即写回
+		PerOperation,
+		//每N次修改或每T毫秒写回一次
+		GroupCommit,
+		//只在调用sync()时写回
+		Manual
+	};
+	//存储后端
+	enum StorageType {
+		//stdio文件读写
+		StdioStorage,
+		//内存映射，结点直接在映射中访问
+		MmapStorage,
+		//pread/pwrite读写，不同块的读入可以并行（配合find_async/insert_async）
+		PreadStorage
+	};
+
+	//压缩关键字：对按std::less排序的整数Key特化为std::true_type时，叶子中的关键字存为基准值加半宽的无符号差值，
+	//关键字密集（如递增编号）时一个叶子放得下更多元素；差值放不下时叶子分裂。文件只能用相同设置的树打开
+	template <class Key>
+	class Compact_Key : public std::false_type {};
+
+	//是否收集统计信息，定义为0时计数与计时的代码全部被编译掉
+#ifndef BPTREE_STATS
+#define BPTREE_STATS 1
+#endif
+
+	//树的统计信息快照，见BTree::stats()
+	//BPTREE_STATS定义为0时只统计缓存与重做日志的块读写，其余字段都为0
+	class BTree_Stats {
+	public:
+		//延迟直方图：第i个桶记录耗时在[2^i, 2^(i+1))纳秒内的操作数
+		class Histogram {
+		public:
+			constexpr static int BUCKET_NUM = 48;
+			off_t bucket[BUCKET_NUM] = {};
+			//计时的操作数
+			off_t count = 0;
+			//计时的操作的总耗时（纳秒）
+			off_t total_ns = 0;
+			double mean_ns() const {
+				return count ? double(total_ns) / double(count) : 0.0;
+			}
+			//p分位数所在桶的上界（纳秒），0 < p <= 1
+			off_t percentile_ns(double p) const {
+				auto target = off_t(p * double(count));
+				if (target < 1)
+					target = 1;
+				off_t seen = 0;
+				for (int i = 0; i < BUCKET_NUM; ++i) {
+					seen += bucket[i];
+					if (seen >= target)
+						return off_t(1) << (i + 1);
+				}
+				return 0;
+			}
+		};
+		//树的操作经缓存读写的结点块数
+		off_t leaf_reads = 0, inner_reads = 0;
+		off_t leaf_writes = 0, inner_writes = 0;
+		//分离存放的值读写的块数
+		off_t value_reads = 0, value_writes = 0;
+		off_t leaf_splits = 0, inner_splits = 0;
+		//分配（memory_allocation与批量建树）与放回空闲链表的块数
+		off_t allocations = 0, frees = 0;
+		//删除与整理合并兄弟的次数
+		off_t leaf_merges = 0, inner_merges = 0;
+		//整理移到其他块的结点数
+		off_t relocations = 0;
+		//顺序扫描请求存储后端预读的叶子块数
+		off_t readaheads = 0;
+		//数据文件读入与写回的块数，以及写回的字节数
+		off_t storage_reads = 0, storage_writes = 0, flushed_bytes = 0;
+		//追加到重做日志的字节数与日志落盘的次数
+		off_t log_bytes = 0, log_syncs = 0;
+		//insert、find、at、erase与迭代器++/--的延迟；迭代器每64次取样一次
+		Histogram insert_latency, find_latency, at_latency, erase_latency, advance_latency;
+	};
+
+	//树文件的形状，见BTree::analyze()
+	class BTree_Shape {
+	public:
+		constexpr static int LEVEL_NUM = 64;
+		constexpr static int FILL_BUCKET_NUM = 10;
+		//文件头记录的块数、文件实际的块数与页大小
+		off_t block_cnt = 0, file_blocks = 0, block_size = 0;
+		//重做日志的字节数；不为0时数据文件缺少下次打开才会重放的修改，看到的是上次检查点时的形状
+		off_t log_bytes = 0;
+		//文件头记录的元素数与在叶子中找到的元素数
+		off_t size = 0, record_cnt = 0;
+		off_t height = 0;
+		//每层的结点数与项数（元素或孩子），第0层为根
+		off_t level_nodes[LEVEL_NUM] = {};
+		off_t level_entries[LEVEL_NUM] = {};
+		//每层的填充率：项数 / (结点数 * 容量)
+		double level_fill[LEVEL_NUM] = {};
+		off_t leaf_cnt = 0, inner_cnt = 0, leaf_capacity = 0, inner_capacity = 0;
+		//按填充率统计的结点数，第i个桶为[i / 10, (i + 1) / 10)，最后一个桶也包含1
+		off_t leaf_fill[FILL_BUCKET_NUM] = {};
+		off_t inner_fill[FILL_BUCKET_NUM] = {};
+		//分离存放的值所在的块数
+		off_t value_blocks = 0;
+		//空闲链表上的块数与等待重用的值槽数
+		off_t free_blocks = 0, free_values = 0;
+		//block_cnt以内既不是文件头、哨兵、从根可达的结点、空闲块，也不是叶子或空闲值链表引用的值块的块数
+		off_t unreachable_blocks = 0;
+		//叶子链：链上的叶子数、跳到物理上下一块的次数、向后跳的次数，以及相邻叶子的平均块距离
+		off_t chain_leaves = 0, chain_sequential = 0, chain_backward = 0;
+		double chain_mean_jump = 0;
+		//断开的链接、错误的块号、被到达两次的结点以及叶子链前后指针不一致的次数
+		off_t error_cnt = 0;
+	};
+
+	//块读写的公共部分：重做日志、存储后端与块缓存，与结点的格式无关
+	template <off_t BLOCK_SIZE>
+	class Block_Io {
+	public:
+		//最小缓存页数（需容纳一次分裂涉及的所有未提交页）
+		constexpr static off_t MIN_CACHE_SIZE = 32;
+
+		//日志记录类型
+		enum Log_Type {
+			//块内一段字节的新内容
+			LOG_UPDATE = 1,
+			//块被清零（新分配）
+			LOG_FORMAT = 2,
+			//一次操作提交，内容为文件头
+			LOG_COMMIT = 3
+		};
+
+		//可以关闭的互斥锁：只在并发模式下真正加锁（可重入）
+		class Switch_Mutex {
+		private:
+			std::recursive_mutex mutex;
+		public:
+			bool enabled = false;
+			void lock() {
+				if (enabled)
+					mutex.lock();
+			}
+			void unlock() {
+				if (enabled)
+					mutex.unlock();
+			}
+		};
+
+		//日志记录头
+		class Log_Record {
+		public:
+			off_t type = 0;
+			off_t pos = 0;
+			off_t offset = 0;
+			off_t len = 0;
+			unsigned long long checksum = 0;
+		};
+
+		//重做日志
+		//只追加写入，按批fsync；每次修改操作以一条带文件头的提交记录结束，
+		//恢复时只重放最后一条完整提交记录之前的内容，因此分裂等多块修改是原子的
+		class Redo_Log {
+		private:
+			FILE* log_fp = nullptr;
+			//并发模式下保护文件指针
+			Switch_Mutex mutex;
+			//已追加的日志末尾
+			off_t end_lsn = 0;
+			//已落盘的日志末尾
+			off_t flushed_lsn = 0;
+			//累计追加的字节数与落盘次数
+			off_t append_bytes = 0, sync_cnt = 0;
+
+			static unsigned long long get_checksum(const Log_Record& record, const char* data) {
+				unsigned long long hash = 0xcbf29ce484222325ull;
+				auto mix = [&hash](const char* p, off_t len) {
+					for (off_t i = 0; i < len; ++i) {
+						hash ^= (unsigned char)p[i];
+						hash *= 0x100000001b3ull;
+					}
+				};
+				mix((const char*)&record, sizeof(off_t) * 4);
+				mix(data, record.len);
+				return hash;
+			}
+
+		public:
+			Redo_Log() = default;
+			Redo_Log(const Redo_Log&) = delete;
+			Redo_Log& operator=(const Redo_Log&) = delete;
+			~Redo_Log() {
+				close();
+			}
+			void open(const char* address) {
+				close();
+				log_fp = fopen(address, "rb+");
+				if (!log_fp)
+					log_fp = fopen(address, "wb+");
+				fseek(log_fp, 0, SEEK_END);
+				end_lsn = flushed_lsn = ftell(log_fp);
+			}
+			void close() {
+				if (log_fp)
+					fclose(log_fp);
+				log_fp = nullptr;
+			}
+			bool is_open() const {
+				return log_fp != nullptr;
+			}
+			off_t size() const {
+				return end_lsn;
+			}
+			void set_concurrent(bool enable) {
+				mutex.enabled = enable;
+			}
+			//追加一条记录，返回追加后的日志末尾
+			off_t append(off_t type, off_t pos, off_t offset, const char* data, off_t len) {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				Log_Record record;
+				record.type = type;
+				record.pos = pos;
+				record.offset = offset;
+				record.len = len;
+				record.checksum = get_checksum(record, data);
+				fwrite(&record, sizeof(record), 1, log_fp);
+				if (len)
+					fwrite(data, len, 1, log_fp);
+				end_lsn += sizeof(record) + len;
+				append_bytes += sizeof(record) + len;
+				return end_lsn;
+			}
+			//保证lsn之前的日志已落盘
+			void force(off_t lsn) {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				if (lsn <= flushed_lsn)
+					return;
+				fflush(log_fp);
+				fdatasync(fileno(log_fp));
+				flushed_lsn = end_lsn;
+				++sync_cnt;
+			}
+			void force() {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				force(end_lsn);
+			}
+			//累计追加的字节数与落盘次数
+			void io_count(off_t& bytes, off_t& syncs) {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				bytes = append_bytes;
+				syncs = sync_cnt;
+			}
+			//清空日志
+			void truncate() {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				fflush(log_fp);
+				if (ftruncate(fileno(log_fp), 0)) {
+					throw runtime_error();
+				}
+				fseek(log_fp, 0, SEEK_SET);
+				end_lsn = flushed_lsn = 0;
+			}
+			//依次读出日志记录，visit(record, data)；在第一条不完整的记录处停止，
+			//返回最后一条完整提交记录之后的位置
+			template <class Visitor>
+			off_t scan(off_t limit, Visitor visit) {
+				fseek(log_fp, 0, SEEK_SET);
+				off_t cur = 0, committed = 0;
+				char data[BLOCK_SIZE];
+				Log_Record record;
+				while (cur < limit && fread(&record, sizeof(record), 1, log_fp) == 1) {
+					if (record.len < 0 || record.len > BLOCK_SIZE
+						|| (record.len && fread(data, record.len, 1, log_fp) != 1)
+						|| record.checksum != get_checksum(record, data))
+						break;
+					cur += sizeof(record) + record.len;
+					if (cur > limit)
+						break;
+					visit(record, data);
+					if (record.type == LOG_COMMIT)
+						committed = cur;
+				}
+				fseek(log_fp, 0, SEEK_END);
+				return committed;
+			}
+		};
+
+		//存储后端接口
+		class Storage {
+		public:
+			virtual ~Storage() {}
+			//打开已有的文件，不存在时返回false
+			virtual bool open(const char* address) = 0;
+			//创建新文件（已存在则清空）
+			virtual void create(const char* address) = 0;
+			virtual void close() = 0;
+			virtual bool is_open() const = 0;
+			//读写整块，文件末尾之后的块视为全零
+			virtual void read(char* buff, off_t pos) = 0;
+			virtual void write(const char* buff, off_t pos) = 0;
+			//把写入的块落盘
+			virtual void flush() = 0;
+			//把文件截断为block_cnt块（调用前所有修改都已写回）
+			virtual void truncate(off_t block_cnt) = 0;
+			//能否直接访问块所在的内存（此时不经过缓存页）
+			virtual bool in_place() const {
+				return false;
+			}
+			//块所在的内存
+			virtual char* address(off_t) {
+				return nullptr;
+			}
+			//能否在写回其他块的同时并行读入不同的块
+			virtual bool parallel_read() const {
+				return false;
+			}
+			//提示之后会读入[pos, pos + cnt)中的块，后端可以提前异步读入（不改变后端状态，不需要加锁）
+			virtual void prefetch(off_t, off_t) {}
+		};
+
+		//stdio存储
+		class Stdio_Storage : public Storage {
+		private:
+			//文件指针
+			FILE* fp = nullptr;
+		public:
+			~Stdio_Storage() {
+				close();
+			}
+			bool open(const char* address) {
+				close();
+				fp = fopen(address, "rb+");
+				return fp != nullptr;
+			}
+			void create(const char* address) {
+				close();
+				fp = fopen(address, "wb+");
+				if (!fp)
+					throw runtime_error();
+			}
+			void close() {
+				if (fp)
+					fclose(fp);
+				fp = nullptr;
+			}
+			bool is_open() const {
+				return fp != nullptr;
+			}
+			void read(char* buff, off_t pos) {
+				fseek(fp, long(BLOCK_SIZE * pos), SEEK_SET);
+				auto got = off_t(fread(buff, 1, BLOCK_SIZE, fp));
+				if (got < BLOCK_SIZE)
+					memset(buff + got, 0, BLOCK_SIZE - got);
+			}
+			void write(const char* buff, off_t pos) {
+				fseek(fp, long(BLOCK_SIZE * pos), SEEK_SET);
+				fwrite(buff, BLOCK_SIZE, 1, fp);
+			}
+			void flush() {
+				fflush(fp);
+				fsync(fileno(fp));
+			}
+			void truncate(off_t block_cnt) {
+				fflush(fp);
+				if (ftruncate(fileno(fp), block_cnt * BLOCK_SIZE))
+					throw runtime_error();
+			}
+			void prefetch(off_t pos, off_t cnt) {
+				posix_fadvise(fileno(fp), pos * BLOCK_SIZE, cnt * BLOCK_SIZE, POSIX_FADV_WILLNEED);
+			}
+		};
+
+		//内存映射存储
+		//预留一段固定的地址空间，文件按大段扩展并以MAP_PRIVATE映射到其中，因此已映射块的地址不会变化；
+		//对映射的修改只留在进程内，由写回（pwrite）按日志规则落盘，未提交的修改不会进入文件
+		class Mmap_Storage : public Storage {
+		private:
+			//预留的地址空间
+			constexpr static off_t RESERVE_SIZE = off_t(1) << 36;
+			//每次扩展的块数
+			constexpr static off_t EXTENT_BLOCK_NUM = 1 << 14;
+
+			int fd = -1;
+			char* base = nullptr;
+			//已映射的块数（并发读者只访问已映射的块）
+			std::atomic<off_t> mapped_cnt{ 0 };
+
+			void reserve() {
+				auto addr = mmap(nullptr, RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+				if (addr == MAP_FAILED)
+					throw runtime_error();
+				base = (char*)addr;
+				mapped_cnt = 0;
+			}
+			//映射到至少block_cnt个块
+			void extend(off_t block_cnt) {
+				auto new_cnt = (block_cnt + EXTENT_BLOCK_NUM - 1) / EXTENT_BLOCK_NUM * EXTENT_BLOCK_NUM;
+				if (new_cnt * BLOCK_SIZE > RESERVE_SIZE)
+					throw runtime_error();
+				struct stat st;
+				if (fstat(fd, &st) || (st.st_size < new_cnt * BLOCK_SIZE && ftruncate(fd, new_cnt * BLOCK_SIZE)))
+					throw runtime_error();
+				auto addr = mmap(base + mapped_cnt * BLOCK_SIZE, (new_cnt - mapped_cnt) * BLOCK_SIZE,
+					PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, mapped_cnt * BLOCK_SIZE);
+				if (addr == MAP_FAILED)
+					throw runtime_error();
+				mapped_cnt = new_cnt;
+			}
+
+		public:
+			~Mmap_Storage() {
+				close();
+			}
+			bool open(const char* address) {
+				close();
+				fd = ::open(address, O_RDWR);
+				if (fd < 0)
+					return false;
+				reserve();
+				struct stat st;
+				fstat(fd, &st);
+				if (st.st_size)
+					extend((st.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+				return true;
+			}
+			void create(const char* address) {
+				close();
+				fd = ::open(address, O_RDWR | O_CREAT | O_TRUNC, 0644);
+				if (fd < 0)
+					throw runtime_error();
+				reserve();
+			}
+			void close() {
+				if (base)
+					munmap(base, RESERVE_SIZE);
+				if (fd >= 0)
+					::close(fd);
+				base = nullptr;
+				fd = -1;
+				mapped_cnt = 0;
+			}
+			bool is_open() const {
+				return fd >= 0;
+			}
+			void read(char* buff, off_t pos) {
+				memcpy(buff, address(pos), BLOCK_SIZE);
+			}
+			void write(const char* buff, off_t pos) {
+				if (pwrite(fd, buff, BLOCK_SIZE, pos * BLOCK_SIZE) != BLOCK_SIZE)
+					throw runtime_error();
+			}
+			void flush() {
+				fdatasync(fd);
+			}
+			//文件只能按段缩小，之后的地址空间换回不可访问的预留映射
+			void truncate(off_t block_cnt) {
+				auto new_cnt = (block_cnt + EXTENT_BLOCK_NUM - 1) / EXTENT_BLOCK_NUM * EXTENT_BLOCK_NUM;
+				if (new_cnt >= mapped_cnt)
+					return;
+				auto addr = mmap(base + new_cnt * BLOCK_SIZE, (mapped_cnt - new_cnt) * BLOCK_SIZE, PROT_NONE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+				if (addr == MAP_FAILED || ftruncate(fd, new_cnt * BLOCK_SIZE))
+					throw runtime_error();
+				mapped_cnt = new_cnt;
+			}
+			bool in_place() const {
+				return true;
+			}
+			char* address(off_t pos) {
+				if (pos >= mapped_cnt)
+					extend(pos + 1);
+				return base + pos * BLOCK_SIZE;
+			}
+			//只提示已映射的块，起点按系统页对齐
+			void prefetch(off_t pos, off_t cnt) {
+				auto end = std::min(pos + cnt, off_t(mapped_cnt));
+				if (pos >= end)
+					return;
+				auto page_size = off_t(sysconf(_SC_PAGESIZE));
+				auto begin = pos * BLOCK_SIZE / page_size * page_size;
+				madvise(base + begin, end * BLOCK_SIZE - begin, MADV_WILLNEED);
+			}
+		};
+
+		//pread/pwrite存储：没有共享的文件位置，多个线程可以同时读入不同的块
+		class Pread_Storage : public Storage {
+		private:
+			int fd = -1;
+		public:
+			~Pread_Storage() {
+				close();
+			}
+			bool open(const char* address) {
+				close();
+				fd = ::open(address, O_RDWR);
+				return fd >= 0;
+			}
+			void create(const char* address) {
+				close();
+				fd = ::open(address, O_RDWR | O_CREAT | O_TRUNC, 0644);
+				if (fd < 0)
+					throw runtime_error();
+			}
+			void close() {
+				if (fd >= 0)
+					::close(fd);
+				fd = -1;
+			}
+			bool is_open() const {
+				return fd >= 0;
+			}
+			void read(char* buff, off_t pos) {
+				off_t got = 0;
+				while (got < BLOCK_SIZE) {
+					auto len = pread(fd, buff + got, BLOCK_SIZE - got, pos * BLOCK_SIZE + got);
+					if (len < 0 && errno == EINTR)
+						continue;
+					if (len < 0)
+						throw runtime_error();
+					if (len == 0)
+						break;
+					got += len;
+				}
+				if (got < BLOCK_SIZE)
+					memset(buff + got, 0, BLOCK_SIZE - got);
+			}
+			void write(const char* buff, off_t pos) {
+				if (pwrite(fd, buff, BLOCK_SIZE, pos * BLOCK_SIZE) != BLOCK_SIZE)
+					throw runtime_error();
+			}
+			void flush() {
+				fdatasync(fd);
+			}
+			void truncate(off_t block_cnt) {
+				if (ftruncate(fd, block_cnt * BLOCK_SIZE))
+					throw runtime_error();
+			}
+			bool parallel_read() const {
+				return true;
+			}
+			void prefetch(off_t pos, off_t cnt) {
+				posix_fadvise(fd, pos * BLOCK_SIZE, cnt * BLOCK_SIZE, POSIX_FADV_WILLNEED);
+			}
+		};
+
+		//缓存页
+		class Cache_Frame {
+		public:
+			//对应的块位置(-1表示空闲)
+			off_t pos = -1;
+			//固定计数
+			off_t pin_cnt = 0;
+			//是否被修改
+			bool dirty = false;
+			//是否在热段
+			bool hot = false;
+			//是否正在从存储后端读入（此时已固定，其他线程等待读入完成）
+			bool loading = false;
+			//链表前驱后继
+			off_t prev = -1, next = -1;
+			//哈希链后继
+			off_t hash_next = -1;
+			//最后一次修改对应的日志位置
+			off_t lsn = 0;
+			//最后一次修改所属的操作编号
+			off_t txn = -1;
+			//页数据
+			char data[BLOCK_SIZE];
+		};
+
+		//块缓存池
+		//两段LRU：新页进入冷段，在冷段中被再次访问（且不是紧接着的重复访问）才晋升到热段，
+		//热段溢出时降级回冷段头部，淘汰总是优先从冷段尾部选择，
+		//因此迭代器顺序扫描只会在冷段中轮换，不会冲掉热段中的根和上层索引结点
+		//存储后端可以直接访问块时，页就是后端中的内存，缓存只记录修改过的块
+		class Page_Cache {
+		private:
+			//写回页之前需要保证对应日志已落盘
+			Redo_Log* log = nullptr;
+			//存储后端
+			Storage* storage = nullptr;
+			//直接访问后端中修改过的块
+			off_t* dirty_list = nullptr;
+			off_t dirty_cnt = 0, dirty_capacity = 0;
+			char* dirty_flag = nullptr;
+			off_t flag_capacity = 0;
+			//当前未提交的操作编号
+			off_t cur_txn = 0;
+			Cache_Frame* frames = nullptr;
+			off_t capacity = 0;
+			//哈希桶
+			off_t* bucket = nullptr;
+			off_t bucket_mask = 0;
+			//空闲页链表
+			off_t free_head = -1;
+			//冷段[0]与热段[1]
+			off_t head[2] = { -1, -1 }, tail[2] = { -1, -1 }, seg_size[2] = { 0, 0 };
+			off_t hot_limit = 0;
+			//每次清空缓存后加一，用于使之前的固定失效
+			off_t epoch = 0;
+			//从存储后端读入与写回的块数
+			off_t read_cnt = 0, write_cnt = 0;
+			//并发模式下保护页表、链表和存储后端
+			Switch_Mutex mutex;
+			//后端可以并行读入时，读入在锁外进行，完成后唤醒等待这一页的线程
+			std::condition_variable_any load_cv;
+
+			off_t hash(off_t pos) const {
+				return off_t((unsigned long long)pos * 0x9E3779B97F4A7C15ull >> 20) & bucket_mask;
+			}
+			off_t lookup(off_t pos) const {
+				for (auto p = bucket[hash(pos)]; p != -1; p = frames[p].hash_next)
+					if (frames[p].pos == pos)
+						return p;
+				return -1;
+			}
+			void hash_insert(off_t idx) {
+				auto& b = bucket[hash(frames[idx].pos)];
+				frames[idx].hash_next = b;
+				b = idx;
+			}
+			void hash_erase(off_t idx) {
+				auto* p = &bucket[hash(frames[idx].pos)];
+				while (*p != idx)
+					p = &frames[*p].hash_next;
+				*p = frames[idx].hash_next;
+			}
+			void list_erase(off_t idx) {
+				auto& f = frames[idx];
+				auto seg = f.hot ? 1 : 0;
+				if (f.prev != -1) frames[f.prev].next = f.next;
+				else head[seg] = f.next;
+				if (f.next != -1) frames[f.next].prev = f.prev;
+				else tail[seg] = f.prev;
+				--seg_size[seg];
+			}
+			void list_push_front(off_t idx, bool hot) {
+				auto& f = frames[idx];
+				auto seg = hot ? 1 : 0;
+				f.hot = hot;
+				f.prev = -1;
+				f.next = head[seg];
+				if (head[seg] != -1) frames[head[seg]].prev = idx;
+				else tail[seg] = idx;
+				head[seg] = idx;
+				++seg_size[seg];
+			}
+			//访问已缓存的页
+			void touch(off_t idx) {
+				if (frames[idx].hot) {
+					if (head[1] != idx) {
+						list_erase(idx);
+						list_push_front(idx, true);
+					}
+					return;
+				}
+				//紧接着的重复访问不算作再次访问
+				if (head[0] == idx)
+					return;
+				list_erase(idx);
+				list_push_front(idx, true);
+				if (seg_size[1] > hot_limit) {
+					auto victim = tail[1];
+					list_erase(victim);
+					list_push_front(victim, false);
+				}
+			}
+			//选出一个可用的页
+			off_t acquire_frame() {
+				if (free_head != -1) {
+					auto idx = free_head;
+					free_head = frames[idx].next;
+					return idx;
+				}
+				for (auto seg = 0; seg < 2; ++seg) {
+					for (auto p = tail[seg]; p != -1; p = frames[p].prev) {
+						//含有未提交修改的页不能写回
+						if (frames[p].pin_cnt || frames[p].txn == cur_txn)
+							continue;
+						if (frames[p].dirty) {
+							log->force(frames[p].lsn);
+							storage->write(frames[p].data, frames[p].pos);
+							++write_cnt;
+						}
+						hash_erase(p);
+						list_erase(p);
+						frames[p].dirty = false;
+						frames[p].pos = -1;
+						return p;
+					}
+				}
+				//所有页都被固定
+				throw runtime_error();
+			}
+			//记录直接访问的块被修改
+			void mark_dirty(off_t pos) {
+				if (pos >= flag_capacity) {
+					auto new_capacity = flag_capacity ? flag_capacity : 1024;
+					while (new_capacity <= pos)
+						new_capacity <<= 1;
+					auto new_flag = new char[new_capacity]();
+					if (flag_capacity)
+						memcpy(new_flag, dirty_flag, flag_capacity);
+					delete[] dirty_flag;
+					dirty_flag = new_flag;
+					flag_capacity = new_capacity;
+				}
+				if (dirty_flag[pos])
+					return;
+				if (dirty_cnt == dirty_capacity) {
+					dirty_capacity = dirty_capacity ? dirty_capacity << 1 : 1024;
+					auto new_list = new off_t[dirty_capacity];
+					if (dirty_cnt)
+						memcpy(new_list, dirty_list, dirty_cnt * sizeof(off_t));
+					delete[] dirty_list;
+					dirty_list = new_list;
+				}
+				dirty_flag[pos] = 1;
+				dirty_list[dirty_cnt++] = pos;
+			}
+
+		public:
+			Page_Cache(off_t page_num, Redo_Log* redo_log, Storage* block_storage) : log(redo_log), storage(block_storage) {
+				capacity = page_num < MIN_CACHE_SIZE ? MIN_CACHE_SIZE : page_num;
+				if (storage->in_place())
+					capacity = MIN_CACHE_SIZE;
+				hot_limit = capacity - (capacity >> 2);
+				frames = new Cache_Frame[capacity];
+				off_t bucket_num = 1;
+				while (bucket_num < (capacity << 1))
+					bucket_num <<= 1;
+				bucket = new off_t[bucket_num];
+				bucket_mask = bucket_num - 1;
+				reset();
+			}
+			Page_Cache(const Page_Cache&) = delete;
+			Page_Cache& operator=(const Page_Cache&) = delete;
+			~Page_Cache() {
+				delete[] frames;
+				delete[] bucket;
+				delete[] dirty_list;
+				delete[] dirty_flag;
+			}
+			void set_concurrent(bool enable) {
+				mutex.enabled = enable;
+			}
+			//固定一个页并返回其数据，load为false时不从文件读入（整页将被覆盖）
+			char* pin(off_t pos, bool load = true) {
+				if (storage->in_place())
+					return storage->address(pos);
+				std::unique_lock<Switch_Mutex> guard(mutex);
+				auto idx = lookup(pos);
+				//等待其他线程读入这一页（它可能在等待期间又被淘汰）
+				while (idx != -1 && frames[idx].loading) {
+					load_cv.wait(guard);
+					idx = lookup(pos);
+				}
+				if (idx != -1) {
+					touch(idx);
+					++frames[idx].pin_cnt;
+					return frames[idx].data;
+				}
+				idx = acquire_frame();
+				auto& f = frames[idx];
+				f.pos = pos;
+				f.pin_cnt = 1;
+				f.dirty = false;
+				f.txn = -1;
+				hash_insert(idx);
+				list_push_front(idx, false);
+				if (!load)
+					memset(f.data, 0, BLOCK_SIZE);
+				else if (!storage->parallel_read()) {
+					storage->read(f.data, pos);
+					++read_cnt;
+				}
+				else {
+					f.loading = true;
+					guard.unlock();
+					try {
+						storage->read(f.data, pos);
+					}
+					catch (...) {
+						guard.lock();
+						f.loading = false;
+						--f.pin_cnt;
+						hash_erase(idx);
+						list_erase(idx);
+						f.pos = -1;
+						f.next = free_head;
+						free_head = idx;
+						load_cv.notify_all();
+						throw;
+					}
+					guard.lock();
+					f.loading = false;
+					++read_cnt;
+					load_cv.notify_all();
+				}
+				return f.data;
+			}
+			//释放一个页，lsn不为0时表示本次修改已记入日志且属于当前未提交的操作
+			void unpin(off_t pos, bool dirty = false, off_t lsn = 0) {
+				if (storage->in_place() && !dirty)
+					return;
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				if (storage->in_place()) {
+					mark_dirty(pos);
+					return;
+				}
+				auto idx = lookup(pos);
+				if (idx == -1)
+					throw runtime_error();
+				--frames[idx].pin_cnt;
+				frames[idx].dirty |= dirty;
+				if (lsn) {
+					frames[idx].lsn = lsn;
+					frames[idx].txn = cur_txn;
+				}
+			}
+			//给已固定的页再增加一次固定
+			char* add_pin(off_t pos) {
+				if (storage->in_place())
+					return storage->address(pos);
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				auto idx = lookup(pos);
+				if (idx == -1)
+					throw runtime_error();
+				++frames[idx].pin_cnt;
+				return frames[idx].data;
+			}
+			//从存储后端读入与写回的块数（内存映射时块被直接访问，只统计写回）
+			void io_count(off_t& reads, off_t& writes) {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				reads = read_cnt;
+				writes = write_cnt;
+			}
+			//提示存储后端之后会读入pos中的块：跳过已缓存的块，相邻的块合并为一次提示，
+			//提示在锁外进行；pos会被改写，返回提示的块数
+			off_t prefetch(off_t* pos, off_t cnt) {
+				if (!storage->in_place()) {
+					std::lock_guard<Switch_Mutex> guard(mutex);
+					off_t n = 0;
+					for (off_t i = 0; i < cnt; ++i)
+						if (lookup(pos[i]) == -1)
+							pos[n++] = pos[i];
+					cnt = n;
+				}
+				std::sort(pos, pos + cnt);
+				for (off_t i = 0, j = 0; i < cnt; i = j) {
+					j = i + 1;
+					while (j < cnt && pos[j] == pos[j - 1] + 1)
+						++j;
+					storage->prefetch(pos[i], j - i);
+				}
+				return cnt;
+			}
+			//缓存被清空的次数
+			off_t get_epoch() const {
+				return epoch;
+			}
+			//提交当前操作
+			void commit() {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				++cur_txn;
+			}
+			//写回所有修改过的页并落盘
+			void flush() {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				log->force();
+				for (off_t i = 0; i < dirty_cnt; ++i) {
+					storage->write(storage->address(dirty_list[i]), dirty_list[i]);
+					dirty_flag[dirty_list[i]] = 0;
+				}
+				write_cnt += dirty_cnt;
+				dirty_cnt = 0;
+				for (off_t i = 0; i < capacity; ++i) {
+					if (frames[i].pos != -1 && frames[i].dirty) {
+						storage->write(frames[i].data, frames[i].pos);
+						frames[i].dirty = false;
+						++write_cnt;
+					}
+				}
+				storage->flush();
+			}
+			//丢弃所有页（不写回）
+			void reset() {
+				std::lock_guard<Switch_Mutex> guard(mutex);
+				++epoch;
+				for (off_t i = 0; i < dirty_cnt; ++i)
+					dirty_flag[dirty_list[i]] = 0;
+				dirty_cnt = 0;
+				for (off_t i = 0; i <= bucket_mask; ++i)
+					bucket[i] = -1;
+				for (off_t i = 0; i < capacity; ++i) {
+					frames[i].pos = -1;
+					frames[i].pin_cnt = 0;
+					frames[i].dirty = false;
+					frames[i].txn = -1;
+					frames[i].next = i + 1 < capacity ? i + 1 : -1;
+				}
+				free_head = 0;
+				head[0] = head[1] = tail[0] = tail[1] = -1;
+				seg_size[0] = seg_size[1] = 0;
+			}
+		};
+
+		//创建存储后端
+		static Storage* create_storage(StorageType type) {
+			if (type == MmapStorage)
+				return new Mmap_Storage;
+			if (type == PreadStorage)
+				return new Pread_Storage;
+			return new Stdio_Storage;
+		}
+	};
+
+	//固定数量的工作线程按提交顺序执行任务（任务不能抛出异常），析构时执行完已提交的任务再退出
+	class Task_Pool {
+	private:
+		std::thread* workers = nullptr;
+		off_t worker_num = 0;
+		std::mutex mutex;
+		std::condition_variable task_cv;
+		//环形任务队列
+		std::function<void()>* tasks = nullptr;
+		off_t head = 0, task_cnt = 0, capacity = 0;
+		bool stop = false;
+
+		void work() {
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true) {
+				task_cv.wait(lock, [this] { return stop || task_cnt; });
+				if (!task_cnt)
+					return;
+				auto task = std::move(tasks[head]);
+				tasks[head] = nullptr;
+				head = (head + 1) % capacity;
+				--task_cnt;
+				lock.unlock();
+				task();
+				lock.lock();
+			}
+		}
+
+	public:
+		explicit Task_Pool(off_t thread_num) {
+			worker_num = thread_num > 1 ? thread_num : 1;
+			capacity = 64;
+			tasks = new std::function<void()>[capacity];
+			workers = new std::thread[worker_num];
+			for (off_t i = 0; i < worker_num; ++i)
+				workers[i] = std::thread([this] { work(); });
+		}
+		Task_Pool(const Task_Pool&) = delete;
+		Task_Pool& operator=(const Task_Pool&) = delete;
+		~Task_Pool() {
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				stop = true;
+			}
+			task_cv.notify_all();
+			for (off_t i = 0; i < worker_num; ++i)
+				workers[i].join();
+			delete[] workers;
+			delete[] tasks;
+		}
+		void submit(std::function<void()> task) {
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				if (task_cnt == capacity) {
+					auto new_tasks = new std::function<void()>[capacity << 1];
+					for (off_t i = 0; i < task_cnt; ++i)
+						new_tasks[i] = std::move(tasks[(head + i) % capacity]);
+					delete[] tasks;
+					tasks = new_tasks;
+					head = 0;
+					capacity <<= 1;
+				}
+				tasks[(head + task_cnt) % capacity] = std::move(task);
+				++task_cnt;
+			}
+			task_cv.notify_one();
+		}
+	};
+
+	template <class Key, class Value, class Compare>
+	class BTree_Catalog;
+	template <class Key, class Value, class Compare, class Hash>
+	class ShardedBTree;
+
+	//PAGE_SIZE为块的字节数；INNER_FANOUT与LEAF_FANOUT指定索引结点的孩子数与叶子的元素数（为0时由PAGE_SIZE算出），
+	//文件只能用创建时的块大小打开
+	//大于VALUE_INLINE_LIMIT字节（为0时取PAGE_SIZE / 16）的Value分离存放在值块中，叶子只存它的位置，
+	//叶子的元素数只取决于关键字；值在解引用时才读出
+	template <class Key, class Value, class Compare = std::less<Key>, off_t PAGE_SIZE = 4096,
+		off_t INNER_FANOUT = 0, off_t LEAF_FANOUT = 0, off_t VALUE_INLINE_LIMIT = 0>
 	class BTree {
+		template <class K, class V, class C>
+		friend class BTree_Catalog;
+		template <class K, class V, class C, class H>
+		friend class ShardedBTree;
 	private:
 		// Your private members go here
+		//块的类别：结点、值块或空闲块，分配和释放时写入块头
+		enum Block_Kind : char { NODE_BLOCK = 1, VALUE_BLOCK = 2, FREE_BLOCK = 3 };
 		//块头
 		class Block_Head {
 		public:
 			//存储类型
 			bool block_type = false;
+			//块的类别
+			Block_Kind block_kind = NODE_BLOCK;
 			off_t size = 0;
 			off_t pos = 0;
-			off_t parent = 0;
 			off_t last = 0;
 			off_t next = 0;
 		};
 		
-		//索引数据
+		//索引数据：孩子、孩子子树中的元素个数和右边的分隔关键字
 		struct Normal_Data_Node {
 			off_t child = 0;
+			off_t count = 0;
 			Key key;
 		};
 
+		//值分离时叶子中存放的引用：值从pos块的offset字节处开始，可能跨越之后连续的块
+		class Value_Ref {
+		public:
+			off_t pos = 0;
+			off_t offset = 0;
+		};
+
 		//B+树大数据块大小
-		constexpr static off_t BLOCK_SIZE = 4096;
+		constexpr static off_t BLOCK_SIZE = PAGE_SIZE;
 		//大数据块预留数据块大小
 		constexpr static off_t INIT_SIZE = sizeof(Block_Head);
 		//Key类型的大小
 		constexpr static off_t KEY_SIZE = sizeof(Key);
 		//Value类型的大小
 		constexpr static off_t VALUE_SIZE = sizeof(Value);
+		//值超过该大小时存放在单独的值块中
+		constexpr static off_t INLINE_VALUE_SIZE = VALUE_INLINE_LIMIT ? VALUE_INLINE_LIMIT : BLOCK_SIZE / 16;
+		//是否分离存放值
+		constexpr static bool SEPARATE_VALUE = VALUE_SIZE > INLINE_VALUE_SIZE;
+		typedef std::integral_constant<bool, SEPARATE_VALUE> Separate_Tag;
+		//删除的值能放下链表指针时回收它的空间
+		constexpr static bool VALUE_REUSE = VALUE_SIZE >= off_t(sizeof(off_t));
+		//叶子中存放的值：值本身或它的引用
+		typedef typename std::conditional<SEPARATE_VALUE, Value_Ref, Value>::type Stored_Value;
+		//叶子中的元素
+		typedef pair<Key, Stored_Value> Leaf_Node;
+		//是否压缩叶子中的关键字
+		constexpr static bool PACKED_KEY = Compact_Key<Key>::value;
+		typedef std::integral_constant<bool, PACKED_KEY> Packed_Tag;
+		static_assert(!PACKED_KEY || (std::is_integral<Key>::value && !std::is_same<Key, bool>::value
+			&& sizeof(Key) >= 2 && std::is_same<Compare, std::less<Key> >::value),
+			"Compact_Key needs an integral Key of at least 2 bytes ordered by std::less");
+		//关键字对应的无符号类型，关键字压缩时用于求差值
+		typedef typename std::conditional<PACKED_KEY, std::make_unsigned<Key>,
+			std::enable_if<true, Key> >::type::type Unsigned_Key;
+		//关键字压缩时的差值：宽度为关键字的一半
+		typedef typename std::conditional<sizeof(Key) >= 8, uint32_t,
+			typename std::conditional<sizeof(Key) >= 4, uint16_t, uint8_t>::type>::type Delta;
+		//迭代器中解码关键字的缓冲（不压缩时不需要）
+		typedef typename std::conditional<PACKED_KEY, Key, char>::type Key_Buffer;
 		//大数据块能够存储孩子的个数(M)
-		constexpr static off_t BLOCK_KEY_NUM = (BLOCK_SIZE - INIT_SIZE) / sizeof(Normal_Data_Node) - 1;
-		//小数据块能够存放的记录的个数(L)
-		constexpr static off_t BLOCK_PAIR_NUM = (BLOCK_SIZE - INIT_SIZE) / (KEY_SIZE + VALUE_SIZE) - 1;
+		constexpr static off_t BLOCK_KEY_NUM = INNER_FANOUT ? INNER_FANOUT
+			: (BLOCK_SIZE - INIT_SIZE) / off_t(sizeof(Normal_Data_Node));
+		//小数据块能够存放的记录的个数(L)，关键字压缩时页中另有base和对齐的空间
+		constexpr static off_t BLOCK_PAIR_NUM = LEAF_FANOUT ? LEAF_FANOUT
+			: PACKED_KEY ? (BLOCK_SIZE - INIT_SIZE - KEY_SIZE - off_t(alignof(Stored_Value)))
+			/ off_t(sizeof(Delta) + sizeof(Stored_Value))
+			: (BLOCK_SIZE - INIT_SIZE) / off_t(sizeof(Leaf_Node));
+
+		static_assert(BLOCK_SIZE >= 256 && (BLOCK_SIZE & (BLOCK_SIZE - 1)) == 0,
+			"PAGE_SIZE must be a power of two of at least 256 bytes");
+		static_assert(BLOCK_KEY_NUM >= 4, "an index node must hold at least 4 children");
+		static_assert(BLOCK_PAIR_NUM >= 4, "a leaf must hold at least 4 pairs");
+		static_assert(INIT_SIZE + BLOCK_KEY_NUM * off_t(sizeof(Normal_Data_Node)) <= BLOCK_SIZE,
+			"index node does not fit in a page");
+		//删除后少于一半的叶子或索引结点向兄弟借或与兄弟合并
+		constexpr static off_t MIN_PAIR_NUM = BLOCK_PAIR_NUM / 2;
+		constexpr static off_t MIN_KEY_NUM = BLOCK_KEY_NUM / 2;
+		//索引结点的格式：孩子带有子树中的元素个数
+		constexpr static off_t INNER_FORMAT = 1;
+		//块头的格式：带有块的类别，值块也以块头开始
+		constexpr static off_t BLOCK_FORMAT = 1;
+		//值块中存放值的字节数
+		constexpr static off_t VALUE_AREA_SIZE = BLOCK_SIZE - INIT_SIZE;
+		//整理时三个相邻的叶子合起来不超过该大小的两倍就合并成两个
+		constexpr static off_t COALESCE_PAIR_NUM = BLOCK_PAIR_NUM * 3 / 4;
+		//整理的一步最多检查的块数
+		constexpr static off_t COMPACT_SCAN_NUM = 64;
+		//顺序扫描预读窗口的初始叶子数、默认与允许设置的最大叶子数
+		constexpr static off_t READAHEAD_MIN_NUM = 4;
+		constexpr static off_t DEFAULT_READAHEAD_NUM = 64;
+		constexpr static off_t MAX_READAHEAD_NUM = 1024;
 
 		//私有类
 		//B+树文件头
@@ -55,6 +1143,21 @@ namespace sjtu {
 			off_t data_block_rear = 0;
 			//存储大小
 			off_t size = 0;
+			//块大小（旧文件中为0，即4096）
+			off_t block_size = BLOCK_SIZE;
+			//值分离时当前值块及其中下一个空闲位置（0表示需要新的值块）
+			off_t value_block = 0;
+			off_t value_offset = 0;
+			//叶子中关键字的格式（旧文件中为0，即不压缩）
+			off_t key_format = PACKED_KEY;
+			//空闲块链表的表头（0表示为空）
+			off_t free_head = 0;
+			//空闲值链表的表头：值的字节地址pos * BLOCK_SIZE + offset（0表示为空）
+			off_t value_free = 0;
+			//索引结点的格式（旧文件中为0，即不记录子树大小）
+			off_t inner_format = INNER_FORMAT;
+			//块头的格式（旧文件中为0，即没有块的类别）
+			off_t block_format = BLOCK_FORMAT;
 		};
 
 		class Normal_Data {
@@ -63,877 +1166,5201 @@ namespace sjtu {
 		};
 
 		//叶子数据
-		class Leaf_Data {
+		class Raw_Leaf_Data {
 		public:
-			pair<Key, Value> val[BLOCK_PAIR_NUM];
+			Leaf_Node val[BLOCK_PAIR_NUM];
+
+			const Key& key(off_t index) const {
+				return val[index].first;
+			}
+			Stored_Value& value(off_t index) {
+				return val[index].second;
+			}
+			const Stored_Value& value(off_t index) const {
+				return val[index].second;
+			}
+			void set(off_t index, const Key& key, const Stored_Value& value) {
+				val[index].first = key;
+				val[index].second = value;
+			}
+			void move(off_t to, off_t from) {
+				val[to].first = val[from].first;
+				val[to].second = val[from].second;
+			}
+			//[low, high]中的关键字能否和前size个元素放在同一页
+			bool fits(const Key&, const Key&, off_t) const {
+				return true;
+			}
+			//使之后能写入不小于low的关键字
+			void rebase(const Key&, off_t) {}
 		};
 
-		//私有变量
-		//文件头
-		File_Head tree_data;
+		//关键字压缩的叶子：关键字为base加上差值，差值连续存放以便整段比较
+		class Packed_Leaf_Data {
+		public:
+			constexpr static Unsigned_Key DELTA_MAX = Unsigned_Key(Delta(-1));
 
-		//文件指针
-		static FILE* fp;
+			Key base;
+			Delta delta[BLOCK_PAIR_NUM];
+			Stored_Value stored[BLOCK_PAIR_NUM];
 
-		//私有函数
-		//块内存读取
-		template <class MEM_TYPE>
-		static void mem_read(MEM_TYPE buff, off_t buff_size, off_t pos) {
-			fseek(fp, long(buff_size * pos), SEEK_SET);
-			fread(buff, buff_size, 1, fp);
-		}
-
-		//块内存写入
-		template <class MEM_TYPE>
-		static void mem_write(MEM_TYPE buff, off_t buff_size, off_t pos) {
-			fseek(fp, long(buff_size * pos), SEEK_SET);
-			fwrite(buff, buff_size, 1, fp);
-			fflush(fp);
-		}
+			Key key(off_t index) const {
+				return Key(Unsigned_Key(base) + delta[index]);
+			}
+			Stored_Value& value(off_t index) {
+				return stored[index];
+			}
+			const Stored_Value& value(off_t index) const {
+				return stored[index];
+			}
+			//关键字不能小于base，且与base的差不能超过DELTA_MAX
+			void set(off_t index, const Key& key, const Stored_Value& value) {
+				delta[index] = Delta(Unsigned_Key(key) - Unsigned_Key(base));
+				stored[index] = value;
+			}
+			void move(off_t to, off_t from) {
+				delta[to] = delta[from];
+				stored[to] = stored[from];
+			}
+			bool fits(const Key& low, const Key& high, off_t size) const {
+				auto first = size && key(0) < low ? key(0) : low;
+				auto last = size && high < key(size - 1) ? key(size - 1) : high;
+				return Unsigned_Key(last) - Unsigned_Key(first) <= DELTA_MAX;
+			}
+			//以low和最小关键字中较小者为新的base
+			void rebase(const Key& low, off_t size) {
+				auto first = size && key(0) < low ? key(0) : low;
+				for (off_t i = 0; i < size; ++i)
+					delta[i] = Delta(Unsigned_Key(base) + delta[i] - Unsigned_Key(first));
+				base = first;
+			}
+		};
 
-		//写入B+树基本数据
-		void write_tree_data() {
-			fseek(fp, 0, SEEK_SET);
-			char buff[BLOCK_SIZE] = { 0 };
-			memcpy(buff, &tree_data, sizeof(tree_data));
-			mem_write(buff, BLOCK_SIZE, 0);
-		}
+		typedef typename std::conditional<PACKED_KEY, Packed_Leaf_Data, Raw_Leaf_Data>::type Leaf_Data;
+		static_assert(INIT_SIZE + off_t(sizeof(Leaf_Data)) <= BLOCK_SIZE, "leaf does not fit in a page");
 
-		//获取新内存
-		off_t memory_allocation() {
-			++tree_data.block_cnt;
-			write_tree_data();
-			char buff[BLOCK_SIZE] = { 0 };
-			mem_write(buff, BLOCK_SIZE, tree_data.block_cnt - 1);
-			return tree_data.block_cnt - 1;
-		}
+		//树的最大高度
+		constexpr static off_t MAX_HEIGHT = 64;
 
-		//创建新的索引结点
-		off_t create_normal_node(off_t parent) {
-			auto node_pos = memory_allocation();
-			Block_Head temp;
-			Normal_Data normal_data;
-			temp.block_type = false;
-			temp.parent = parent;
-			temp.pos = node_pos;
-			temp.size = 0;
-			write_block(&temp, &normal_data, node_pos);
-			return node_pos;
-		}
+		//查找路径：pos[0]为叶子的父亲，pos[cnt - 1]为根
+		class Tree_Path {
+		public:
+			off_t pos[MAX_HEIGHT];
+			off_t cnt = 0;
+			//最低的未满索引结点的层数（都满时为cnt），叶子分裂最多影响到这一层
+			off_t safe = 0;
+		};
 
-		//创建新的叶子结点
-		off_t create_leaf_node(off_t parent, off_t last, off_t next) {
-			auto node_pos = memory_allocation();
-			Block_Head temp;
-			Leaf_Data leaf_data;
-			temp.block_type = true;
-			temp.parent = parent;
-			temp.pos = node_pos;
-			temp.last = last;
-			temp.next = next;
-			temp.size = 0;
-			write_block(&temp, &leaf_data, node_pos);
-			return node_pos;
-		}
-	
-		//索引节点插入新索引
-		void insert_new_index(Block_Head& parent_info, Normal_Data& parent_data, 
-			off_t origin, off_t new_pos, const Key& new_index) {
+		//迭代器沿叶子链表顺序移动时的预读状态
+		class Readahead {
+		public:
+			//上一次跨入的叶子
+			off_t last = 0;
+			//是否向前驱方向移动
+			bool backward = false;
+			//连续顺序跨过的叶子数
+			off_t streak = 0;
+			//当前窗口
+			off_t window = 0;
+			//已提示预读、还没有跨入的叶子数
+			off_t remain = 0;
+			//父亲中之后的孩子是否都已提示（跨入下一个父亲的孩子时再预读）
+			bool parent_done = false;
+		};
+
+		//在线整理的进度（只在内存中，重新打开后从头开始）
+		class Compact_State {
+		public:
+			enum Phase { IDLE, LEAF, TAIL };
+			Phase phase = IDLE;
+			//下一个叶子应放的位置，之前的叶子已按链表顺序排好
+			off_t dest = 0;
+			//下一个要放置的叶子中的关键字（为空时从第一个叶子开始）
+			Key* next_key = nullptr;
+			//空闲链表中每块的前驱（-1表示不在链表中，0表示它是表头），整理期间随分配与释放维护
+			off_t* prev = nullptr;
+			off_t capacity = 0;
+			//本轮是否缩小过文件
+			bool shrunk = false;
+
+			Compact_State() = default;
+			Compact_State(const Compact_State&) = delete;
+			Compact_State& operator=(const Compact_State&) = delete;
+			~Compact_State() {
+				reset();
+			}
+			void reset() {
+				delete next_key;
+				delete[] prev;
+				next_key = nullptr;
+				prev = nullptr;
+				capacity = 0;
+				phase = IDLE;
+				shrunk = false;
+			}
+			void set_key(const Key& key) {
+				delete next_key;
+				next_key = new Key(key);
+			}
+			//记录空闲块pos的前驱
+			void set_prev(off_t pos, off_t prev_pos) {
+				if (!prev)
+					return;
+				if (pos >= capacity) {
+					auto new_capacity = std::max(pos + 1, capacity << 1);
+					auto new_prev = new off_t[new_capacity];
+					memcpy(new_prev, prev, capacity * sizeof(off_t));
+					for (auto i = capacity; i < new_capacity; ++i)
+						new_prev[i] = -1;
+					delete[] prev;
+					prev = new_prev;
+					capacity = new_capacity;
+				}
+				prev[pos] = prev_pos;
+			}
+			bool is_free(off_t pos) const {
+				return prev && pos < capacity && prev[pos] != -1;
+			}
+		};
+
+		//并发模式下删除的值的位置：叶子快照可能还要读它们，先退休，等快照释放后再放入空闲值链表
+		//快照登记在创建时的纪元中；上一纪元的快照都释放后纪元前进，此时两个纪元前退休的位置不再被任何快照引用
+		class Value_Retire {
+		public:
+			std::atomic<off_t> epoch{ 0 };
+			//每个纪元（按奇偶）仍存在的快照数
+			std::atomic<off_t> live[2];
+			//每个纪元（按奇偶）退休的位置，只在写锁下访问
+			off_t* list[2] = { nullptr, nullptr };
+			off_t cnt[2] = { 0, 0 }, capacity[2] = { 0, 0 };
+
+			Value_Retire() {
+				live[0] = live[1] = 0;
+			}
+			Value_Retire(const Value_Retire&) = delete;
+			Value_Retire& operator=(const Value_Retire&) = delete;
+			~Value_Retire() {
+				reset();
+			}
+			void reset() {
+				for (int i = 0; i < 2; ++i) {
+					delete[] list[i];
+					list[i] = nullptr;
+					cnt[i] = capacity[i] = 0;
+				}
+			}
+			//快照创建前登记，返回所在的纪元
+			off_t enter() {
+				while (true) {
+					auto cur = epoch.load();
+					live[cur & 1].fetch_add(1);
+					if (epoch.load() == cur)
+						return cur;
+					live[cur & 1].fetch_sub(1);
+				}
+			}
+			void leave(off_t cur) {
+				live[cur & 1].fetch_sub(1);
+			}
+			//上一纪元的快照都已释放时，把两个纪元前退休的位置交给release（至多max_cnt个），
+			//全部交出后前进一个纪元；返回交出的个数
+			template <class RELEASE>
+			off_t advance(RELEASE release, off_t max_cnt) {
+				auto cur = epoch.load();
+				auto old = (cur + 1) & 1;
+				if (live[old].load())
+					return 0;
+				off_t done = 0;
+				while (cnt[old] && done < max_cnt) {
+					release(list[old][--cnt[old]]);
+					++done;
+				}
+				if (!cnt[old])
+					epoch.store(cur + 1);
+				return done;
+			}
+			void retire(off_t slot) {
+				auto cur = epoch.load() & 1;
+				if (cnt[cur] == capacity[cur]) {
+					capacity[cur] = capacity[cur] ? capacity[cur] << 1 : 64;
+					auto new_list = new off_t[capacity[cur]];
+					if (cnt[cur])
+						memcpy(new_list, list[cur], cnt[cur] * sizeof(off_t));
+					delete[] list[cur];
+					list[cur] = new_list;
+				}
+				list[cur][cnt[cur]++] = slot;
+			}
+			bool empty() const {
+				return !cnt[0] && !cnt[1];
+			}
+		};
+
+		//默认缓存页数
+		constexpr static off_t DEFAULT_CACHE_SIZE = 1024;
+		//每次操作至多复用的退休值位置数
+		constexpr static off_t RETIRE_RELEASE_NUM = 8;
+		//日志超过该大小时做检查点
+		constexpr static off_t LOG_CHECKPOINT_SIZE = 1 << 24;
+		//结点内二分查找缩小到该范围后改为整段比较
+		constexpr static off_t SEARCH_WINDOW = 16;
+		//是否可以绕过Compare直接用<比较（默认比较器下的算术类型）
+		constexpr static bool DIRECT_COMPARE = std::is_arithmetic<Key>::value
+			&& std::is_same<Compare, std::less<Key> >::value;
+		//窗口内比较方式：-1使用Compare，0直接比较，4/8为可用AVX2整段比较的整数关键字字节数
+		constexpr static int SEARCH_MODE = !DIRECT_COMPARE ? -1
+			: std::is_integral<Key>::value && std::is_signed<Key>::value
+			&& (sizeof(Key) == 4 || sizeof(Key) == 8) ? int(sizeof(Key)) : 0;
+
+		//块读写、日志与缓存
+		typedef Block_Io<BLOCK_SIZE> Io;
+		typedef typename Io::Switch_Mutex Switch_Mutex;
+		typedef typename Io::Log_Record Log_Record;
+		typedef typename Io::Redo_Log Redo_Log;
+		typedef typename Io::Storage Storage;
+		typedef typename Io::Page_Cache Page_Cache;
+		constexpr static off_t LOG_UPDATE = Io::LOG_UPDATE;
+		constexpr static off_t LOG_FORMAT = Io::LOG_FORMAT;
+		constexpr static off_t LOG_COMMIT = Io::LOG_COMMIT;
+
+		//统计项
+		enum Stat_Type {
+			STAT_LEAF_READ, STAT_INNER_READ, STAT_LEAF_WRITE, STAT_INNER_WRITE,
+			STAT_VALUE_READ, STAT_VALUE_WRITE, STAT_LEAF_SPLIT, STAT_INNER_SPLIT,
+			STAT_ALLOCATION, STAT_FREE, STAT_LEAF_MERGE, STAT_INNER_MERGE,
+			STAT_RELOCATION, STAT_READAHEAD, STAT_NUM
+		};
+		//延迟直方图
+		enum Latency_Type {
+			LATENCY_INSERT, LATENCY_FIND, LATENCY_AT, LATENCY_ERASE, LATENCY_ADVANCE, LATENCY_NUM
+		};
+		constexpr static int BUCKET_NUM = BTree_Stats::Histogram::BUCKET_NUM;
+
+		//统计计数器，多个线程用relaxed原子操作累加
+		class Stats_Counter {
+		public:
+#if BPTREE_STATS
+			std::atomic<off_t> counter[STAT_NUM];
+			std::atomic<off_t> bucket[LATENCY_NUM][BUCKET_NUM];
+			std::atomic<off_t> total_ns[LATENCY_NUM];
+#endif
+			//缓存与日志的计数在上次清零时的值
+			off_t base_storage_reads = 0, base_storage_writes = 0, base_log_bytes = 0, base_log_syncs = 0;
+
+			Stats_Counter() {
+				reset();
+			}
+			void reset() {
+#if BPTREE_STATS
+				for (auto& c : counter)
+					c.store(0, std::memory_order_relaxed);
+				for (off_t i = 0; i < LATENCY_NUM; ++i) {
+					for (auto& b : bucket[i])
+						b.store(0, std::memory_order_relaxed);
+					total_ns[i].store(0, std::memory_order_relaxed);
+				}
+#endif
+			}
+#if BPTREE_STATS
+			void add(Stat_Type type, off_t delta) {
+				counter[type].fetch_add(delta, std::memory_order_relaxed);
+			}
+			void record(Latency_Type type, off_t ns) {
+				auto idx = ns > 1 ? 63 - __builtin_clzll((unsigned long long)ns) : 0;
+				bucket[type][idx < BUCKET_NUM ? idx : BUCKET_NUM - 1].fetch_add(1, std::memory_order_relaxed);
+				total_ns[type].fetch_add(ns, std::memory_order_relaxed);
+			}
+#else
+			void add(Stat_Type, off_t) {}
+			void record(Latency_Type, off_t) {}
+#endif
+		};
+
+		//给一次操作计时，析构时记入直方图；enabled为假时不计时
+		class Stat_Timer {
+#if BPTREE_STATS
+		private:
+			Stats_Counter* stats;
+			Latency_Type type;
+			bool enabled;
+			std::chrono::steady_clock::time_point start;
+		public:
+			Stat_Timer(Stats_Counter* counter, Latency_Type latency_type, bool enable = true)
+				: stats(counter), type(latency_type), enabled(enable) {
+				if (enabled)
+					start = std::chrono::steady_clock::now();
+			}
+			~Stat_Timer() {
+				if (enabled)
+					stats->record(type, std::chrono::duration_cast<std::chrono::nanoseconds>(
+						std::chrono::steady_clock::now() - start).count());
+			}
+#else
+		public:
+			Stat_Timer(Stats_Counter*, Latency_Type, bool = true) {}
+#endif
+			Stat_Timer(const Stat_Timer&) = delete;
+			Stat_Timer& operator=(const Stat_Timer&) = delete;
+		};
+
+		//迭代器移动只抽样计时
+		static bool sample_advance() {
+#if BPTREE_STATS
+			static thread_local unsigned int tick = 0;
+			return (++tick & 63) == 0;
+#else
+			return false;
+#endif
+		}
+
+		//结点闩锁表：每个块一个读写闩锁（>0为读者数，-1为写者），按块号分段分配，已分配的段不会移动
+		//读者可以重复加锁（迭代器复制时）；块0的闩锁保护文件头中的根位置
+		class Latch_Table {
+		private:
+			constexpr static off_t SEGMENT_SIZE = 1 << 14;
+			constexpr static off_t SEGMENT_NUM = 1 << 16;
+			std::atomic<std::atomic<int>*>* segment = nullptr;
+			bool enabled = false;
+
+			std::atomic<int>& get(off_t pos) {
+				auto& seg = segment[pos / SEGMENT_SIZE];
+				auto latch = seg.load(std::memory_order_acquire);
+				if (!latch) {
+					auto new_latch = new std::atomic<int>[SEGMENT_SIZE];
+					for (off_t i = 0; i < SEGMENT_SIZE; ++i)
+						new_latch[i].store(0, std::memory_order_relaxed);
+					if (seg.compare_exchange_strong(latch, new_latch, std::memory_order_acq_rel))
+						latch = new_latch;
+					else
+						delete[] new_latch;
+				}
+				return latch[pos % SEGMENT_SIZE];
+			}
+
+		public:
+			Latch_Table() = default;
+			Latch_Table(const Latch_Table&) = delete;
+			Latch_Table& operator=(const Latch_Table&) = delete;
+			~Latch_Table() {
+				if (!segment)
+					return;
+				for (off_t i = 0; i < SEGMENT_NUM; ++i)
+					delete[] segment[i].load(std::memory_order_relaxed);
+				delete[] segment;
+			}
+			//只能在没有其他线程访问时切换
+			void enable() {
+				if (!segment) {
+					segment = new std::atomic<std::atomic<int>*>[SEGMENT_NUM];
+					for (off_t i = 0; i < SEGMENT_NUM; ++i)
+						segment[i].store(nullptr, std::memory_order_relaxed);
+				}
+				enabled = true;
+			}
+			void disable() {
+				enabled = false;
+			}
+			bool is_enabled() const {
+				return enabled;
+			}
+			void lock_shared(off_t pos) {
+				if (!enabled)
+					return;
+				auto& latch = get(pos);
+				auto state = latch.load(std::memory_order_relaxed);
+				while (true) {
+					if (state >= 0) {
+						if (latch.compare_exchange_weak(state, state + 1, std::memory_order_acquire))
+							return;
+					}
+					else {
+						std::this_thread::yield();
+						state = latch.load(std::memory_order_relaxed);
+					}
+				}
+			}
+			void unlock_shared(off_t pos) {
+				if (enabled)
+					get(pos).fetch_sub(1, std::memory_order_release);
+			}
+			void lock(off_t pos) {
+				if (!enabled)
+					return;
+				auto& latch = get(pos);
+				int state = 0;
+				while (!latch.compare_exchange_weak(state, -1, std::memory_order_acquire)) {
+					std::this_thread::yield();
+					state = 0;
+				}
+			}
+			void unlock(off_t pos) {
+				if (enabled)
+					get(pos).store(0, std::memory_order_release);
+			}
+		};
+
+		//写操作持有的排他闩锁，按加锁顺序记录，析构时全部释放
+		//（删除时每层最多锁三个结点）
+		class Write_Latch {
+		private:
+			Latch_Table* table;
+			off_t pos[MAX_HEIGHT * 3 + 8];
+			off_t cnt = 0;
+		public:
+			explicit Write_Latch(Latch_Table* latch_table) : table(latch_table) {}
+			Write_Latch(const Write_Latch&) = delete;
+			Write_Latch& operator=(const Write_Latch&) = delete;
+			~Write_Latch() {
+				release();
+			}
+			void add(off_t block_pos) {
+				table->lock(block_pos);
+				pos[cnt++] = block_pos;
+			}
+			void release() {
+				while (cnt)
+					table->unlock(pos[--cnt]);
+			}
+		};
+
+		//并发模式下迭代器持有的叶子快照，迭代器的副本共享同一份
+		class Leaf_Snapshot {
+		public:
+			char data[BLOCK_SIZE];
+			std::atomic<int> ref_cnt{ 1 };
+			//复制时树的结构版本
+			off_t version = 0;
+			//登记所在的退休纪元（值分离时）
+			off_t retire_epoch = 0;
+		};
+
+		//私有变量
+		//文件头
+		File_Head tree_data;
+
+		//索引文件与重做日志的地址
+		char address[BPTREE_ADDRESS_SIZE];
+		char log_address[BPTREE_ADDRESS_SIZE + 4];
+		//没有指定地址的副本，析构时删除文件
+		bool temporary = false;
+
+		//存储后端类型
+		StorageType storage_type;
+
+		//存储后端
+		Storage* storage;
+
+		//重做日志
+		mutable Redo_Log log;
+
+		//块缓存
+		mutable Page_Cache cache;
+
+		//并发模式下串行化写操作
+		mutable Switch_Mutex write_lock;
+		//并发模式下保护元素个数
+		mutable Switch_Mutex size_lock;
+		//结点闩锁
+		mutable Latch_Table latches;
+		//结构版本：删除引起借用、合并或释放块时加一，快照迭代器据此判断快照中的前驱后继是否仍然有效
+		std::atomic<off_t> structure_version{ 0 };
+		//统计信息
+		mutable Stats_Counter stats_data;
+		//执行find_async与insert_async的线程（未启用时为空）
+		Task_Pool* async_pool = nullptr;
+		//在线整理的进度
+		Compact_State compaction;
+		//并发模式下等待复用的值位置
+		mutable Value_Retire retired_values;
+		//顺序扫描最多预读的叶子数（0表示不预读）
+		off_t readahead_num = DEFAULT_READAHEAD_NUM;
+
+		//持久化模式
+		DurabilityMode durability = PerOperation;
+		//组提交的操作数与时间间隔(ms)
+		off_t group_op_num = 64, group_interval = 10;
+		//上次写回后的修改次数
+		off_t pending_op_num = 0;
+		//上次写回的时间
+		std::chrono::steady_clock::time_point last_sync_time = std::chrono::steady_clock::now();
+
+		//私有函数
+		//设置文件地址
+		void set_address(const char* file_address) {
+			auto len = strlen(file_address);
+			if (len == 0 || len >= size_t(BPTREE_ADDRESS_SIZE))
+				throw runtime_error();
+			memcpy(address, file_address, len + 1);
+			memcpy(log_address, file_address, len);
+			memcpy(log_address + len, ".log", 5);
+		}
+
+		//累加统计项
+		void stat(Stat_Type type, off_t delta = 1) const {
+			stats_data.add(type, delta);
+		}
+		//按块头记录一次结点读
+		void stat_read(const char* page) const {
+			stat(reinterpret_cast<const Block_Head*>(page)->block_type ? STAT_LEAF_READ : STAT_INNER_READ);
+		}
+
+		//打开已有的树，文件不存在时创建
+		void open_file() {
+			if (!storage->open(address)) {
+				check_file();
+				return;
+			}
+			char buff[BLOCK_SIZE] = { 0 };
+			page_read(buff, 0);
+			memcpy(&tree_data, buff, sizeof(tree_data));
+			if ((tree_data.block_size ? tree_data.block_size : 4096) != BLOCK_SIZE || tree_data.key_format != PACKED_KEY
+				|| tree_data.inner_format != INNER_FORMAT || tree_data.block_format != BLOCK_FORMAT) {
+				cache.reset();
+				delete storage;
+				throw runtime_error();
+			}
+			tree_data.block_size = BLOCK_SIZE;
+			log.open(log_address);
+			recover();
+		}
+
+		//在自己的文件中建立other的副本
+		void copy_from(const BTree& other) {
+			if (!other.storage->is_open())
+				return;
+			other.write_checkpoint();
+			storage->create(address);
+			char buff[BLOCK_SIZE];
+			for (off_t i = 0; i < other.tree_data.block_cnt; ++i) {
+				other.storage->read(buff, i);
+				storage->write(buff, i);
+			}
+			storage->flush();
+			log.open(log_address);
+			log.truncate();
+			tree_data = other.tree_data;
+		}
+
+		//通过缓存读取整块
+		void page_read(char* buff, off_t pos) const {
+			auto page = cache.pin(pos);
+			memcpy(buff, page, BLOCK_SIZE);
+			cache.unpin(pos);
+		}
+
+		//通过缓存写入整块（不记日志，只用于可以随时重建的信息）
+		void page_write(const char* buff, off_t pos) const {
+			auto page = cache.pin(pos, false);
+			memcpy(page, buff, BLOCK_SIZE);
+			cache.unpin(pos, true);
+		}
+
+		//通过缓存写入块中从offset开始的len字节，并把变化的部分记入日志
+		void page_log_write(const char* buff, off_t len, off_t pos, off_t offset = 0) const {
+			auto page = cache.pin(pos) + offset;
+			off_t l = 0, r = len;
+			while (l < r && buff[l] == page[l])
+				++l;
+			while (r > l && buff[r - 1] == page[r - 1])
+				--r;
+			if (l == r) {
+				cache.unpin(pos);
+				return;
+			}
+			auto lsn = log.append(LOG_UPDATE, pos, offset + l, buff + l, r - l);
+			memcpy(page + l, buff + l, r - l);
+			cache.unpin(pos, true, lsn);
+		}
+
+		//为迭代器固定叶子块，返回页数据并读出块头
+		//并发模式下不长期持有闩锁，而是在共享闩锁下复制一份叶子快照
+		const char* pin_leaf(off_t pos, Block_Head& info, off_t& epoch, Leaf_Snapshot*& snapshot) const {
+			epoch = cache.get_epoch();
+			stat(STAT_LEAF_READ);
+			if (latches.is_enabled()) {
+				snapshot = new Leaf_Snapshot;
+				//快照中的值引用在快照释放前不能被复用
+				if (SEPARATE_VALUE)
+					snapshot->retire_epoch = retired_values.enter();
+				latches.lock_shared(pos);
+				snapshot->version = structure_version.load(std::memory_order_acquire);
+				auto page = cache.pin(pos);
+				memcpy(snapshot->data, page, BLOCK_SIZE);
+				cache.unpin(pos);
+				latches.unlock_shared(pos);
+				memcpy(&info, snapshot->data, sizeof(Block_Head));
+				return snapshot->data;
+			}
+			snapshot = nullptr;
+			auto page = cache.pin(pos);
+			memcpy(&info, page, sizeof(Block_Head));
+			return page;
+		}
+		//复制迭代器时再次固定同一个页（不算作一次访问）
+		const char* repin_leaf(off_t pos, off_t epoch, Leaf_Snapshot* snapshot) const {
+			if (snapshot) {
+				snapshot->ref_cnt.fetch_add(1, std::memory_order_relaxed);
+				return snapshot->data;
+			}
+			if (epoch != cache.get_epoch())
+				return nullptr;
+			return cache.add_pin(pos);
+		}
+		//释放迭代器固定的页（缓存被清空后不再释放）或快照
+		void unpin_leaf(off_t pos, off_t epoch, Leaf_Snapshot* snapshot) const {
+			if (snapshot) {
+				if (snapshot->ref_cnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					if (SEPARATE_VALUE)
+						retired_values.leave(snapshot->retire_epoch);
+					delete snapshot;
+				}
+			}
+			else if (epoch == cache.get_epoch())
+				cache.unpin(pos);
+		}
+		//修改叶子pos中第index个值
+		void modify_value(off_t pos, off_t index, const Value& value) {
+			std::lock_guard<Switch_Mutex> lock_guard(write_lock);
+			Block_Head info;
+			Leaf_Data leaf_data;
+			read_block(&info, &leaf_data, pos);
+			set_value(leaf_data.value(index), value);
+			write_block(&info, &leaf_data, pos);
+			commit_operation();
+		}
+		//修改关键字为key的值（快照迭代器的位置可能已过时），返回是否找到以及当前的位置
+		bool modify_key(const Key& key, const Value& value, off_t& pos, off_t& index) {
+			std::lock_guard<Switch_Mutex> lock_guard(write_lock);
+			pos = find_leaf(key);
+			Block_Head info;
+			Leaf_Data leaf_data;
+			read_block(&info, &leaf_data, pos);
+			index = leaf_lower_bound(leaf_data, info.size, key);
+			if (index == info.size || !key_equal(leaf_data.key(index), key))
+				return false;
+			{
+				Write_Latch guard(&latches);
+				guard.add(pos);
+				set_value(leaf_data.value(index), value);
+				write_block(&info, &leaf_data, pos);
+			}
+			commit_operation();
+			return true;
+		}
+		//迭代器是否位于末尾
+		template <class ITERATOR_TYPE>
+		bool at_end(const ITERATOR_TYPE& it) const {
+			return it.block_info.pos == tree_data.data_block_rear;
+		}
+		//从根找到key所在的叶子，迭代器指向其中第一个不小于key（upper为真时为大于key）的元素
+		template <class ITERATOR_TYPE>
+		void seek_leaf(ITERATOR_TYPE& it, const Key& key, bool upper) const {
+			auto pos = shared_find_leaf(key);
+			if (!pos) {
+				it.move_to(tree_data.data_block_rear);
+				it.cur_pos = 0;
+				return;
+			}
+			it.move_to(pos);
+			latches.unlock_shared(pos);
+			auto& data = *reinterpret_cast<const Leaf_Data*>(it.page + INIT_SIZE);
+			it.cur_pos = leaf_lower_bound(data, it.block_info.size, key);
+			if (upper && it.cur_pos < it.block_info.size && key_equal(data.key(it.cur_pos), key))
+				++it.cur_pos;
+		}
+		//迭代器指向第一个不小于key（upper为真时为大于key）的元素：它在key所在叶子之后时移到后继叶子
+		template <class ITERATOR_TYPE>
+		void seek(ITERATOR_TYPE& it, const Key& key, bool upper) const {
+			seek_leaf(it, key, upper);
+			while (it.cur_pos >= it.block_info.size && !at_end(it))
+				next_leaf(it);
+		}
+		//把叶子中第index个元素交给visit，返回是否继续；值在叶子中时直接传页中的值
+		template <class Visitor>
+		bool visit_element(const Leaf_Data& data, off_t index, Visitor& visit) const {
+			return visit_element(data, index, visit, Separate_Tag());
+		}
+		template <class Visitor>
+		bool visit_element(const Leaf_Data& data, off_t index, Visitor& visit, std::false_type) const {
+			return visit(data.key(index), data.value(index));
+		}
+		template <class Visitor>
+		bool visit_element(const Leaf_Data& data, off_t index, Visitor& visit, std::true_type) const {
+			Value value;
+			read_value(data.value(index), value);
+			return visit(data.key(index), static_cast<const Value&>(value));
+		}
+		//从根找到key所在的叶子leaf的父亲，取出父亲中leaf之后（backward为真时为之前）的至多cnt个孩子，
+		//与其他读者一样逐层加共享闩锁；返回取出的个数，途中找不到leaf（结构变过）时返回0
+		off_t sibling_leaves(const Key& key, off_t leaf, bool backward, off_t* pos, off_t cnt) const {
+			latches.lock_shared(0);
+			auto cur_pos = tree_data.root_pos;
+			if (!cur_pos || cur_pos == leaf) {
+				latches.unlock_shared(0);
+				return 0;
+			}
+			latches.lock_shared(cur_pos);
+			latches.unlock_shared(0);
+			while (true) {
+				auto page = cache.pin(cur_pos);
+				auto info = reinterpret_cast<const Block_Head*>(page);
+				if (info->block_type) {
+					cache.unpin(cur_pos);
+					latches.unlock_shared(cur_pos);
+					return 0;
+				}
+				auto normal_data = reinterpret_cast<const Normal_Data*>(page + INIT_SIZE);
+				auto index = child_index(*normal_data, info->size, key);
+				auto next_pos = normal_data->val[index].child;
+				if (next_pos == leaf) {
+					off_t n = 0;
+					if (backward) {
+						for (auto i = index - 1; i >= 0 && n < cnt; --i)
+							pos[n++] = normal_data->val[i].child;
+					}
+					else {
+						for (auto i = index + 1; i < info->size && n < cnt; ++i)
+							pos[n++] = normal_data->val[i].child;
+					}
+					cache.unpin(cur_pos);
+					latches.unlock_shared(cur_pos);
+					return n;
+				}
+				cache.unpin(cur_pos);
+				latches.lock_shared(next_pos);
+				latches.unlock_shared(cur_pos);
+				cur_pos = next_pos;
+			}
+		}
+		//迭代器从from沿链表跨入当前叶子后调用：连续顺序跨过叶子时，按父亲中记录的后续孩子提示后端预读，
+		//窗口从READAHEAD_MIN_NUM开始，预读的叶子用掉一半时翻倍（至多readahead_num）并提示下一段；
+		//跳转或改变方向后重新开始。叶子链表在文件中不连续时也只预读真正要访问的块
+		template <class ITERATOR_TYPE>
+		void read_ahead(ITERATOR_TYPE& it, off_t from, bool backward) const {
+			auto& ahead = it.ahead;
+			if (ahead.last != from || ahead.backward != backward) {
+				ahead.streak = 0;
+				ahead.window = 0;
+				ahead.remain = 0;
+				ahead.parent_done = false;
+			}
+			ahead.last = it.block_info.pos;
+			ahead.backward = backward;
+			if (ahead.remain)
+				--ahead.remain;
+			//跨过第一个叶子时还不能确定是顺序扫描
+			if (++ahead.streak == 1 || !readahead_num || !it.block_info.size
+				|| ahead.remain > (ahead.parent_done ? 0 : ahead.window / 2))
+				return;
+			ahead.window = std::min(ahead.window ? ahead.window * 2 : READAHEAD_MIN_NUM, readahead_num);
+			off_t pos[MAX_READAHEAD_NUM];
+			Key key = element_key(it.page, 0, it.key_buffer);
+			auto cnt = sibling_leaves(key, it.block_info.pos, backward, pos, ahead.window);
+			//前remain个已经提示过；在文件中紧接着当前叶子向后排列的块由系统的顺序预读读入，也不再提示
+			auto first = ahead.remain;
+			while (!backward && first < cnt && pos[first] == it.block_info.pos + 1 + first)
+				++first;
+			if (cnt > first)
+				stat(STAT_READAHEAD, cache.prefetch(pos + first, cnt - first));
+			ahead.remain = std::max(cnt, ahead.remain);
+			ahead.parent_done = cnt < ahead.window;
+		}
+		//迭代器移到后继叶子的第一个元素并按需预读
+		template <class ITERATOR_TYPE>
+		void next_leaf(ITERATOR_TYPE& it) const {
+			auto from = it.block_info.pos;
+			follow_next(it);
+			read_ahead(it, from, false);
+		}
+		//迭代器移到前驱叶子的最后一个元素并按需预读
+		template <class ITERATOR_TYPE>
+		void prev_leaf(ITERATOR_TYPE& it) const {
+			auto from = it.block_info.pos;
+			follow_prev(it);
+			read_ahead(it, from, true);
+		}
+		//迭代器移到后继叶子的第一个元素。并发模式下快照之后树的结构变过（版本不同）时，
+		//快照中的next可能已被释放，改为从根查找当前叶子最后一个关键字之后的元素
+		template <class ITERATOR_TYPE>
+		void follow_next(ITERATOR_TYPE& it) const {
+			while (true) {
+				auto from = it.block_info.pos;
+				auto version = it.snapshot ? it.snapshot->version : 0;
+				if (!it.block_info.size) {
+					it.move_to(it.block_info.next);
+					it.cur_pos = 0;
+					if (!it.snapshot || it.snapshot->version == version)
+						return;
+					//首哨兵不会被释放，重新复制它
+					it.move_to(from);
+					continue;
+				}
+				Key last = element_key(it.page, it.block_info.size - 1, it.key_buffer);
+				it.move_to(it.block_info.next);
+				it.cur_pos = 0;
+				if (!it.snapshot || it.snapshot->version == version)
+					return;
+				seek_leaf(it, last, true);
+				if (it.cur_pos < it.block_info.size || at_end(it))
+					return;
+			}
+		}
+		//沿快照中的前驱找到当前叶子真正的前驱（前驱之后可能分裂过，从它向右找），
+		//迭代器指向其最后一个元素，返回途中树的结构是否没有变过
+		template <class ITERATOR_TYPE>
+		bool walk_back(ITERATOR_TYPE& it, off_t version) const {
+			auto pos = it.block_info.pos;
+			it.move_to(it.block_info.last);
+			while (!it.snapshot || it.snapshot->version == version) {
+				if (it.block_info.next == pos || !it.block_info.next) {
+					it.cur_pos = it.block_info.size - 1;
+					return true;
+				}
+				it.move_to(it.block_info.next);
+			}
+			return false;
+		}
+		//迭代器移到前驱叶子的最后一个元素，结构变过时从根查找当前叶子第一个关键字之前的元素
+		template <class ITERATOR_TYPE>
+		void follow_prev(ITERATOR_TYPE& it) const {
+			while (true) {
+				auto version = it.snapshot ? it.snapshot->version : 0;
+				if (!it.block_info.size) {
+					auto from = it.block_info.pos;
+					if (walk_back(it, version))
+						return;
+					//尾哨兵不会被释放，重新复制它
+					it.move_to(from);
+					continue;
+				}
+				Key first = element_key(it.page, 0, it.key_buffer);
+				if (walk_back(it, version))
+					return;
+				seek_leaf(it, first, false);
+				if (it.cur_pos > 0) {
+					--it.cur_pos;
+					return;
+				}
+			}
+		}
+		//修改元素个数（并发模式下size()可能同时读取）
+		void add_size(off_t delta) {
+			std::lock_guard<Switch_Mutex> guard(size_lock);
+			tree_data.size += delta;
+		}
+
+		//写入B+树基本数据
+		void write_tree_data() const {
+			char buff[BLOCK_SIZE] = { 0 };
+			memcpy(buff, &tree_data, sizeof(tree_data));
+			page_write(buff, 0);
+		}
+
+		//检查点：把所有修改写回数据文件后清空日志
+		void write_checkpoint() const {
+			write_tree_data();
+			cache.flush();
+			log.truncate();
+		}
+
+		//重放日志中已提交的修改
+		void recover() {
+			auto committed = log.scan(log.size(), [](const Log_Record&, const char*) {});
+			log.scan(committed, [this](const Log_Record& record, const char* data) {
+				if (record.type == LOG_UPDATE) {
+					auto page = cache.pin(record.pos);
+					memcpy(page + record.offset, data, record.len);
+					cache.unpin(record.pos, true);
+				}
+				else if (record.type == LOG_FORMAT) {
+					//页可能已在缓存中（或直接映射），不能依赖pin清零
+					auto page = cache.pin(record.pos, false);
+					memset(page, 0, BLOCK_SIZE);
+					cache.unpin(record.pos, true);
+				}
+				else if (record.type == LOG_COMMIT) {
+					memcpy(&tree_data, data, sizeof(tree_data));
+				}
+			});
+			write_checkpoint();
+		}
+
+		//写入提交记录，此前的修改成为一个原子单位
+		void commit_log() {
+			log.append(LOG_COMMIT, 0, 0, (const char*)&tree_data, sizeof(tree_data));
+			cache.commit();
+			if (log.size() >= LOG_CHECKPOINT_SIZE)
+				write_checkpoint();
+		}
+
+		//一次修改操作结束，写入提交记录，并按持久化模式决定是否落盘
+		void commit_operation() {
+			commit_log();
+			++pending_op_num;
+			switch (durability) {
+			case PerOperation:
+				sync();
+				break;
+			case GroupCommit:
+				if (pending_op_num >= group_op_num
+					|| std::chrono::steady_clock::now() - last_sync_time >= std::chrono::milliseconds(group_interval))
+					sync();
+				break;
+			case Manual:
+				break;
+			}
+		}
+
+		//获取新内存：优先取空闲链表的表头，否则扩展文件
+		off_t memory_allocation() {
+			stat(STAT_ALLOCATION);
+			auto pos = tree_data.free_head;
+			if (pos) {
+				auto page = cache.pin(pos);
+				tree_data.free_head = reinterpret_cast<const Block_Head*>(page)->next;
+				cache.unpin(pos);
+				compaction.set_prev(pos, -1);
+				if (tree_data.free_head)
+					compaction.set_prev(tree_data.free_head, 0);
+			}
+			else
+				pos = tree_data.block_cnt++;
+			format_block(pos);
+			return pos;
+		}
+		//把块清零（记为新分配）
+		void format_block(off_t pos) {
+			auto lsn = log.append(LOG_FORMAT, pos, 0, nullptr, 0);
+			auto page = cache.pin(pos, false);
+			memset(page, 0, BLOCK_SIZE);
+			cache.unpin(pos, true, lsn);
+		}
+		//把不再使用的块放入空闲链表：块头的next指向原来的表头
+		void memory_free(off_t pos) {
+			stat(STAT_FREE);
+			Block_Head info;
+			info.block_kind = FREE_BLOCK;
+			info.pos = pos;
+			info.next = tree_data.free_head;
+			page_log_write(reinterpret_cast<const char*>(&info), sizeof(info), pos);
+			compaction.set_prev(pos, 0);
+			if (tree_data.free_head)
+				compaction.set_prev(tree_data.free_head, pos);
+			tree_data.free_head = pos;
+		}
+
+		//为一个分离存放的值分配空间：值块以块头开始，放得下的值依次排在值块中，更大的值占用连续的新块
+		//logged为假时不记日志（只用于批量建树，由之后的检查点保证落盘）
+		Value_Ref value_allocation(bool logged) {
+			Value_Ref ref;
+			//先复用删除的值留下的位置
+			if (logged && VALUE_REUSE)
+				release_retired_values();
+			if (logged && tree_data.value_free) {
+				ref.pos = tree_data.value_free / BLOCK_SIZE;
+				ref.offset = tree_data.value_free % BLOCK_SIZE;
+				auto page = cache.pin(ref.pos);
+				memcpy(&tree_data.value_free, page + ref.offset, sizeof(off_t));
+				cache.unpin(ref.pos);
+				return ref;
+			}
+			if (VALUE_SIZE <= VALUE_AREA_SIZE) {
+				if (!tree_data.value_block || tree_data.value_offset + VALUE_SIZE > BLOCK_SIZE) {
+					if (!logged)
+						stat(STAT_ALLOCATION);
+					tree_data.value_block = logged ? memory_allocation() : tree_data.block_cnt++;
+					tree_data.value_offset = INIT_SIZE;
+					init_value_block(tree_data.value_block, logged);
+				}
+				ref.pos = tree_data.value_block;
+				ref.offset = tree_data.value_offset;
+				tree_data.value_offset += VALUE_SIZE;
+				return ref;
+			}
+			//跨块的值需要连续的块，空闲链表中的块不一定相邻，因此总是扩展文件；
+			//删除后整段作为一个位置进入空闲值链表，由之后的值整段复用
+			ref.pos = tree_data.block_cnt;
+			ref.offset = INIT_SIZE;
+			for (off_t i = 0; i < (VALUE_SIZE + VALUE_AREA_SIZE - 1) / VALUE_AREA_SIZE; ++i) {
+				stat(STAT_ALLOCATION);
+				auto pos = tree_data.block_cnt++;
+				if (logged)
+					format_block(pos);
+				init_value_block(pos, logged);
+			}
+			return ref;
+		}
+		//写入新值块的块头
+		void init_value_block(off_t pos, bool logged) {
+			Block_Head info;
+			info.block_kind = VALUE_BLOCK;
+			info.pos = pos;
+			if (logged) {
+				page_log_write(reinterpret_cast<const char*>(&info), sizeof(info), pos);
+				return;
+			}
+			auto page = cache.pin(pos, false);
+			memset(page, 0, BLOCK_SIZE);
+			memcpy(page, &info, sizeof(info));
+			cache.unpin(pos, true);
+		}
+		//值占用的最后一块（每块的值从块头之后开始）
+		static off_t value_last_block(const Value_Ref& ref) {
+			return ref.pos + (ref.offset - INIT_SIZE + VALUE_SIZE - 1) / VALUE_AREA_SIZE;
+		}
+		//把值写入ref处，写的过程中排他地锁住值所在的块
+		void write_value(const Value_Ref& ref, const Value& value, bool logged) {
+			auto last = value_last_block(ref);
+			for (auto pos = ref.pos; pos <= last; ++pos)
+				latches.lock(pos);
+			auto src = reinterpret_cast<const char*>(&value);
+			off_t done = 0, offset = ref.offset;
+			for (auto pos = ref.pos; pos <= last; ++pos, offset = INIT_SIZE) {
+				auto len = std::min(VALUE_SIZE - done, BLOCK_SIZE - offset);
+				stat(STAT_VALUE_WRITE);
+				if (logged) {
+					char buff[BLOCK_SIZE];
+					page_read(buff, pos);
+					memcpy(buff + offset, src + done, len);
+					page_log_write(buff, offset + len, pos);
+				}
+				else {
+					auto page = cache.pin(pos);
+					memcpy(page + offset, src + done, len);
+					cache.unpin(pos, true);
+				}
+				done += len;
+			}
+			for (auto pos = ref.pos; pos <= last; ++pos)
+				latches.unlock(pos);
+		}
+		//读出ref处的值，读的过程中共享地锁住值所在的块
+		void read_value(const Value_Ref& ref, Value& value) const {
+			auto last = value_last_block(ref);
+			for (auto pos = ref.pos; pos <= last; ++pos)
+				latches.lock_shared(pos);
+			auto dst = reinterpret_cast<char*>(&value);
+			off_t done = 0, offset = ref.offset;
+			for (auto pos = ref.pos; pos <= last; ++pos, offset = INIT_SIZE) {
+				auto len = std::min(VALUE_SIZE - done, BLOCK_SIZE - offset);
+				stat(STAT_VALUE_READ);
+				auto page = cache.pin(pos);
+				memcpy(dst + done, page + offset, len);
+				cache.unpin(pos);
+				done += len;
+			}
+			for (auto pos = ref.pos; pos <= last; ++pos)
+				latches.unlock_shared(pos);
+		}
+
+		//新元素在叶子中存放的值：值分离时写入新分配的空间
+		Stored_Value new_value(const Value& value, bool logged = true) {
+			return new_value(value, logged, Separate_Tag());
+		}
+		Value new_value(const Value& value, bool, std::false_type) {
+			return value;
+		}
+		Value_Ref new_value(const Value& value, bool logged, std::true_type) {
+			auto ref = value_allocation(logged);
+			write_value(ref, value, logged);
+			return ref;
+		}
+		//删除元素的值：值分离时把它的位置放入空闲值链表，开头存放原来的表头；
+		//并发模式下叶子快照可能还要读这个值，先退休，等引用它的快照都释放后再放入链表
+		void free_value(const Value&) {}
+		void free_value(const Value_Ref& ref) {
+			if (!VALUE_REUSE)
+				return;
+			release_retired_values();
+			if (latches.is_enabled())
+				retired_values.retire(ref.pos * BLOCK_SIZE + ref.offset);
+			else
+				push_free_value(ref.pos * BLOCK_SIZE + ref.offset);
+		}
+		//把至多max_cnt个已没有快照引用的退休位置放入空闲值链表，返回放入的个数
+		//每放入一个都修改一页，而未提交的页不能换出，因此一次操作只放入少量
+		off_t release_retired_values(off_t max_cnt = RETIRE_RELEASE_NUM) {
+			off_t done = 0;
+			for (int i = 0; i < 2 && done < max_cnt && !retired_values.empty(); ++i)
+				done += retired_values.advance([this](off_t slot) { push_free_value(slot); }, max_cnt - done);
+			return done;
+		}
+		//没有其他线程时放入所有可以放入的退休位置，分批提交
+		void drain_retired_values() {
+			while (release_retired_values())
+				commit_log();
+		}
+		void push_free_value(off_t slot) {
+			auto pos = slot / BLOCK_SIZE, offset = slot % BLOCK_SIZE;
+			stat(STAT_VALUE_WRITE);
+			latches.lock(pos);
+			char buff[BLOCK_SIZE];
+			page_read(buff, pos);
+			memcpy(buff + offset, &tree_data.value_free, sizeof(off_t));
+			page_log_write(buff, offset + sizeof(off_t), pos);
+			latches.unlock(pos);
+			tree_data.value_free = slot;
+		}
+		//修改已有元素的值：值分离时原地覆盖
+		void set_value(Value& stored, const Value& value) {
+			stored = value;
+		}
+		void set_value(Value_Ref& stored, const Value& value) {
+			write_value(stored, value, true);
+		}
+		//叶子中存放的值对应的值
+		Value load_value(const Value& stored) const {
+			return stored;
+		}
+		Value load_value(const Value_Ref& stored) const {
+			Value value;
+			read_value(stored, value);
+			return value;
+		}
+		//迭代器取第index个元素：值在叶子中且关键字未压缩时直接返回页中的元素，
+		//否则解码出元素并缓存在loaded中（loaded_pos记录它对应的位置）
+		const pair<const Key, Value>& load_element(const char* page, off_t index, pair<const Key, Value>*& loaded, off_t& loaded_pos) const {
+			return load_element(page, index, loaded, loaded_pos, std::integral_constant<bool, SEPARATE_VALUE || PACKED_KEY>());
+		}
+		const pair<const Key, Value>& load_element(const char* page, off_t index, pair<const Key, Value>*&, off_t&, std::false_type) const {
+			return reinterpret_cast<const pair<const Key, Value>*>(page + INIT_SIZE)[index];
+		}
+		const pair<const Key, Value>& load_element(const char* page, off_t index, pair<const Key, Value>*& loaded, off_t& loaded_pos, std::true_type) const {
+			if (loaded && loaded_pos == index)
+				return *loaded;
+			auto& data = *reinterpret_cast<const Leaf_Data*>(page + INIT_SIZE);
+			delete loaded;
+			loaded = new pair<const Key, Value>(data.key(index), load_value(data.value(index)));
+			loaded_pos = index;
+			return *loaded;
+		}
+
+		//迭代器取第index个关键字，关键字压缩时解码到buffer中
+		static const Key& element_key(const char* page, off_t index, Key_Buffer& buffer) {
+			return element_key(page, index, buffer, Packed_Tag());
+		}
+		static const Key& element_key(const char* page, off_t index, Key_Buffer&, std::false_type) {
+			return reinterpret_cast<const Leaf_Data*>(page + INIT_SIZE)->key(index);
+		}
+		static const Key& element_key(const char* page, off_t index, Key_Buffer& buffer, std::true_type) {
+			buffer = reinterpret_cast<const Leaf_Data*>(page + INIT_SIZE)->key(index);
+			return buffer;
+		}
+
+		//写入尚未被任何已提交状态引用的新块（不记日志，由之后的检查点保证落盘）
+		template <class DATA_TYPE>
+		void write_new_block(Block_Head* info, DATA_TYPE* data, off_t pos) const {
+			stat(info->block_type ? STAT_LEAF_WRITE : STAT_INNER_WRITE);
+			auto page = cache.pin(pos, false);
+			memset(page, 0, BLOCK_SIZE);
+			memcpy(page, info, sizeof(Block_Head));
+			memcpy(page + INIT_SIZE, data, sizeof(DATA_TYPE));
+			cache.unpin(pos, true);
+		}
+
+		//创建新的索引结点
+		off_t create_normal_node() {
+			auto node_pos = memory_allocation();
+			Block_Head temp;
+			Normal_Data normal_data;
+			temp.block_type = false;
+			temp.pos = node_pos;
+			temp.size = 0;
+			write_block(&temp, &normal_data, node_pos);
+			return node_pos;
+		}
+
+		//创建新的叶子结点
+		off_t create_leaf_node(off_t last, off_t next) {
+			auto node_pos = memory_allocation();
+			Block_Head temp;
+			//空叶子的内容不会被读取，清零以免把未初始化的字节写进日志
+			Leaf_Data leaf_data = Leaf_Data();
+			temp.block_type = true;
+			temp.pos = node_pos;
+			temp.last = last;
+			temp.next = next;
+			temp.size = 0;
+			write_block(&temp, &leaf_data, node_pos);
+			return node_pos;
+		}
+	
+		//索引节点插入新索引：new_pos接在origin之后，origin的子树中有moved个元素移到了new_pos
+		void insert_new_index(Block_Head& parent_info, Normal_Data& parent_data, 
+			off_t origin, off_t new_pos, const Key& new_index, off_t moved) {
 			++parent_info.size;
 			auto p = parent_info.size - 2;
 			while (parent_data.val[p].child != origin) {
 				parent_data.val[p + 1] = parent_data.val[p];
 				--p;
 			}
-			parent_data.val[p + 1].key = parent_data.val[p].key;
-			parent_data.val[p].key = new_index;
-			parent_data.val[p + 1].child = new_pos;
+			parent_data.val[p + 1].key = parent_data.val[p].key;
+			parent_data.val[p].key = new_index;
+			parent_data.val[p + 1].child = new_pos;
+			parent_data.val[p + 1].count = moved;
+			parent_data.val[p].count -= moved;
+		}
+
+		//读取结点信息
+		template <class DATA_TYPE>
+		void read_block(Block_Head* info, DATA_TYPE* data, off_t pos) const
+		{
+			auto page = cache.pin(pos);
+			stat_read(page);
+			memcpy(info, page, sizeof(Block_Head));
+			memcpy(data, page + INIT_SIZE, sizeof(DATA_TYPE));
+			cache.unpin(pos);
+		}
+		//写入节点信息
+		template <class DATA_TYPE>
+		void write_block(Block_Head* info, DATA_TYPE* data, off_t pos) const {
+			stat(info->block_type ? STAT_LEAF_WRITE : STAT_INNER_WRITE);
+			char buff[BLOCK_SIZE];
+			memcpy(buff, info, sizeof(Block_Head));
+			memcpy(buff + INIT_SIZE, data, sizeof(DATA_TYPE));
+			page_log_write(buff, INIT_SIZE + sizeof(DATA_TYPE), pos);
+		}
+
+		//关键字比较
+		static bool key_less(const Key& lhs, const Key& rhs) {
+			return Compare()(lhs, rhs);
+		}
+		static bool key_equal(const Key& lhs, const Key& rhs) {
+			return !Compare()(lhs, rhs) && !Compare()(rhs, lhs);
+		}
+		static const Key& key_of(const Normal_Data_Node& node) {
+			return node.key;
+		}
+		static const Key& key_of(const Leaf_Node& node) {
+			return node.first;
+		}
+
+		//统计窗口内关键字小于key（upper为真时为不大于key）的个数
+		template <class NODE_TYPE>
+		static off_t count_window(const NODE_TYPE* base, off_t len, const Key& key, bool upper,
+			std::integral_constant<int, -1>) {
+			off_t cnt = 0;
+			if (upper)
+				for (off_t i = 0; i < len; ++i)
+					cnt += !key_less(key, key_of(base[i]));
+			else
+				for (off_t i = 0; i < len; ++i)
+					cnt += key_less(key_of(base[i]), key);
+			return cnt;
+		}
+		template <class NODE_TYPE>
+		static off_t count_window(const NODE_TYPE* base, off_t len, const Key& key, bool upper,
+			std::integral_constant<int, 0>) {
+			off_t cnt = 0;
+			if (upper)
+				for (off_t i = 0; i < len; ++i)
+					cnt += !(key < key_of(base[i]));
+			else
+				for (off_t i = 0; i < len; ++i)
+					cnt += key_of(base[i]) < key;
+			return cnt;
+		}
+#ifdef __AVX2__
+		//32位整数关键字：一次gather比较8个
+		template <class NODE_TYPE>
+		static off_t count_window(const NODE_TYPE* base, off_t len, const Key& key, bool upper,
+			std::integral_constant<int, 4>) {
+			const auto stride = int(sizeof(NODE_TYPE));
+			const auto index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+			const auto target = _mm256_set1_epi32(int(key));
+			off_t cnt = 0, i = 0;
+			for (; i + 8 <= len; i += 8) {
+				auto keys = _mm256_i32gather_epi32((const int*)&key_of(base[i]), index, 1);
+				auto mask = upper ? _mm256_cmpgt_epi32(keys, target) : _mm256_cmpgt_epi32(target, keys);
+				auto bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+				cnt += upper ? 8 - bits : bits;
+			}
+			return cnt + count_window(base + i, len - i, key, upper, std::integral_constant<int, 0>());
+		}
+		//64位整数关键字：一次gather比较4个
+		template <class NODE_TYPE>
+		static off_t count_window(const NODE_TYPE* base, off_t len, const Key& key, bool upper,
+			std::integral_constant<int, 8>) {
+			const auto stride = (long long)sizeof(NODE_TYPE);
+			const auto index = _mm256_setr_epi64x(0, stride, stride * 2, stride * 3);
+			const auto target = _mm256_set1_epi64x((long long)key);
+			off_t cnt = 0, i = 0;
+			for (; i + 4 <= len; i += 4) {
+				auto keys = _mm256_i64gather_epi64((const long long*)&key_of(base[i]), index, 1);
+				auto mask = upper ? _mm256_cmpgt_epi64(keys, target) : _mm256_cmpgt_epi64(target, keys);
+				auto bits = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(mask)));
+				cnt += upper ? 4 - bits : bits;
+			}
+			return cnt + count_window(base + i, len - i, key, upper, std::integral_constant<int, 0>());
+		}
+#else
+		template <class NODE_TYPE>
+		static off_t count_window(const NODE_TYPE* base, off_t len, const Key& key, bool upper,
+			std::integral_constant<int, 4>) {
+			return count_window(base, len, key, upper, std::integral_constant<int, 0>());
+		}
+		template <class NODE_TYPE>
+		static off_t count_window(const NODE_TYPE* base, off_t len, const Key& key, bool upper,
+			std::integral_constant<int, 8>) {
+			return count_window(base, len, key, upper, std::integral_constant<int, 0>());
+		}
+#endif
+
+		//无分支二分查找：返回有序数组中第一个不小于key（upper为真时为大于key）的位置
+		template <class NODE_TYPE>
+		static off_t search_node(const NODE_TYPE* first, off_t len, const Key& key, bool upper) {
+			auto base = first;
+			while (len > SEARCH_WINDOW) {
+				auto half = len >> 1;
+				auto& mid = key_of(base[half - 1]);
+				base = (upper ? !key_less(key, mid) : key_less(mid, key)) ? base + half : base;
+				len -= half;
+			}
+			return (base - first) + count_window(base, len, key, upper, std::integral_constant<int, SEARCH_MODE>());
+		}
+
+		//统计差值窗口内小于target的个数
+		template <class DELTA_TYPE>
+		static off_t count_delta(const DELTA_TYPE* base, off_t len, DELTA_TYPE target) {
+			off_t cnt = 0;
+			for (off_t i = 0; i < len; ++i)
+				cnt += base[i] < target;
+			return cnt;
+		}
+#ifdef __AVX2__
+		//32位差值连续存放：一次比较8个，翻转符号位后用有符号比较
+		static off_t count_delta(const uint32_t* base, off_t len, uint32_t target) {
+			const auto sign = _mm256_set1_epi32(int(0x80000000u));
+			const auto bound = _mm256_xor_si256(_mm256_set1_epi32(int(target)), sign);
+			off_t cnt = 0, i = 0;
+			for (; i + 8 <= len; i += 8) {
+				auto deltas = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(base + i)), sign);
+				auto mask = _mm256_cmpgt_epi32(bound, deltas);
+				cnt += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+			}
+			for (; i < len; ++i)
+				cnt += base[i] < target;
+			return cnt;
+		}
+#endif
+		//差值数组中第一个不小于target的位置
+		static off_t search_delta(const Delta* first, off_t len, Delta target) {
+			auto base = first;
+			while (len > SEARCH_WINDOW) {
+				auto half = len >> 1;
+				base = base[half - 1] < target ? base + half : base;
+				len -= half;
+			}
+			return (base - first) + count_delta(base, len, target);
+		}
+
+		//索引结点中key所在的孩子
+		static off_t child_index(const Normal_Data& data, off_t size, const Key& key) {
+			return search_node(data.val, size - 1, key, true);
+		}
+
+		//叶子结点中第一个不小于key的位置
+		static off_t leaf_lower_bound(const Leaf_Data& data, off_t size, const Key& key) {
+			return leaf_lower_bound(data, size, key, Packed_Tag());
+		}
+		static off_t leaf_lower_bound(const Leaf_Data& data, off_t size, const Key& key, std::false_type) {
+			return search_node(data.val, size, key, false);
+		}
+		//关键字压缩时在差值数组中查找
+		static off_t leaf_lower_bound(const Leaf_Data& data, off_t size, const Key& key, std::true_type) {
+			if (size == 0 || !(data.base < key))
+				return 0;
+			auto diff = Unsigned_Key(key) - Unsigned_Key(data.base);
+			if (diff > Leaf_Data::DELTA_MAX)
+				return size;
+			return search_delta(data.delta, size, Delta(diff));
+		}
+
+		//创建文件
+		void check_file() {
+			if (!storage->is_open()) {
+				//创建新的树
+				storage->create(address);
+				log.open(log_address);
+				log.truncate();
+				write_tree_data();
+
+				auto node_head = tree_data.block_cnt,
+					node_rear = tree_data.block_cnt + 1;
+
+				tree_data.data_block_head = node_head;
+				tree_data.data_block_rear = node_rear;
+
+				create_leaf_node(0, node_rear);
+				create_leaf_node(node_head, 0);
+				write_checkpoint();
+			}
+		}
+		
+		
+		//从根找到key所在的叶子（只读），path不为空时记录经过的索引结点，
+		//fence不为空时，has_fence为真表示*fence为该叶子之后第一个叶子的最小关键字
+		off_t find_leaf(const Key& key, Tree_Path* path = nullptr, Key* fence = nullptr, bool* has_fence = nullptr) const {
+			off_t cur_pos = tree_data.root_pos, depth = 0, safe = -1;
+			off_t trace[MAX_HEIGHT];
+			if (has_fence)
+				*has_fence = false;
+			while (true) {
+				auto page = cache.pin(cur_pos);
+				stat_read(page);
+				auto info = reinterpret_cast<const Block_Head*>(page);
+				if (info->block_type) {
+					cache.unpin(cur_pos);
+					break;
+				}
+				auto normal_data = reinterpret_cast<const Normal_Data*>(page + INIT_SIZE);
+				auto child_pos = child_index(*normal_data, info->size, key);
+				if (fence && child_pos < info->size - 1) {
+					*fence = normal_data->val[child_pos].key;
+					*has_fence = true;
+				}
+				auto next_pos = normal_data->val[child_pos].child;
+				if (info->size < BLOCK_KEY_NUM)
+					safe = depth;
+				cache.unpin(cur_pos);
+				if (depth == MAX_HEIGHT)
+					throw runtime_error();
+				trace[depth++] = cur_pos;
+				cur_pos = next_pos;
+			}
+			if (path) {
+				path->cnt = depth;
+				for (off_t i = 0; i < depth; ++i)
+					path->pos[i] = trace[depth - 1 - i];
+				path->safe = safe == -1 ? depth : depth - 1 - safe;
+			}
+			return cur_pos;
+		}
+
+		//读者从根找到key所在的叶子：逐层先给孩子加共享闩锁再释放父亲，
+		//返回时叶子仍持有共享闩锁；树为空时返回0
+		off_t shared_find_leaf(const Key& key) const {
+			latches.lock_shared(0);
+			auto cur_pos = tree_data.root_pos;
+			if (!cur_pos) {
+				latches.unlock_shared(0);
+				return 0;
+			}
+			latches.lock_shared(cur_pos);
+			latches.unlock_shared(0);
+			while (true) {
+				auto page = cache.pin(cur_pos);
+				stat_read(page);
+				auto info = reinterpret_cast<const Block_Head*>(page);
+				if (info->block_type) {
+					cache.unpin(cur_pos);
+					return cur_pos;
+				}
+				auto normal_data = reinterpret_cast<const Normal_Data*>(page + INIT_SIZE);
+				auto next_pos = normal_data->val[child_index(*normal_data, info->size, key)].child;
+				cache.unpin(cur_pos);
+				latches.lock_shared(next_pos);
+				latches.unlock_shared(cur_pos);
+				cur_pos = next_pos;
+			}
+		}
+
+		//在key所在的叶子中查找key，找到叶子时它仍持有共享闩锁（由调用者释放）
+		bool locate(const Key& key, off_t& leaf_pos, off_t& value_pos) const {
+			leaf_pos = shared_find_leaf(key);
+			if (!leaf_pos)
+				return false;
+			auto page = cache.pin(leaf_pos);
+			auto info = reinterpret_cast<const Block_Head*>(page);
+			auto leaf_data = reinterpret_cast<const Leaf_Data*>(page + INIT_SIZE);
+			value_pos = leaf_lower_bound(*leaf_data, info->size, key);
+			auto found = value_pos < info->size && key_equal(leaf_data->key(value_pos), key);
+			cache.unpin(leaf_pos);
+			return found;
+		}
+
+		//从根往下累加key所在孩子左边的子树大小，返回关键字小于key的元素个数（可与其他读者并发）
+		off_t rank_of(const Key& key) const {
+			latches.lock_shared(0);
+			auto cur_pos = tree_data.root_pos;
+			if (!cur_pos) {
+				latches.unlock_shared(0);
+				return 0;
+			}
+			latches.lock_shared(cur_pos);
+			latches.unlock_shared(0);
+			off_t rank = 0;
+			while (true) {
+				auto page = cache.pin(cur_pos);
+				stat_read(page);
+				auto info = reinterpret_cast<const Block_Head*>(page);
+				if (info->block_type) {
+					rank += leaf_lower_bound(*reinterpret_cast<const Leaf_Data*>(page + INIT_SIZE), info->size, key);
+					cache.unpin(cur_pos);
+					latches.unlock_shared(cur_pos);
+					return rank;
+				}
+				auto normal_data = reinterpret_cast<const Normal_Data*>(page + INIT_SIZE);
+				auto index = child_index(*normal_data, info->size, key);
+				for (off_t i = 0; i < index; ++i)
+					rank += normal_data->val[i].count;
+				auto next_pos = normal_data->val[index].child;
+				cache.unpin(cur_pos);
+				latches.lock_shared(next_pos);
+				latches.unlock_shared(cur_pos);
+				cur_pos = next_pos;
+			}
+		}
+		//从根往下按子树大小找第k个元素（从0开始）所在的叶子，k变为它在叶子中的位置，
+		//返回时叶子仍持有共享闩锁；k超出范围时返回0
+		off_t select_leaf(off_t& k) const {
+			latches.lock_shared(0);
+			auto cur_pos = tree_data.root_pos;
+			if (!cur_pos || k < 0) {
+				latches.unlock_shared(0);
+				return 0;
+			}
+			latches.lock_shared(cur_pos);
+			latches.unlock_shared(0);
+			while (true) {
+				auto page = cache.pin(cur_pos);
+				stat_read(page);
+				auto info = reinterpret_cast<const Block_Head*>(page);
+				auto size = info->size;
+				if (info->block_type) {
+					cache.unpin(cur_pos);
+					if (k < size)
+						return cur_pos;
+					latches.unlock_shared(cur_pos);
+					return 0;
+				}
+				auto normal_data = reinterpret_cast<const Normal_Data*>(page + INIT_SIZE);
+				off_t index = 0;
+				while (index < size && k >= normal_data->val[index].count)
+					k -= normal_data->val[index++].count;
+				auto next_pos = index < size ? normal_data->val[index].child : 0;
+				cache.unpin(cur_pos);
+				if (next_pos)
+					latches.lock_shared(next_pos);
+				latches.unlock_shared(cur_pos);
+				if (!next_pos)
+					return 0;
+				cur_pos = next_pos;
+			}
+		}
+
+		//读出key的值（可与其他读者并发），不存在时返回false，树为空时leaf_pos为0
+		bool read_at(const Key& key, Value& value, off_t& leaf_pos) const {
+			leaf_pos = shared_find_leaf(key);
+			if (!leaf_pos)
+				return false;
+			auto page = cache.pin(leaf_pos);
+			auto info = reinterpret_cast<const Block_Head*>(page);
+			auto leaf_data = reinterpret_cast<const Leaf_Data*>(page + INIT_SIZE);
+			auto value_pos = leaf_lower_bound(*leaf_data, info->size, key);
+			auto found = value_pos < info->size && key_equal(leaf_data->key(value_pos), key);
+			if (found)
+				value = load_value(leaf_data->value(value_pos));
+			cache.unpin(leaf_pos);
+			latches.unlock_shared(leaf_pos);
+			return found;
+		}
+
+		//在异步线程上执行job，未启用异步线程时直接执行
+		template <class RESULT_TYPE>
+		std::future<RESULT_TYPE> submit_async(std::function<RESULT_TYPE()> job) const {
+			auto task = std::make_shared<std::packaged_task<RESULT_TYPE()> >(std::move(job));
+			auto result = task->get_future();
+			if (async_pool)
+				async_pool->submit([task] { (*task)(); });
+			else
+				(*task)();
+			return result;
+		}
+
+		//按自顶向下、从左到右的顺序锁住一次插入要修改的块：整条路径（子树大小都会变）和叶子，
+		//叶子分裂时还有它的后继（祖先都满时还有保护根位置的块0）
+		void latch_insert(Write_Latch& guard, const Tree_Path& path, off_t leaf_pos, bool split, off_t next_pos) const {
+			if (split && path.safe == path.cnt)
+				guard.add(0);
+			for (auto i = path.cnt - 1; i >= 0; --i)
+				guard.add(path.pos[i]);
+			guard.add(leaf_pos);
+			if (split)
+				guard.add(next_pos);
+		}
+
+		//新建根结点，原来的根（子树中有count个元素）作为它唯一的孩子
+		off_t grow_root(Tree_Path& path, off_t count) {
+			auto origin_root = tree_data.root_pos;
+			auto root_pos = create_normal_node();
+			Block_Head root_info;
+			Normal_Data root_data;
+			read_block(&root_info, &root_data, root_pos);
+			root_info.size = 1;
+			root_data.val[0].child = origin_root;
+			root_data.val[0].count = count;
+			write_block(&root_info, &root_data, root_pos);
+			tree_data.root_pos = root_pos;
+			path.pos[path.cnt++] = root_pos;
+			return root_pos;
+		}
+
+		//从中间分裂叶子结点，path为从叶子的父亲到根的路径，返回新叶子的最小关键字
+		Key split_leaf_node(off_t pos, Block_Head& origin_info, Leaf_Data& origin_data, Tree_Path& path) {
+			auto mid_pos = origin_info.size >> 1;
+			return split_leaf_node(pos, origin_info, origin_data, path, mid_pos, origin_data.key(mid_pos));
+		}
+		//把[mid_pos, size)移入新的叶子，separator为新叶子在父亲中的关键字（新叶子为空时由调用者给出）
+		Key split_leaf_node(off_t pos, Block_Head& origin_info, Leaf_Data& origin_data, Tree_Path& path,
+			off_t mid_pos, Key separator) {
+			stat(STAT_LEAF_SPLIT);
+			//判断是否为根结点
+			if (path.cnt == 0)
+				grow_root(path, origin_info.size);
+			split_parent(path, 0, pos);
+
+			//读入数据
+			auto parent_pos = path.pos[0];
+			Block_Head parent_info;
+			Normal_Data parent_data;
+			read_block(&parent_info, &parent_data, parent_pos);
+
+			//创建一个新的子结点
+			auto new_pos = create_leaf_node(pos, origin_info.next);
+			
+			//修改后继结点的前驱
+			auto tmp_pos = origin_info.next;
+			Block_Head tmp_info;
+			Leaf_Data tmp_data;
+			read_block(&tmp_info, &tmp_data, tmp_pos);
+			tmp_info.last = new_pos;
+			write_block(&tmp_info, &tmp_data, tmp_pos);
+			origin_info.next = new_pos;
+
+			Block_Head new_info;
+			Leaf_Data new_data;
+			read_block(&new_info, &new_data, new_pos);
+
+			//移动数据的位置
+			new_data.rebase(separator, 0);
+			for (off_t p = mid_pos, i = 0; p < origin_info.size; ++p, ++i) {
+				new_data.set(i, origin_data.key(p), origin_data.value(p));
+				++new_info.size;
+			}
+			origin_info.size = mid_pos;
+			insert_new_index(parent_info, parent_data, pos, new_pos, separator, new_info.size);
+
+			//写入
+			write_block(&origin_info, &origin_data, pos);
+			write_block(&new_info, &new_data, new_pos);
+			write_block(&parent_info, &parent_data, parent_pos);
+
+			return separator;
+		}
+
+		//保证路径上第level个索引结点还能插入孩子，已满则分裂，
+		//分裂后path[level]更新为孩子child所在的那一半
+		void split_parent(Tree_Path& path, off_t level, off_t child) {
+			//读入数据
+			auto origin_pos = path.pos[level];
+			Block_Head origin_info;
+			Normal_Data origin_data;
+			read_block(&origin_info, &origin_data, origin_pos);
+			if (origin_info.size < BLOCK_KEY_NUM)
+				return;
+			stat(STAT_INNER_SPLIT);
+
+			//判断是否为根结点
+			if (level == path.cnt - 1)
+				grow_root(path, subtree_count(origin_info, origin_data));
+			split_parent(path, level + 1, origin_pos);
+			auto parent_pos = path.pos[level + 1];
+			Block_Head parent_info;
+			Normal_Data parent_data;
+			read_block(&parent_info, &parent_data, parent_pos);
+
+			//创建一个新的子结点
+			auto new_pos = create_normal_node();
+			Block_Head new_info;
+			Normal_Data new_data;
+			read_block(&new_info, &new_data, new_pos);
+
+			//移动数据的位置：两半各有至少一半的孩子（删除的调整依赖这一下限）
+			off_t mid_pos = (origin_info.size >> 1) - 1;
+			for (off_t p = mid_pos + 1, i = 0; p < origin_info.size; ++p,++i) {
+				if (origin_data.val[p].child == child) {
+					path.pos[level] = new_pos;
+				}
+				std::swap(new_data.val[i], origin_data.val[p]);
+				++new_info.size;
+			}
+			origin_info.size = mid_pos + 1;
+			insert_new_index(parent_info, parent_data, origin_pos, new_pos, origin_data.val[mid_pos].key,
+				subtree_count(new_info, new_data));
+			
+			//写入
+			write_block(&origin_info, &origin_data, origin_pos);
+			write_block(&new_info, &new_data, new_pos);
+			write_block(&parent_info, &parent_data, parent_pos);
+		}
+
+		//读出结点中元素或孩子的个数
+		off_t node_size(off_t pos) const {
+			auto page = cache.pin(pos);
+			stat_read(page);
+			auto size = reinterpret_cast<const Block_Head*>(page)->size;
+			cache.unpin(pos);
+			return size;
+		}
+
+		//索引结点子树中的元素个数
+		static off_t subtree_count(const Block_Head& info, const Normal_Data& data) {
+			off_t count = 0;
+			for (off_t i = 0; i < info.size; ++i)
+				count += data.val[i].count;
+			return count;
+		}
+		//索引结点pos中孩子child的子树大小加上delta（只写入这一项）
+		void add_child_count(off_t pos, off_t child, off_t delta) {
+			auto page = cache.pin(pos);
+			auto info = reinterpret_cast<const Block_Head*>(page);
+			auto data = reinterpret_cast<const Normal_Data*>(page + INIT_SIZE);
+			auto& node = data->val[child_position(*info, *data, child)];
+			auto offset = off_t(reinterpret_cast<const char*>(&node.count) - page);
+			auto count = node.count + delta;
+			cache.unpin(pos);
+			stat(STAT_INNER_WRITE);
+			page_log_write(reinterpret_cast<const char*>(&count), sizeof(count), pos, offset);
+		}
+		//叶子leaf中的元素个数加上delta后修改路径上各祖先中的子树大小
+		void add_path_count(const Tree_Path& path, off_t leaf, off_t delta) {
+			for (off_t level = 0; level < path.cnt; ++level) {
+				add_child_count(path.pos[level], leaf, delta);
+				leaf = path.pos[level];
+			}
+		}
+
+		//索引结点中孩子child的位置
+		static off_t child_position(const Block_Head& info, const Normal_Data& data, off_t child) {
+			off_t index = 0;
+			while (index < info.size && data.val[index].child != child)
+				++index;
+			return index;
+		}
+
+		//删去索引结点的第index个孩子及其左边的关键字（index为0时为右边的）
+		static void remove_child(Block_Head& info, Normal_Data& data, off_t index) {
+			for (auto p = index; p < info.size - 1; ++p) {
+				data.val[p].child = data.val[p + 1].child;
+				data.val[p].count = data.val[p + 1].count;
+			}
+			for (auto p = index ? index - 1 : 0; p < info.size - 2; ++p)
+				data.val[p].key = data.val[p + 1].key;
+			--info.size;
+		}
+		//第index个孩子已并入左边的孩子：子树大小加到左边后删去它
+		static void merge_child(Block_Head& info, Normal_Data& data, off_t index) {
+			data.val[index - 1].count += data.val[index].count;
+			remove_child(info, data, index);
+		}
+
+		//删除后叶子是否不足下限（根为叶子时只有空了才算）
+		static bool leaf_underflow(off_t size, const Tree_Path& path) {
+			return path.cnt ? size < MIN_PAIR_NUM : size == 0;
+		}
+
+		//锁住pos及其在父亲中的左右兄弟
+		void latch_siblings(Write_Latch& guard, off_t parent_pos, off_t pos) const {
+			Block_Head parent_info;
+			Normal_Data parent_data;
+			read_block(&parent_info, &parent_data, parent_pos);
+			auto index = child_position(parent_info, parent_data, pos);
+			if (index > 0)
+				guard.add(parent_data.val[index - 1].child);
+			guard.add(pos);
+			if (index + 1 < parent_info.size)
+				guard.add(parent_data.val[index + 1].child);
+		}
+
+		//锁住叶子的父亲少一个孩子时要修改的祖先：整条路径（子树大小都会变），
+		//以及最低的少一个孩子也不会不足的祖先之下可能调整的结点的左右兄弟（祖先都可能不足时还有保护根位置的块0）
+		void latch_ancestors(Write_Latch& guard, const Tree_Path& path) const {
+			off_t top = 0;
+			while (top < path.cnt && node_size(path.pos[top]) - 1 < (top == path.cnt - 1 ? 2 : MIN_KEY_NUM))
+				++top;
+			if (top == path.cnt) {
+				guard.add(0);
+				--top;
+			}
+			for (auto level = path.cnt - 1; level >= top && level >= 0; --level)
+				guard.add(path.pos[level]);
+			for (auto level = top - 1; level >= 0; --level)
+				latch_siblings(guard, path.pos[level + 1], path.pos[level]);
+		}
+
+		//按自顶向下、从左到右的顺序锁住一次删除要修改的块：叶子删除后不少于下限时只有整条路径和叶子，
+		//否则是父亲少一个孩子时要修改的祖先，以及叶子的前驱、后继和后继的后继
+		void latch_erase(Write_Latch& guard, const Tree_Path& path, const Block_Head& info) const {
+			if (!latches.is_enabled())
+				return;
+			if (!leaf_underflow(info.size - 1, path)) {
+				for (auto level = path.cnt - 1; level >= 0; --level)
+					guard.add(path.pos[level]);
+				guard.add(info.pos);
+				return;
+			}
+			latch_ancestors(guard, path);
+			guard.add(info.last);
+			guard.add(info.pos);
+			guard.add(info.next);
+			if (info.next != tree_data.data_block_rear) {
+				Block_Head next_info;
+				Leaf_Data next_data;
+				read_block(&next_info, &next_data, info.next);
+				guard.add(next_info.next);
+			}
+		}
+
+		//把右边的叶子并入左边，释放右边的块并修改链表；关键字压缩时放不下则不合并
+		bool merge_leaf(Block_Head& l_info, Leaf_Data& l_data, Block_Head& r_info, Leaf_Data& r_data) {
+			if (r_info.size) {
+				if (!l_data.fits(r_data.key(0), r_data.key(r_info.size - 1), l_info.size))
+					return false;
+				l_data.rebase(r_data.key(0), l_info.size);
+			}
+			stat(STAT_LEAF_MERGE);
+			for (off_t i = 0; i < r_info.size; ++i)
+				l_data.set(l_info.size + i, r_data.key(i), r_data.value(i));
+			l_info.size += r_info.size;
+
+			//修改后继结点的前驱
+			Block_Head tmp_info;
+			Leaf_Data tmp_data;
+			read_block(&tmp_info, &tmp_data, r_info.next);
+			tmp_info.last = l_info.pos;
+			write_block(&tmp_info, &tmp_data, r_info.next);
+			l_info.next = r_info.next;
+
+			write_block(&l_info, &l_data, l_info.pos);
+			memory_free(r_info.pos);
+			return true;
+		}
+
+		//叶子不足下限：向同一父亲下的兄弟借一个元素，都借不到时与兄弟合并，返回父亲是否少了一个孩子
+		bool rebalance_leaf(const Tree_Path& path, Block_Head& info, Leaf_Data& data) {
+			auto parent_pos = path.pos[0];
+			Block_Head parent_info, sibling_info;
+			Normal_Data parent_data;
+			Leaf_Data sibling_data;
+			read_block(&parent_info, &parent_data, parent_pos);
+			auto index = child_position(parent_info, parent_data, info.pos);
+			auto has_left = index > 0, has_right = index + 1 < parent_info.size;
+
+			//借左兄弟的最大元素
+			if (has_left) {
+				read_block(&sibling_info, &sibling_data, info.last);
+				auto last_pos = sibling_info.size - 1;
+				if (sibling_info.size > MIN_PAIR_NUM && data.fits(sibling_data.key(last_pos), sibling_data.key(last_pos), info.size)) {
+					Key key = sibling_data.key(last_pos);
+					data.rebase(key, info.size);
+					for (auto p = info.size; p > 0; --p)
+						data.move(p, p - 1);
+					data.set(0, key, sibling_data.value(last_pos));
+					++info.size;
+					--sibling_info.size;
+					parent_data.val[index - 1].key = key;
+					--parent_data.val[index - 1].count;
+					++parent_data.val[index].count;
+					write_block(&sibling_info, &sibling_data, sibling_info.pos);
+					write_block(&info, &data, info.pos);
+					write_block(&parent_info, &parent_data, parent_pos);
+					return false;
+				}
+			}
+			//借右兄弟的最小元素
+			if (has_right) {
+				read_block(&sibling_info, &sibling_data, info.next);
+				if (sibling_info.size > MIN_PAIR_NUM && data.fits(sibling_data.key(0), sibling_data.key(0), info.size)) {
+					Key key = sibling_data.key(0);
+					data.rebase(key, info.size);
+					data.set(info.size, key, sibling_data.value(0));
+					++info.size;
+					for (off_t p = 1; p < sibling_info.size; ++p)
+						sibling_data.move(p - 1, p);
+					--sibling_info.size;
+					parent_data.val[index].key = sibling_data.key(0);
+					++parent_data.val[index].count;
+					--parent_data.val[index + 1].count;
+					write_block(&sibling_info, &sibling_data, sibling_info.pos);
+					write_block(&info, &data, info.pos);
+					write_block(&parent_info, &parent_data, parent_pos);
+					return false;
+				}
+			}
+			//与左兄弟或右兄弟合并
+			if (has_left) {
+				read_block(&sibling_info, &sibling_data, info.last);
+				if (merge_leaf(sibling_info, sibling_data, info, data)) {
+					merge_child(parent_info, parent_data, index);
+					write_block(&parent_info, &parent_data, parent_pos);
+					return true;
+				}
+			}
+			if (has_right) {
+				read_block(&sibling_info, &sibling_data, info.next);
+				if (merge_leaf(info, data, sibling_info, sibling_data)) {
+					merge_child(parent_info, parent_data, index + 1);
+					write_block(&parent_info, &parent_data, parent_pos);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		//合并索引：右边的孩子接在左边之后，中间的关键字为父亲中的分隔关键字，释放右边的块
+		void merge_normal(Block_Head& l_info, Normal_Data& l_data, Block_Head& r_info, Normal_Data& r_data,
+			const Key& separator) {
+			stat(STAT_INNER_MERGE);
+			l_data.val[l_info.size - 1].key = separator;
+			for (off_t p = l_info.size, i = 0; i < r_info.size; ++p, ++i) {
+				l_data.val[p] = r_data.val[i];
+			}
+			l_info.size += r_info.size;
+			write_block(&l_info, &l_data, l_info.pos);
+			memory_free(r_info.pos);
+		}
+
+		//路径上第level个索引结点不足下限：向兄弟借一个孩子（分隔关键字经过父亲轮转），
+		//都借不到时与兄弟合并，返回父亲是否少了一个孩子
+		bool rebalance_normal(const Tree_Path& path, off_t level) {
+			auto pos = path.pos[level], parent_pos = path.pos[level + 1];
+			Block_Head info, parent_info, left_info, right_info;
+			Normal_Data data, parent_data, left_data, right_data;
+			read_block(&info, &data, pos);
+			read_block(&parent_info, &parent_data, parent_pos);
+			auto index = child_position(parent_info, parent_data, pos);
+			auto has_left = index > 0, has_right = index + 1 < parent_info.size;
+			if (has_left)
+				read_block(&left_info, &left_data, parent_data.val[index - 1].child);
+			if (has_right)
+				read_block(&right_info, &right_data, parent_data.val[index + 1].child);
+
+			if (has_left && left_info.size > MIN_KEY_NUM) {
+				for (auto p = info.size; p > 0; --p) {
+					data.val[p].child = data.val[p - 1].child;
+					data.val[p].count = data.val[p - 1].count;
+				}
+				for (auto p = info.size - 1; p > 0; --p)
+					data.val[p].key = data.val[p - 1].key;
+				auto moved = left_data.val[left_info.size - 1].count;
+				data.val[0].child = left_data.val[left_info.size - 1].child;
+				data.val[0].count = moved;
+				data.val[0].key = parent_data.val[index - 1].key;
+				parent_data.val[index - 1].count -= moved;
+				parent_data.val[index].count += moved;
+				parent_data.val[index - 1].key = left_data.val[left_info.size - 2].key;
+				++info.size;
+				--left_info.size;
+				write_block(&left_info, &left_data, left_info.pos);
+				write_block(&info, &data, pos);
+				write_block(&parent_info, &parent_data, parent_pos);
+				return false;
+			}
+			if (has_right && right_info.size > MIN_KEY_NUM) {
+				data.val[info.size - 1].key = parent_data.val[index].key;
+				auto moved = right_data.val[0].count;
+				data.val[info.size].child = right_data.val[0].child;
+				data.val[info.size].count = moved;
+				parent_data.val[index].key = right_data.val[0].key;
+				parent_data.val[index].count += moved;
+				parent_data.val[index + 1].count -= moved;
+				++info.size;
+				remove_child(right_info, right_data, 0);
+				write_block(&right_info, &right_data, right_info.pos);
+				write_block(&info, &data, pos);
+				write_block(&parent_info, &parent_data, parent_pos);
+				return false;
+			}
+			if (has_left && left_info.size + info.size <= BLOCK_KEY_NUM) {
+				merge_normal(left_info, left_data, info, data, parent_data.val[index - 1].key);
+				merge_child(parent_info, parent_data, index);
+			}
+			else if (has_right && info.size + right_info.size <= BLOCK_KEY_NUM) {
+				merge_normal(info, data, right_info, right_data, parent_data.val[index].key);
+				merge_child(parent_info, parent_data, index + 1);
+			}
+			else
+				return false;
+			write_block(&parent_info, &parent_data, parent_pos);
+			return true;
+		}
+
+		//摘除没有兄弟的空叶子：释放它和只有它一个后代的祖先，并从链表中删去，
+		//返回少了一个孩子的祖先在路径上的位置（树变空时为path.cnt）
+		off_t detach_leaf(const Tree_Path& path, const Block_Head& info) {
+			Block_Head tmp_info;
+			Leaf_Data tmp_data;
+			read_block(&tmp_info, &tmp_data, info.last);
+			tmp_info.next = info.next;
+			write_block(&tmp_info, &tmp_data, info.last);
+			read_block(&tmp_info, &tmp_data, info.next);
+			tmp_info.last = info.last;
+			write_block(&tmp_info, &tmp_data, info.next);
+			memory_free(info.pos);
+
+			auto child = info.pos;
+			for (off_t level = 0; level < path.cnt; ++level) {
+				Block_Head parent_info;
+				Normal_Data parent_data;
+				read_block(&parent_info, &parent_data, path.pos[level]);
+				if (parent_info.size > 1) {
+					remove_child(parent_info, parent_data, child_position(parent_info, parent_data, child));
+					write_block(&parent_info, &parent_data, path.pos[level]);
+					return level;
+				}
+				memory_free(path.pos[level]);
+				child = path.pos[level];
+			}
+			tree_data.root_pos = 0;
+			return path.cnt;
+		}
+
+		//删除后叶子不足下限时自底向上调整，根只剩一个孩子时以孩子为新根
+		void erase_rebalance(const Tree_Path& path, Block_Head& info, Leaf_Data& data) {
+			off_t level = 0;
+			if (info.size == 0 && (path.cnt == 0 || node_size(path.pos[0]) < 2))
+				level = detach_leaf(path, info);
+			else if (!path.cnt || !rebalance_leaf(path, info, data))
+				return;
+			rebalance_ancestors(path, level);
+		}
+		//path.pos[level]少了一个孩子：自下而上调整不足的祖先，根只剩一个孩子时降低高度
+		void rebalance_ancestors(const Tree_Path& path, off_t level) {
+			for (; level + 1 < path.cnt; ++level)
+				if (node_size(path.pos[level]) >= MIN_KEY_NUM || !rebalance_normal(path, level))
+					return;
+			if (level == path.cnt)
+				return;
+			Block_Head root_info;
+			Normal_Data root_data;
+			read_block(&root_info, &root_data, tree_data.root_pos);
+			if (root_info.size == 1) {
+				memory_free(tree_data.root_pos);
+				tree_data.root_pos = root_data.val[0].child;
+			}
+		}
+
+		//从空闲链表中删去块pos（前驱由整理期间维护的表给出）
+		void unlink_free(off_t pos) {
+			auto prev_pos = compaction.prev[pos];
+			auto page = cache.pin(pos);
+			auto next_pos = reinterpret_cast<const Block_Head*>(page)->next;
+			cache.unpin(pos);
+			if (prev_pos) {
+				Block_Head info;
+				page = cache.pin(prev_pos);
+				memcpy(&info, page, sizeof(info));
+				cache.unpin(prev_pos);
+				info.next = next_pos;
+				latches.lock(prev_pos);
+				page_log_write(reinterpret_cast<const char*>(&info), sizeof(info), prev_pos);
+				latches.unlock(prev_pos);
+			}
+			else
+				tree_data.free_head = next_pos;
+			if (next_pos)
+				compaction.set_prev(next_pos, prev_pos);
+			compaction.set_prev(pos, -1);
+		}
+		//取出空闲块pos（pos为block_cnt时扩展文件）并清零
+		void take_block(off_t pos) {
+			stat(STAT_ALLOCATION);
+			if (pos == tree_data.block_cnt)
+				++tree_data.block_cnt;
+			else
+				unlink_free(pos);
+			format_block(pos);
+		}
+		//编号不小于from的最小空闲块，没有时为block_cnt
+		off_t lowest_free(off_t from) const {
+			for (auto pos = from; pos < tree_data.block_cnt; ++pos)
+				if (compaction.is_free(pos))
+					return pos;
+			return tree_data.block_cnt;
+		}
+
+		//块头中记录的块的类别（只看块头，不计入结点读）
+		Block_Kind block_kind(off_t pos) const {
+			auto page = cache.pin(pos);
+			auto kind = reinterpret_cast<const Block_Head*>(page)->block_kind;
+			cache.unpin(pos);
+			return kind;
+		}
+		//pos处是否为树中的叶子（不是哨兵），是则path为它的查找路径
+		bool find_leaf_block(off_t pos, Tree_Path& path, Block_Head& info, Leaf_Data& data) const {
+			if (pos <= 0 || pos >= tree_data.block_cnt || !tree_data.root_pos || block_kind(pos) != NODE_BLOCK)
+				return false;
+			read_block(&info, &data, pos);
+			if (!info.block_type || info.size <= 0)
+				return false;
+			return find_leaf(data.key(0), &path) == pos;
+		}
+		//pos处是否为树中的索引结点：沿最左的孩子走到叶子，用叶子的查找路径找到它，
+		//是则path为经过它的查找路径，index为它在路径中的位置
+		bool find_normal_block(off_t pos, Tree_Path& path, off_t& index) const {
+			if (pos <= 0 || pos >= tree_data.block_cnt || !tree_data.root_pos || block_kind(pos) != NODE_BLOCK)
+				return false;
+			Block_Head info;
+			Normal_Data data;
+			auto cur_pos = pos;
+			while (true) {
+				read_block(&info, &data, cur_pos);
+				if (info.block_type)
+					break;
+				cur_pos = data.val[0].child;
+			}
+			Block_Head leaf_info;
+			Leaf_Data leaf_data;
+			if (cur_pos == pos || !find_leaf_block(cur_pos, path, leaf_info, leaf_data))
+				return false;
+			for (index = 0; index < path.cnt; ++index)
+				if (path.pos[index] == pos)
+					return true;
+			return false;
+		}
+
+		//把叶子搬到new_pos（空闲块，或为block_cnt时扩展文件），修改父亲和链表中的引用
+		void move_leaf(Block_Head& info, Leaf_Data& data, const Tree_Path& path, off_t new_pos) {
+			stat(STAT_RELOCATION);
+			auto pos = info.pos;
+			Write_Latch guard(&latches);
+			guard.add(path.cnt ? path.pos[0] : 0);
+			guard.add(info.last);
+			guard.add(pos);
+			guard.add(info.next);
+			guard.add(new_pos);
+			take_block(new_pos);
+			info.pos = new_pos;
+			write_block(&info, &data, new_pos);
+
+			Block_Head tmp_info;
+			Leaf_Data tmp_data;
+			read_block(&tmp_info, &tmp_data, info.last);
+			tmp_info.next = new_pos;
+			write_block(&tmp_info, &tmp_data, info.last);
+			read_block(&tmp_info, &tmp_data, info.next);
+			tmp_info.last = new_pos;
+			write_block(&tmp_info, &tmp_data, info.next);
+
+			if (path.cnt) {
+				Block_Head parent_info;
+				Normal_Data parent_data;
+				read_block(&parent_info, &parent_data, path.pos[0]);
+				parent_data.val[child_position(parent_info, parent_data, pos)].child = new_pos;
+				write_block(&parent_info, &parent_data, path.pos[0]);
+			}
+			else
+				tree_data.root_pos = new_pos;
+			memory_free(pos);
+			structure_version.fetch_add(1, std::memory_order_release);
+		}
+		//把路径上第index个索引结点搬到new_pos，修改父亲（它是根时为根位置）中的引用
+		void move_normal(const Tree_Path& path, off_t index, off_t new_pos) {
+			stat(STAT_RELOCATION);
+			auto pos = path.pos[index];
+			auto is_root = index + 1 == path.cnt;
+			Write_Latch guard(&latches);
+			guard.add(is_root ? 0 : path.pos[index + 1]);
+			guard.add(pos);
+			guard.add(new_pos);
+			Block_Head info;
+			Normal_Data data;
+			read_block(&info, &data, pos);
+			take_block(new_pos);
+			info.pos = new_pos;
+			write_block(&info, &data, new_pos);
+			if (is_root)
+				tree_data.root_pos = new_pos;
+			else {
+				Block_Head parent_info;
+				Normal_Data parent_data;
+				read_block(&parent_info, &parent_data, path.pos[index + 1]);
+				parent_data.val[child_position(parent_info, parent_data, pos)].child = new_pos;
+				write_block(&parent_info, &parent_data, path.pos[index + 1]);
+			}
+			memory_free(pos);
+		}
+
+		//叶子和同一父亲下的两个后继合起来不超过两个COALESCE_PAIR_NUM时，把中间叶子的元素分给两边
+		//（删除让每个叶子不少于一半，两个相邻叶子总放不进一个），父亲因此不足时与删除一样调整，返回是否合并
+		bool coalesce_leaf(Block_Head& info, Leaf_Data& data, const Tree_Path& path) {
+			if (!path.cnt)
+				return false;
+			auto parent_pos = path.pos[0];
+			Block_Head parent_info, mid_info, right_info;
+			Normal_Data parent_data;
+			Leaf_Data mid_data, right_data;
+			read_block(&parent_info, &parent_data, parent_pos);
+			auto index = child_position(parent_info, parent_data, info.pos);
+			if (index + 2 >= parent_info.size)
+				return false;
+			read_block(&mid_info, &mid_data, info.next);
+			read_block(&right_info, &right_data, mid_info.next);
+			auto total = info.size + mid_info.size + right_info.size;
+			if (total > COALESCE_PAIR_NUM * 2)
+				return false;
+			//左边补到一半，其余的并入右边
+			auto take = std::max(off_t(0), std::min(mid_info.size, (total + 1) / 2 - info.size));
+			if ((take && !data.fits(mid_data.key(0), mid_data.key(take - 1), info.size))
+				|| (take < mid_info.size && !right_data.fits(mid_data.key(take), mid_data.key(take), right_info.size)))
+				return false;
+			Write_Latch guard(&latches);
+			if (latches.is_enabled())
+				latch_ancestors(guard, path);
+			guard.add(info.pos);
+			guard.add(mid_info.pos);
+			guard.add(right_info.pos);
+			guard.add(right_info.next);
+			if (take) {
+				data.rebase(mid_data.key(0), info.size);
+				for (off_t i = 0; i < take; ++i)
+					data.set(info.size + i, mid_data.key(i), mid_data.value(i));
+				info.size += take;
+				for (auto p = take; p < mid_info.size; ++p)
+					mid_data.move(p - take, p);
+				mid_info.size -= take;
+				write_block(&info, &data, info.pos);
+			}
+			merge_leaf(mid_info, mid_data, right_info, right_data);
+			info.next = mid_info.pos;
+			parent_data.val[index].count += take;
+			parent_data.val[index + 1].count -= take;
+			merge_child(parent_info, parent_data, index + 2);
+			parent_data.val[index].key = mid_data.key(0);
+			write_block(&parent_info, &parent_data, parent_pos);
+			rebalance_ancestors(path, 0);
+			structure_version.fetch_add(1, std::memory_order_release);
+			return true;
+		}
+
+		//开始一轮整理：记下空闲链表中每块的前驱，叶子从哨兵之后开始放
+		void compact_begin() {
+			compaction.reset();
+			compaction.capacity = tree_data.block_cnt;
+			compaction.prev = new off_t[compaction.capacity];
+			for (off_t i = 0; i < compaction.capacity; ++i)
+				compaction.prev[i] = -1;
+			off_t prev_pos = 0;
+			for (auto pos = tree_data.free_head; pos; ) {
+				compaction.prev[pos] = prev_pos;
+				prev_pos = pos;
+				auto page = cache.pin(pos);
+				pos = reinterpret_cast<const Block_Head*>(page)->next;
+				cache.unpin(prev_pos);
+			}
+			compaction.dest = std::max(tree_data.data_block_head, tree_data.data_block_rear) + 1;
+			compaction.phase = Compact_State::LEAF;
+		}
+		//按链表顺序放置下一个叶子：先试着并入后继，再把它搬到dest
+		//（跳过dest处不能搬的块，dest处是还没放置的叶子时先把那个叶子搬到更后面的空闲块），返回是否有修改
+		bool compact_leaf() {
+			if (!tree_data.root_pos) {
+				compaction.phase = Compact_State::TAIL;
+				return false;
+			}
+			Block_Head info, dest_info;
+			Leaf_Data data, dest_data;
+			Tree_Path path, dest_path;
+			off_t pos;
+			if (compaction.next_key)
+				pos = find_leaf(*compaction.next_key);
+			else {
+				read_block(&info, &data, tree_data.data_block_head);
+				pos = info.next;
+			}
+			read_block(&info, &data, pos);
+			find_leaf(data.key(0), &path);
+			if (coalesce_leaf(info, data, path))
+				return true;
+
+			auto& dest = compaction.dest;
+			auto occupied = false;
+			for (off_t i = 0; dest != pos && dest < tree_data.block_cnt && !compaction.is_free(dest); ++i, ++dest) {
+				if (find_leaf_block(dest, dest_path, dest_info, dest_data)) {
+					occupied = true;
+					break;
+				}
+				if (i == COMPACT_SCAN_NUM)
+					return false;
+			}
+			auto modified = dest != pos;
+			if (occupied) {
+				move_leaf(dest_info, dest_data, dest_path, lowest_free(dest + 1));
+				read_block(&info, &data, pos);
+			}
+			if (modified)
+				move_leaf(info, data, path, dest);
+			++dest;
+			if (info.next == tree_data.data_block_rear)
+				compaction.phase = Compact_State::TAIL;
+			else {
+				Block_Head next_info;
+				Leaf_Data next_data;
+				read_block(&next_info, &next_data, info.next);
+				compaction.set_key(next_data.key(0));
+			}
+			return modified;
+		}
+		//缩小文件：去掉末尾的空闲块，末尾是结点时把它搬到最低的空闲块，返回是否有修改；
+		//末尾是值块或没有更低的空闲块时结束本轮，缩小过文件则做检查点后截断
+		bool compact_tail() {
+			auto last = tree_data.block_cnt - 1;
+			if (compaction.is_free(last)) {
+				unlink_free(last);
+				--tree_data.block_cnt;
+				compaction.shrunk = true;
+				return true;
+			}
+			auto target = lowest_free(1);
+			if (target < last && block_kind(last) == NODE_BLOCK) {
+				Tree_Path path;
+				Block_Head info;
+				Leaf_Data data;
+				off_t index;
+				if (find_leaf_block(last, path, info, data)) {
+					move_leaf(info, data, path, target);
+					return true;
+				}
+				if (find_normal_block(last, path, index)) {
+					move_normal(path, index, target);
+					return true;
+				}
+			}
+			if (compaction.shrunk) {
+				write_checkpoint();
+				storage->truncate(tree_data.block_cnt);
+			}
+			compaction.reset();
+			return false;
+		}
+		//整理的一步，返回本轮是否还没有结束
+		bool compact_step() {
+			std::lock_guard<Switch_Mutex> lock_guard(write_lock);
+			if (!storage->is_open())
+				return false;
+			if (compaction.phase == Compact_State::IDLE) {
+				compact_begin();
+				return true;
+			}
+			auto modified = compaction.phase == Compact_State::LEAF ? compact_leaf() : compact_tail();
+			if (modified)
+				commit_operation();
+			return compaction.phase != Compact_State::IDLE;
+		}
+
+		//自底向上建树
+		//叶子按关键字顺序依次写入文件，每层只在内存中保留一个未写满的索引结点
+		class Bulk_Loader {
+		private:
+			//最大层数
+			constexpr static off_t MAX_LEVEL = 64;
+
+			BTree* tree;
+			off_t leaf_capacity, node_capacity;
+			//当前叶子
+			Block_Head leaf_info;
+			Leaf_Data leaf_data;
+			//每层未写满的索引结点及其第一个关键字
+			off_t level_cnt = 0;
+			Block_Head level_info[MAX_LEVEL];
+			Normal_Data* level_data;
+			Key level_first[MAX_LEVEL];
+			//每层未写满的索引结点子树中的元素个数
+			off_t level_count[MAX_LEVEL];
+
+			off_t allocation() {
+				tree->stat(STAT_ALLOCATION);
+				return tree->tree_data.block_cnt++;
+			}
+			//把(key, pos)作为孩子加入第level层，它的子树中有count个元素
+			void add_child(off_t level, const Key& key, off_t pos, off_t count) {
+				if (level == level_cnt) {
+					if (level_cnt == MAX_LEVEL)
+						throw runtime_error();
+					level_info[level] = Block_Head();
+					level_count[level] = 0;
+					++level_cnt;
+				}
+				auto& info = level_info[level];
+				auto& data = level_data[level];
+				if (info.size == node_capacity)
+					flush_level(level);
+				if (info.size == 0)
+					level_first[level] = key;
+				else
+					data.val[info.size - 1].key = key;
+				data.val[info.size].child = pos;
+				data.val[info.size].count = count;
+				level_count[level] += count;
+				++info.size;
+			}
+			//写出第level层的结点
+			void flush_level(off_t level) {
+				auto& info = level_info[level];
+				info.block_type = false;
+				info.pos = allocation();
+				tree->write_new_block(&info, &level_data[level], info.pos);
+				info.size = 0;
+				auto count = level_count[level];
+				level_count[level] = 0;
+				add_child(level + 1, level_first[level], info.pos, count);
+			}
+
+		public:
+			Bulk_Loader(BTree* bptree, double fill_factor) : tree(bptree) {
+				leaf_capacity = off_t(BLOCK_PAIR_NUM * fill_factor);
+				if (leaf_capacity < 1) leaf_capacity = 1;
+				if (leaf_capacity > BLOCK_PAIR_NUM) leaf_capacity = BLOCK_PAIR_NUM;
+				node_capacity = off_t(BLOCK_KEY_NUM * fill_factor);
+				if (node_capacity < 2) node_capacity = 2;
+				if (node_capacity > BLOCK_KEY_NUM) node_capacity = BLOCK_KEY_NUM;
+				level_data = new Normal_Data[MAX_LEVEL];
+				leaf_info.block_type = true;
+				leaf_info.pos = allocation();
+				leaf_info.last = tree->tree_data.data_block_head;
+			}
+			Bulk_Loader(const Bulk_Loader&) = delete;
+			Bulk_Loader& operator=(const Bulk_Loader&) = delete;
+			~Bulk_Loader() {
+				delete[] level_data;
+			}
+			//追加一条记录（关键字必须严格递增）
+			void push(const Key& key, const Value& value) {
+				if (leaf_info.size == leaf_capacity || !leaf_data.fits(key, key, leaf_info.size)) {
+					auto next_pos = allocation();
+					leaf_info.next = next_pos;
+					tree->write_new_block(&leaf_info, &leaf_data, leaf_info.pos);
+					add_child(0, leaf_data.key(0), leaf_info.pos, leaf_info.size);
+					leaf_info.last = leaf_info.pos;
+					leaf_info.pos = next_pos;
+					leaf_info.size = 0;
+				}
+				leaf_data.rebase(key, leaf_info.size);
+				leaf_data.set(leaf_info.size, key, tree->new_value(value, false));
+				++leaf_info.size;
+			}
+			//写出剩余结点，返回最后一个叶子的位置，root_pos返回根结点
+			off_t finish(off_t& root_pos) {
+				leaf_info.next = tree->tree_data.data_block_rear;
+				tree->write_new_block(&leaf_info, &leaf_data, leaf_info.pos);
+				add_child(0, leaf_data.key(0), leaf_info.pos, leaf_info.size);
+				for (off_t level = 0; level < level_cnt; ++level) {
+					if (level == level_cnt - 1 && level_info[level].size == 1) {
+						root_pos = level_data[level].val[0].child;
+						break;
+					}
+					flush_level(level);
+				}
+				return leaf_info.pos;
+			}
+		};
+
+		//离线分析文件中树的形状：从根深度优先遍历，每层只保留一个块的缓冲，
+		//另用一个位图记录访问过的块
+		class Shape_Walker {
+		private:
+			FILE* fp;
+			BTree_Shape& shape;
+			off_t block_cnt;
+			unsigned char* bitmap;
+			char* buffer;
+
+			//标记pos处的块，返回此前是否未被标记
+			bool mark(off_t pos) {
+				auto bit = (unsigned char)(1 << (pos & 7));
+				if (bitmap[pos >> 3] & bit)
+					return false;
+				bitmap[pos >> 3] |= bit;
+				return true;
+			}
+			static off_t fill_bucket(off_t size, off_t capacity) {
+				auto bucket = size * BTree_Shape::FILL_BUCKET_NUM / capacity;
+				return bucket < BTree_Shape::FILL_BUCKET_NUM ? bucket : BTree_Shape::FILL_BUCKET_NUM - 1;
+			}
+			//标记叶子引用的值块
+			void mark_values(const Leaf_Data& data, off_t size, std::true_type) {
+				for (off_t i = 0; i < size; ++i) {
+					auto& ref = data.value(i);
+					if (ref.pos <= 0 || value_last_block(ref) >= block_cnt) {
+						++shape.error_cnt;
+						continue;
+					}
+					for (auto pos = ref.pos; pos <= value_last_block(ref); ++pos)
+						shape.value_blocks += mark(pos);
+				}
+			}
+			void mark_values(const Leaf_Data&, off_t, std::false_type) {}
+
+		public:
+			Shape_Walker(FILE* file, BTree_Shape& result, off_t block_num)
+				: fp(file), shape(result), block_cnt(block_num) {
+				bitmap = new unsigned char[(block_cnt >> 3) + 1]();
+				buffer = new char[BLOCK_SIZE * BTree_Shape::LEVEL_NUM];
+			}
+			Shape_Walker(const Shape_Walker&) = delete;
+			Shape_Walker& operator=(const Shape_Walker&) = delete;
+			~Shape_Walker() {
+				delete[] bitmap;
+				delete[] buffer;
+			}
+			//读入一块，文件末尾之后的部分为0
+			bool read(char* buff, off_t pos) {
+				if (pos <= 0 || pos >= block_cnt)
+					return false;
+				fseek(fp, pos * BLOCK_SIZE, SEEK_SET);
+				auto len = fread(buff, 1, BLOCK_SIZE, fp);
+				memset(buff + len, 0, BLOCK_SIZE - len);
+				return true;
+			}
+			//文件头和首尾哨兵
+			void mark_fixed(off_t pos) {
+				if (pos >= 0 && pos < block_cnt)
+					mark(pos);
+			}
+			//访问第level层pos处的结点及其子树，返回子树中的元素个数
+			off_t visit(off_t pos, off_t level) {
+				auto buff = buffer + level * BLOCK_SIZE;
+				if (level >= BTree_Shape::LEVEL_NUM || !read(buff, pos) || !mark(pos)) {
+					++shape.error_cnt;
+					return 0;
+				}
+				auto info = reinterpret_cast<const Block_Head*>(buff);
+				if (info->block_kind != NODE_BLOCK
+					|| 0 > info->size || info->size > (info->block_type ? BLOCK_PAIR_NUM : BLOCK_KEY_NUM)) {
+					++shape.error_cnt;
+					return 0;
+				}
+				++shape.level_nodes[level];
+				shape.level_entries[level] += info->size;
+				if (level + 1 > shape.height)
+					shape.height = level + 1;
+				if (info->block_type) {
+					++shape.leaf_cnt;
+					shape.record_cnt += info->size;
+					++shape.leaf_fill[fill_bucket(info->size, BLOCK_PAIR_NUM)];
+					mark_values(*reinterpret_cast<const Leaf_Data*>(buff + INIT_SIZE), info->size, Separate_Tag());
+					return info->size;
+				}
+				++shape.inner_cnt;
+				++shape.inner_fill[fill_bucket(info->size, BLOCK_KEY_NUM)];
+				auto data = reinterpret_cast<const Normal_Data*>(buff + INIT_SIZE);
+				off_t count = 0;
+				for (off_t i = 0; i < info->size; ++i) {
+					auto child_count = visit(data->val[i].child, level + 1);
+					//记录的子树大小与实际不符
+					if (child_count != data->val[i].count)
+						++shape.error_cnt;
+					count += child_count;
+				}
+				return count;
+			}
+			//沿叶子链表从head走到rear
+			void walk_chain(off_t head, off_t rear) {
+				char buff[BLOCK_SIZE];
+				Block_Head info;
+				if (!read(buff, head)) {
+					++shape.error_cnt;
+					return;
+				}
+				memcpy(&info, buff, sizeof(info));
+				off_t prev = head, jump = 0;
+				for (auto pos = info.next; pos != rear; pos = info.next) {
+					if (shape.chain_leaves > shape.leaf_cnt || !read(buff, pos)) {
+						++shape.error_cnt;
+						return;
+					}
+					memcpy(&info, buff, sizeof(info));
+					if (info.last != prev)
+						++shape.error_cnt;
+					if (prev != head) {
+						shape.chain_sequential += pos == prev + 1;
+						shape.chain_backward += pos < prev;
+						jump += pos > prev ? pos - prev : prev - pos;
+					}
+					++shape.chain_leaves;
+					prev = pos;
+				}
+				if (shape.chain_leaves > 1)
+					shape.chain_mean_jump = double(jump) / double(shape.chain_leaves - 1);
+				if (shape.chain_leaves != shape.leaf_cnt)
+					++shape.error_cnt;
+			}
+			//标记空闲链表中的块
+			void walk_free(off_t pos) {
+				char buff[BLOCK_SIZE];
+				for (; pos; pos = reinterpret_cast<const Block_Head*>(buff)->next) {
+					if (!read(buff, pos) || !mark(pos) || reinterpret_cast<const Block_Head*>(buff)->block_kind != FREE_BLOCK) {
+						++shape.error_cnt;
+						return;
+					}
+					++shape.free_blocks;
+				}
+			}
+			//标记空闲值链表中的值所在的块
+			void walk_free_values(off_t address) {
+				char buff[BLOCK_SIZE];
+				while (address) {
+					Value_Ref ref;
+					ref.pos = address / BLOCK_SIZE;
+					ref.offset = address % BLOCK_SIZE;
+					if (shape.free_values > block_cnt * BLOCK_SIZE / VALUE_SIZE
+						|| value_last_block(ref) >= block_cnt || !read(buff, ref.pos)
+						|| reinterpret_cast<const Block_Head*>(buff)->block_kind != VALUE_BLOCK) {
+						++shape.error_cnt;
+						return;
+					}
+					++shape.free_values;
+					for (auto pos = ref.pos; pos <= value_last_block(ref); ++pos)
+						shape.value_blocks += mark(pos);
+					memcpy(&address, buff + ref.offset, sizeof(address));
+				}
+			}
+			//未被标记的块数
+			off_t unmarked() const {
+				off_t cnt = 0;
+				for (off_t pos = 0; pos < block_cnt; ++pos)
+					cnt += !(bitmap[pos >> 3] & (1 << (pos & 7)));
+				return cnt;
+			}
+		};
+
+	public:
+		typedef pair<const Key, Value> value_type;
+
+		class const_iterator;
+		class iterator {
+			friend class BTree;
+			friend class BTree::const_iterator;
+		private:
+			// Your private members go here
+			//指向当前bpt
+			BTree* cur_bptree = nullptr;
+			//存储当前块的基本信息
+			Block_Head block_info;
+			//存储当前指向的元素位置
+			off_t cur_pos = 0;
+			//当前块在缓存中固定的页（迭代器存在期间不会被淘汰）
+			const char* page = nullptr;
+			//固定页时缓存的版本
+			off_t page_epoch = 0;
+			//并发模式下page指向的叶子快照
+			Leaf_Snapshot* snapshot = nullptr;
+			//值分离时读出的当前元素
+			mutable value_type* loaded = nullptr;
+			mutable off_t loaded_pos = 0;
+			//key()解码出的关键字
+			mutable Key_Buffer key_buffer;
+			//顺序移动时的预读状态
+			Readahead ahead;
+
+			//固定pos处的块作为当前块
+			void move_to(off_t pos) {
+				release();
+				page = cur_bptree->pin_leaf(pos, block_info, page_epoch, snapshot);
+			}
+			//释放当前固定的页
+			void release() {
+				if (page)
+					cur_bptree->unpin_leaf(block_info.pos, page_epoch, snapshot);
+				page = nullptr;
+				snapshot = nullptr;
+				delete loaded;
+				loaded = nullptr;
+			}
+
+		public:
+			bool modify(const Value& value) {
+				delete loaded;
+				loaded = nullptr;
+				if (!snapshot) {
+					cur_bptree->modify_value(block_info.pos, cur_pos, value);
+					return true;
+				}
+				Key key = this->key();
+				off_t pos, index;
+				if (!cur_bptree->modify_key(key, value, pos, index))
+					return false;
+				move_to(pos);
+				cur_pos = index;
+				return true;
+			}
+			iterator() {}
+			iterator(const iterator& other) {
+				cur_bptree = other.cur_bptree;
+				block_info = other.block_info;
+				cur_pos = other.cur_pos;
+				page_epoch = other.page_epoch;
+				if (other.page) {
+					snapshot = other.snapshot;
+					page = cur_bptree->repin_leaf(block_info.pos, page_epoch, snapshot);
+				}
+			}
+			iterator& operator=(const iterator& other) {
+				if (this == &other)
+					return *this;
+				release();
+				cur_bptree = other.cur_bptree;
+				block_info = other.block_info;
+				cur_pos = other.cur_pos;
+				page_epoch = other.page_epoch;
+				if (other.page) {
+					snapshot = other.snapshot;
+					page = cur_bptree->repin_leaf(block_info.pos, page_epoch, snapshot);
+				}
+				return *this;
+			}
+			~iterator() {
+				release();
+			}
+			// Return a new iterator which points to the n-next elements
+			iterator operator++(int) {
+				auto tmp = *this;
+				++*this;
+				return tmp;
+			}
+			iterator& operator++() {
+				Stat_Timer timer(&cur_bptree->stats_data, LATENCY_ADVANCE, sample_advance());
+				++cur_pos;
+				if (cur_pos >= block_info.size)
+					cur_bptree->next_leaf(*this);
+				return *this;
+			}
+			iterator operator--(int) {
+				auto temp = *this;
+				--*this;
+				return temp;
+			}
+			iterator& operator--() {
+				Stat_Timer timer(&cur_bptree->stats_data, LATENCY_ADVANCE, sample_advance());
+				if (cur_pos == 0)
+					cur_bptree->prev_leaf(*this);
+				else
+					--cur_pos;
+				
+				return *this;
+			}
+			// Overloaded of operator '==' and '!='
+			// Check whether the iterators are same
+			// The reference stays valid while the iterator points to the same element
+			// and the tree is not modified
+			const value_type& operator*() const {
+				if (cur_pos >= block_info.size)
+					throw invalid_iterator();
+				return cur_bptree->load_element(page, cur_pos, loaded, loaded_pos);
+			}
+			// The key of the element; unlike operator* it never reads a separately stored value
+			const Key& key() const {
+				if (cur_pos >= block_info.size)
+					throw invalid_iterator();
+				return cur_bptree->element_key(page, cur_pos, key_buffer);
+			}
+			const value_type* operator->() const {
+				return &**this;
+			}
+			bool operator==(const iterator& rhs) const {
+				return cur_bptree == rhs.cur_bptree
+					&& block_info.pos == rhs.block_info.pos
+					&& cur_pos == rhs.cur_pos;
+			}
+			bool operator==(const const_iterator& rhs) const {
+				return block_info.pos == rhs.block_info.pos
+					&& cur_pos == rhs.cur_pos;
+			}
+			bool operator!=(const iterator& rhs) const {
+				return cur_bptree != rhs.cur_bptree
+					|| block_info.pos != rhs.block_info.pos
+					|| cur_pos != rhs.cur_pos;
+			}
+			bool operator!=(const const_iterator& rhs) const {
+				return block_info.pos != rhs.block_info.pos
+					|| cur_pos != rhs.cur_pos;
+			}
+		};
+		class const_iterator {
+			// it should has similar member method as iterator.
+			//  and it should be able to construct from an iterator.
+			friend class BTree;
+			friend class BTree::iterator;
+		private:
+			// Your private members go here
+			//指向当前bpt
+			const BTree* cur_bptree = nullptr;
+			//存储当前块的基本信息
+			Block_Head block_info;
+			//存储当前指向的元素位置
+			off_t cur_pos = 0;
+			//当前块在缓存中固定的页（迭代器存在期间不会被淘汰）
+			const char* page = nullptr;
+			//固定页时缓存的版本
+			off_t page_epoch = 0;
+			//并发模式下page指向的叶子快照
+			Leaf_Snapshot* snapshot = nullptr;
+			//值分离时读出的当前元素
+			mutable value_type* loaded = nullptr;
+			mutable off_t loaded_pos = 0;
+			//key()解码出的关键字
+			mutable Key_Buffer key_buffer;
+			//顺序移动时的预读状态
+			Readahead ahead;
+
+			//固定pos处的块作为当前块
+			void move_to(off_t pos) {
+				release();
+				page = cur_bptree->pin_leaf(pos, block_info, page_epoch, snapshot);
+			}
+			//释放当前固定的页
+			void release() {
+				if (page)
+					cur_bptree->unpin_leaf(block_info.pos, page_epoch, snapshot);
+				page = nullptr;
+				snapshot = nullptr;
+				delete loaded;
+				loaded = nullptr;
+			}
+			//复制另一个迭代器的位置
+			template <class ITERATOR_TYPE>
+			void assign(const ITERATOR_TYPE& other) {
+				release();
+				cur_bptree = other.cur_bptree;
+				block_info = other.block_info;
+				cur_pos = other.cur_pos;
+				page_epoch = other.page_epoch;
+				if (other.page) {
+					snapshot = other.snapshot;
+					page = cur_bptree->repin_leaf(block_info.pos, page_epoch, snapshot);
+				}
+			}
+
+		public:
+			const_iterator() {}
+			const_iterator(const const_iterator& other) {
+				assign(other);
+			}
+			const_iterator(const iterator& other) {
+				assign(other);
+			}
+			const_iterator& operator=(const const_iterator& other) {
+				if (this != &other)
+					assign(other);
+				return *this;
+			}
+			~const_iterator() {
+				release();
+			}
+			// And other methods in iterator, please fill by yourself.
+			// Return a new iterator which points to the n-next elements
+			const_iterator operator++(int) {
+				auto tmp = *this;
+				++*this;
+				return tmp;
+			}
+			const_iterator& operator++() {
+				Stat_Timer timer(&cur_bptree->stats_data, LATENCY_ADVANCE, sample_advance());
+				++cur_pos;
+				if (cur_pos >= block_info.size)
+					cur_bptree->next_leaf(*this);
+				return *this;
+			}
+			const_iterator operator--(int) {
+				auto tmp = *this;
+				--*this;
+				return tmp;
+			}
+			const_iterator& operator--() {
+				Stat_Timer timer(&cur_bptree->stats_data, LATENCY_ADVANCE, sample_advance());
+				if (cur_pos == 0)
+					cur_bptree->prev_leaf(*this);
+				else
+					--cur_pos;
+
+				return *this;
+			}
+			// Overloaded of operator '==' and '!='
+			// Check whether the iterators are same
+			// The reference stays valid while the iterator points to the same element
+			// and the tree is not modified
+			const value_type& operator*() const {
+				if (cur_pos >= block_info.size)
+					throw invalid_iterator();
+				return cur_bptree->load_element(page, cur_pos, loaded, loaded_pos);
+			}
+			// The key of the element; unlike operator* it never reads a separately stored value
+			const Key& key() const {
+				if (cur_pos >= block_info.size)
+					throw invalid_iterator();
+				return cur_bptree->element_key(page, cur_pos, key_buffer);
+			}
+			const value_type* operator->() const {
+				return &**this;
+			}
+			bool operator==(const iterator& rhs) const {
+				return block_info.pos == rhs.block_info.pos
+					&& cur_pos == rhs.cur_pos;
+			}
+			bool operator==(const const_iterator& rhs) const {
+				return block_info.pos == rhs.block_info.pos
+					&& cur_pos == rhs.cur_pos;
+			}
+			bool operator!=(const iterator& rhs) const {
+				return block_info.pos != rhs.block_info.pos
+					|| cur_pos != rhs.cur_pos;
+			}
+			bool operator!=(const const_iterator& rhs) const {
+				return block_info.pos != rhs.block_info.pos
+					|| cur_pos != rhs.cur_pos;
+			}
+		};
+		// Default Constructor and Copy Constructor
+		// The default tree lives in BPTREE_ADDRESS
+		explicit BTree(off_t cache_page_num = DEFAULT_CACHE_SIZE, StorageType type = StdioStorage)
+			: BTree(BPTREE_ADDRESS, cache_page_num, type) {}
+		// Open the tree stored at file_address (created if it does not exist);
+		// its redo log is file_address with ".log" appended
+		explicit BTree(const char* file_address, off_t cache_page_num = DEFAULT_CACHE_SIZE, StorageType type = StdioStorage)
+			: storage_type(type), storage(Io::create_storage(type)), cache(cache_page_num, &log, storage) {
+			set_address(file_address);
+			open_file();
+		}
+		// Copy other into a temporary file next to it (removed when the copy is destroyed)
+		BTree(const BTree& other)
+			: storage_type(other.storage_type), storage(Io::create_storage(other.storage_type)),
+			cache(DEFAULT_CACHE_SIZE, &log, storage) {
+			char copy_address[BPTREE_ADDRESS_SIZE];
+			for (int i = 1; ; ++i) {
+				if (snprintf(copy_address, sizeof(copy_address), "%s.copy%d", other.address, i) >= BPTREE_ADDRESS_SIZE)
+					throw runtime_error();
+				if (access(copy_address, F_OK))
+					break;
+			}
+			set_address(copy_address);
+			temporary = true;
+			copy_from(other);
+		}
+		// Copy other into the file at file_address
+		BTree(const BTree& other, const char* file_address)
+			: storage_type(other.storage_type), storage(Io::create_storage(other.storage_type)),
+			cache(DEFAULT_CACHE_SIZE, &log, storage) {
+			set_address(file_address);
+			copy_from(other);
+		}
+		// Replace the content of this tree (in its own file) with a copy of other
+		BTree& operator=(const BTree& other) {
+			if (this == &other)
+				return *this;
+			clear();
+			copy_from(other);
+			return *this;
+		}
+		~BTree() {
+			delete async_pool;
+			if (temporary)
+				clear();
+			if (storage->is_open()) {
+				drain_retired_values();
+				write_checkpoint();
+			}
+			delete storage;
+		}
+		// Enable or disable concurrent mode; must be called while no other thread uses the tree
+		// In concurrent mode find/at/count and iteration may run in parallel from many threads;
+		// writers are serialized with each other and latch only the nodes they modify, so
+		// readers on other paths are not blocked. Iterators read a snapshot of their current
+		// leaf taken when they move onto it; clear() and assignment still need exclusive access.
+		// The space of an erased value stored out of line is reused only once no iterator
+		// snapshot can still read it
+		void set_concurrent(bool enable) {
+			check_file();
+			write_lock.enabled = enable;
+			size_lock.enabled = enable;
+			cache.set_concurrent(enable);
+			log.set_concurrent(enable);
+			if (enable)
+				latches.enable();
+			else
+				latches.disable();
+			if (!enable && !retired_values.empty()) {
+				drain_retired_values();
+				commit_operation();
+			}
+		}
+		// Start thread_num threads serving find_async and insert_async (0 stops them once
+		// the submitted requests are done); this also turns on concurrent mode, which stays on
+		// Each request runs as a blocking find or insert on one of the threads, so a single
+		// caller can keep up to thread_num requests in flight; with PreadStorage their leaf
+		// reads overlap instead of queuing behind each other in the cache
+		void set_async(off_t thread_num) {
+			delete async_pool;
+			async_pool = nullptr;
+			if (thread_num <= 0)
+				return;
+			set_concurrent(true);
+			async_pool = new Task_Pool(thread_num);
+		}
+		// Set the largest number of leaves that iteration and scan() ask the storage backend
+		// to read ahead (0 turns readahead off, at most 1024; the default is 64). The window
+		// starts at 4 leaves once a traversal crosses two leaves in a row and doubles while it
+		// stays sequential, so long scans over a cold file overlap their leaf reads.
+		// Must be called while no other thread uses the tree
+		void set_readahead(off_t leaf_num) {
+			readahead_num = std::max(off_t(0), std::min(leaf_num, MAX_READAHEAD_NUM));
+		}
+		// Look key up on an async thread; the future holds the value and Success, or Fail if
+		// the key does not exist. Without set_async the lookup is done before returning
+		std::future<pair<Value, OperationResult> > find_async(const Key& key) const {
+			return submit_async<pair<Value, OperationResult> >([this, key] {
+				Stat_Timer timer(&stats_data, LATENCY_FIND);
+				pair<Value, OperationResult> result;
+				off_t leaf_pos;
+				result.second = read_at(key, result.first, leaf_pos) ? Success : Fail;
+				return result;
+			});
+		}
+		// Insert on an async thread; the future holds the second member of insert's result
+		std::future<OperationResult> insert_async(const Key& key, const Value& value) {
+			return submit_async<OperationResult>([this, key, value] {
+				return insert(key, value).second;
+			});
+		}
+		// Set the durability mode; in GroupCommit mode dirty blocks are written
+		// back every op_num modifications or every interval_ms milliseconds
+		void set_durability(DurabilityMode mode, off_t op_num = 64, off_t interval_ms = 10) {
+			std::lock_guard<Switch_Mutex> guard(write_lock);
+			durability = mode;
+			group_op_num = op_num;
+			group_interval = interval_ms;
+			if (storage->is_open() && pending_op_num)
+				sync();
+		}
+		// Make every finished modification durable by forcing the redo log;
+		// the blocks themselves are written back lazily at checkpoints
+		void sync() {
+			std::lock_guard<Switch_Mutex> guard(write_lock);
+			pending_op_num = 0;
+			last_sync_time = std::chrono::steady_clock::now();
+			if (!storage->is_open())
+				return;
+			log.force();
+		}
+		// Write back all dirty blocks and the file head, then empty the redo log
+		void checkpoint() {
+			std::lock_guard<Switch_Mutex> guard(write_lock);
+			if (!storage->is_open())
+				return;
+			write_checkpoint();
+		}
+		// Insert: Insert certain Key-Value into the database
+		// Return a pair, the first of the pair is the iterator point to the new
+		// element, the second of the pair is Success if it is successfully inserted
+		pair<iterator, OperationResult> insert(const Key& key, const Value& value) {
+			Stat_Timer timer(&stats_data, LATENCY_INSERT);
+			std::lock_guard<Switch_Mutex> lock_guard(write_lock);
+			check_file();
+			if (empty()) {
+				Write_Latch guard(&latches);
+				guard.add(0);
+				guard.add(tree_data.data_block_head);
+				guard.add(tree_data.data_block_rear);
+				auto root_pos = create_leaf_node(tree_data.data_block_head, tree_data.data_block_rear);
+				
+				Block_Head temp_info;
+				Leaf_Data temp_data;
+				read_block(&temp_info, &temp_data, tree_data.data_block_head);
+				temp_info.next = root_pos;
+				write_block(&temp_info, &temp_data, tree_data.data_block_head);
+
+				read_block(&temp_info, &temp_data, tree_data.data_block_rear);
+				temp_info.last = root_pos;
+				write_block(&temp_info, &temp_data, tree_data.data_block_rear);
+
+				read_block(&temp_info, &temp_data, root_pos);
+				++temp_info.size;
+				temp_data.rebase(key, 0);
+				temp_data.set(0, key, new_value(value));
+				write_block(&temp_info, &temp_data, root_pos);
+
+				add_size(1);
+				tree_data.root_pos = root_pos;
+				guard.release();
+				commit_operation();
+
+				pair<iterator, OperationResult> result(begin(), Success);
+				return result;
+			}
+
+			//查找正确的节点位置
+			Tree_Path path;
+			auto cur_pos = find_leaf(key, &path);
+			Block_Head info;
+			Leaf_Data leaf_data;
+			read_block(&info, &leaf_data, cur_pos);
+			auto value_pos = leaf_lower_bound(leaf_data, info.size, key);
+			if (value_pos < info.size && key_equal(leaf_data.key(value_pos), key)) {
+				return pair<iterator, OperationResult>(end(), Fail);
+			}
+			//在此结点之前插入
+			//关键字压缩时key与叶子中的关键字可能相差过大，此时在插入位置分裂（至多两次），锁住整条路径
+			auto fits = leaf_data.fits(key, key, info.size);
+			if (!fits)
+				path.safe = path.cnt;
+			Write_Latch guard(&latches);
+			latch_insert(guard, path, cur_pos, info.size >= BLOCK_PAIR_NUM || !fits, info.next);
+			while (info.size >= BLOCK_PAIR_NUM || !leaf_data.fits(key, key, info.size)) {
+				auto mid_pos = info.size >= BLOCK_PAIR_NUM ? info.size >> 1 : value_pos;
+				auto cur_key = split_leaf_node(cur_pos, info, leaf_data, path, mid_pos,
+					mid_pos < info.size ? leaf_data.key(mid_pos) : key);
+				if (!key_less(key, cur_key)) {
+					cur_pos = info.next;
+					value_pos -= info.size;
+					read_block(&info, &leaf_data, cur_pos);
+				}
+			}
+
+			leaf_data.rebase(key, info.size);
+			for (off_t p = info.size - 1; p >= value_pos; --p)
+			{
+				leaf_data.move(p + 1, p);
+				if (p == value_pos)
+					break;
+			}
+			leaf_data.set(value_pos, key, new_value(value));
+			++info.size;
+			write_block(&info, &leaf_data, cur_pos);
+			add_path_count(path, cur_pos, 1);
+			guard.release();
+			iterator ans;
+			ans.cur_bptree = this;
+			ans.move_to(cur_pos);
+			ans.cur_pos = value_pos;
+			//修改树的基本参数
+			add_size(1);
+			commit_operation();
+			pair<iterator, OperationResult> re(ans, Success);
+			return re;
+		}
+		// Bulk load: build an empty tree bottom-up from [first, last), which must be
+		// sorted by strictly increasing key; each node is filled to fill_factor
+		// Return Fail and leave the tree empty if it was not empty or the input is not sorted
+		template <class InputIt>
+		OperationResult bulk_load(InputIt first, InputIt last, double fill_factor = 1.0) {
+			std::lock_guard<Switch_Mutex> lock_guard(write_lock);
+			check_file();
+			if (!empty())
+				return Fail;
+			if (first == last)
+				return Success;
+			Write_Latch guard(&latches);
+			guard.add(0);
+			guard.add(tree_data.data_block_head);
+			guard.add(tree_data.data_block_rear);
+			//此前的修改先落盘，新块不记日志
+			write_checkpoint();
+			auto origin_data = tree_data;
+			off_t cnt = 0, root_pos = 0, last_leaf = 0;
+			{
+				Bulk_Loader loader(this, fill_factor);
+				auto first_leaf = tree_data.block_cnt - 1;
+				Key prev_key = (*first).first;
+				for (; first != last; ++first, ++cnt) {
+					if (cnt && !key_less(prev_key, (*first).first)) {
+						tree_data = origin_data;
+						return Fail;
+					}
+					prev_key = (*first).first;
+					loader.push((*first).first, (*first).second);
+				}
+				last_leaf = loader.finish(root_pos);
+
+				//连接首尾的哨兵块
+				Block_Head temp_info;
+				Leaf_Data temp_data;
+				read_block(&temp_info, &temp_data, tree_data.data_block_head);
+				temp_info.next = first_leaf;
+				write_block(&temp_info, &temp_data, tree_data.data_block_head);
+				read_block(&temp_info, &temp_data, tree_data.data_block_rear);
+				temp_info.last = last_leaf;
+				write_block(&temp_info, &temp_data, tree_data.data_block_rear);
+			}
+			tree_data.root_pos = root_pos;
+			add_size(cnt);
+			guard.release();
+			commit_operation();
+			write_checkpoint();
+			return Success;
+		}
+		// Insert a batch of Key-Value pairs from the forward range [first, last)
+		// The batch is sorted by key and every run of keys landing in the same leaf is
+		// merged with a single block write; results[i] (if given) receives the result of
+		// the i-th pair, duplicates within the batch behave as if inserted in order
+		// Return the number of pairs successfully inserted
+		template <class ForwardIt>
+		off_t insert_batch(ForwardIt first, ForwardIt last, OperationResult* results = nullptr) {
+			auto n = off_t(std::distance(first, last));
+			if (n == 0)
+				return 0;
+			std::lock_guard<Switch_Mutex> lock_guard(write_lock);
+			check_file();
+			auto items = new pair<Key, Value>[n];
+			auto order = new off_t[n];
+			for (off_t i = 0; i < n; ++i, ++first) {
+				items[i].first = (*first).first;
+				items[i].second = (*first).second;
+				order[i] = i;
+				if (results)
+					results[i] = Fail;
+			}
+			std::stable_sort(order, order + n, [items](off_t lhs, off_t rhs) {
+				return key_less(items[lhs].first, items[rhs].first);
+			});
+
+			off_t idx = 0, inserted = 0;
+			//空树时先插入第一个
+			if (empty()) {
+				insert(items[order[0]].first, items[order[0]].second);
+				if (results)
+					results[order[0]] = Success;
+				++idx;
+				++inserted;
+			}
+			auto run = new off_t[BLOCK_PAIR_NUM];
+			Block_Head info;
+			Leaf_Data leaf_data;
+			Key fence;
+			bool has_fence;
+			while (idx < n) {
+				Tree_Path path;
+				auto cur_pos = find_leaf(items[order[idx]].first, &path, &fence, &has_fence);
+				read_block(&info, &leaf_data, cur_pos);
+				//落在此叶子的关键字可能使它分裂多次，此时锁住整条路径
+				auto group_end = n;
+				if (has_fence)
+					group_end = off_t(std::lower_bound(order + idx, order + n, fence, [items](off_t lhs, const Key& rhs) {
+						return key_less(items[lhs].first, rhs);
+					}) - order);
+				auto split = info.size + group_end - idx > BLOCK_PAIR_NUM;
+				if (split)
+					path.safe = path.cnt;
+				Write_Latch guard(&latches);
+				latch_insert(guard, path, cur_pos, split, info.next);
+				auto origin_size = info.size;
+				bool far = false;
+				while (!far && idx < n && (!has_fence || key_less(items[order[idx]].first, fence))) {
+					//收集能放进当前叶子的关键字
+					off_t run_cnt = 0;
+					while (idx < n && (!has_fence || key_less(items[order[idx]].first, fence))
+						&& info.size + run_cnt < BLOCK_PAIR_NUM) {
+						auto& key = items[order[idx]].first;
+						auto value_pos = leaf_lower_bound(leaf_data, origin_size, key);
+						bool duplicate = (idx > 0 && key_equal(items[order[idx - 1]].first, key))
+							|| (value_pos < origin_size && key_equal(leaf_data.key(value_pos), key));
+						if (!duplicate) {
+							//关键字压缩时放不进此叶子的关键字留给insert
+							if (!leaf_data.fits(run_cnt ? items[run[0]].first : key, key, info.size)) {
+								far = true;
+								break;
+							}
+							run[run_cnt++] = order[idx];
+						}
+						++idx;
+					}
+					//从后往前归并
+					if (run_cnt)
+						leaf_data.rebase(items[run[0]].first, info.size);
+					auto i = info.size - 1, j = run_cnt - 1, w = info.size + run_cnt - 1;
+					while (j >= 0) {
+						if (i >= 0 && key_less(items[run[j]].first, leaf_data.key(i))) {
+							leaf_data.move(w--, i--);
+						}
+						else {
+							leaf_data.set(w, items[run[j]].first, new_value(items[run[j]].second));
+							if (results)
+								results[run[j]] = Success;
+							--w;
+							--j;
+						}
+					}
+					info.size += run_cnt;
+					origin_size = info.size;
+					inserted += run_cnt;
+					add_size(run_cnt);
+					add_path_count(path, cur_pos, run_cnt);
+					//叶子已满且还有关键字落在此处：分裂后继续处理左半部分
+					if (info.size >= BLOCK_PAIR_NUM && idx < n
+						&& (!has_fence || key_less(items[order[idx]].first, fence))) {
+						fence = split_leaf_node(cur_pos, info, leaf_data, path);
+						has_fence = true;
+						origin_size = info.size;
+						commit_log();
+					}
+				}
+				write_block(&info, &leaf_data, cur_pos);
+				commit_log();
+				if (far) {
+					guard.release();
+					auto& item = items[order[idx]];
+					if (insert(item.first, item.second).second == Success) {
+						if (results)
+							results[order[idx]] = Success;
+						++inserted;
+					}
+					++idx;
+				}
+			}
+			delete[] run;
+			delete[] order;
+			delete[] items;
+			commit_operation();
+			return inserted;
+		}
+		// Erase: Erase the Key-Value
+		// Return Success if it is successfully erased
+		// Return Fail if the key doesn't exist in the database
+		// A node left less than half full borrows from or merges with a sibling, a root
+		// left with one child is replaced by it, and freed blocks and value slots are
+		// reused by later inserts. Without concurrent mode, erase invalidates iterators;
+		// in concurrent mode iterators keep working, but dereferencing one whose element
+		// was erased may see another value when values are stored separately
+		OperationResult erase(const Key& key) {
+			Stat_Timer timer(&stats_data, LATENCY_ERASE);
+			std::lock_guard<Switch_Mutex> lock_guard(write_lock);
+			check_file();
+			if (empty())
+				return Fail;
+			Tree_Path path;
+			auto cur_pos = find_leaf(key, &path);
+			Block_Head info;
+			Leaf_Data leaf_data;
+			read_block(&info, &leaf_data, cur_pos);
+			auto value_pos = leaf_lower_bound(leaf_data, info.size, key);
+			if (value_pos == info.size || !key_equal(leaf_data.key(value_pos), key))
+				return Fail;
+
+			Write_Latch guard(&latches);
+			latch_erase(guard, path, info);
+			free_value(leaf_data.value(value_pos));
+			for (auto p = value_pos; p + 1 < info.size; ++p)
+				leaf_data.move(p, p + 1);
+			--info.size;
+			write_block(&info, &leaf_data, cur_pos);
+			add_path_count(path, cur_pos, -1);
+			if (leaf_underflow(info.size, path)) {
+				erase_rebalance(path, info, leaf_data);
+				structure_version.fetch_add(1, std::memory_order_release);
+			}
+			add_size(-1);
+			guard.release();
+			commit_operation();
+			return Success;
+		}
+		// Online compaction: do up to max_steps small steps, each under the write lock and
+		// committed on its own, so other operations run between them. Walking the leaf chain,
+		// a step spreads a leaf over its neighbors when it and the next two leaves together
+		// fill at most one and a half leaves, or moves the leaf (and a leaf in its way) so
+		// that the chain follows file order. Once all leaves are placed, each step drops a
+		// free block from the end of the file or moves the node there into the lowest free
+		// block; the pass stops at a value block or when no lower block is free, and the file
+		// is then truncated. The first step of a pass walks the free list.
+		// Return true when the pass has finished (the next call starts a new one); like
+		// erase, it invalidates iterators unless the tree is in concurrent mode
+		bool compact(off_t max_steps = 64) {
+			for (off_t i = 0; i < max_steps; ++i)
+				if (!compact_step())
+					return true;
+			return false;
+		}
+		iterator begin() {
+			check_file();
+			iterator result;
+			result.cur_bptree = this;
+			result.move_to(tree_data.data_block_head);
+			result.cur_pos = 0;
+			++result;
+			return result;
+		}
+		const_iterator cbegin() const {
+			const_iterator result;
+			result.cur_bptree = this;
+			result.move_to(tree_data.data_block_head);
+			result.cur_pos = 0;
+			++result;
+			return result;
+		}
+		// Return a iterator to the end(the next element after the last)
+		iterator end() {
+			check_file();
+			iterator result;
+			result.cur_bptree = this;
+			result.move_to(tree_data.data_block_rear);
+			result.cur_pos = 0;
+			return result;
+		}
+		const_iterator cend() const {
+			const_iterator result;
+			result.cur_bptree = this;
+			result.move_to(tree_data.data_block_rear);
+			result.cur_pos = 0;
+			return result;
+		}
+		// Check whether this BTree is empty
+		bool empty() const {
+			std::lock_guard<Switch_Mutex> guard(size_lock);
+			if (!storage->is_open())
+				return true;
+			return tree_data.size == 0;
+		}
+		// Return the number of levels (0 for an empty tree, 1 when the root is a leaf)
+		off_t height() const {
+			latches.lock_shared(0);
+			auto cur_pos = tree_data.root_pos;
+			if (!cur_pos) {
+				latches.unlock_shared(0);
+				return 0;
+			}
+			latches.lock_shared(cur_pos);
+			latches.unlock_shared(0);
+			off_t result = 1;
+			while (true) {
+				auto page = cache.pin(cur_pos);
+				auto info = reinterpret_cast<const Block_Head*>(page);
+				if (info->block_type) {
+					cache.unpin(cur_pos);
+					latches.unlock_shared(cur_pos);
+					return result;
+				}
+				auto next_pos = reinterpret_cast<const Normal_Data*>(page + INIT_SIZE)->val[0].child;
+				cache.unpin(cur_pos);
+				latches.lock_shared(next_pos);
+				latches.unlock_shared(cur_pos);
+				cur_pos = next_pos;
+				++result;
+			}
+		}
+		// Number of blocks read from and written back to the storage backend so far;
+		// with MmapStorage blocks are accessed in place and only write-backs are counted
+		void io_count(off_t& reads, off_t& writes) const {
+			cache.io_count(reads, writes);
+		}
+		// Snapshot of the statistics collected since the tree was opened or reset_stats();
+		// the counters are updated with relaxed atomics, so a snapshot taken while other
+		// threads run is not a single point in time
+		BTree_Stats stats() const {
+			BTree_Stats result;
+#if BPTREE_STATS
+			auto& c = stats_data.counter;
+			result.leaf_reads = c[STAT_LEAF_READ].load(std::memory_order_relaxed);
+			result.inner_reads = c[STAT_INNER_READ].load(std::memory_order_relaxed);
+			result.leaf_writes = c[STAT_LEAF_WRITE].load(std::memory_order_relaxed);
+			result.inner_writes = c[STAT_INNER_WRITE].load(std::memory_order_relaxed);
+			result.value_reads = c[STAT_VALUE_READ].load(std::memory_order_relaxed);
+			result.value_writes = c[STAT_VALUE_WRITE].load(std::memory_order_relaxed);
+			result.leaf_splits = c[STAT_LEAF_SPLIT].load(std::memory_order_relaxed);
+			result.inner_splits = c[STAT_INNER_SPLIT].load(std::memory_order_relaxed);
+			result.allocations = c[STAT_ALLOCATION].load(std::memory_order_relaxed);
+			result.frees = c[STAT_FREE].load(std::memory_order_relaxed);
+			result.leaf_merges = c[STAT_LEAF_MERGE].load(std::memory_order_relaxed);
+			result.inner_merges = c[STAT_INNER_MERGE].load(std::memory_order_relaxed);
+			result.relocations = c[STAT_RELOCATION].load(std::memory_order_relaxed);
+			result.readaheads = c[STAT_READAHEAD].load(std::memory_order_relaxed);
+			BTree_Stats::Histogram* histogram[LATENCY_NUM] = {
+				&result.insert_latency, &result.find_latency, &result.at_latency,
+				&result.erase_latency, &result.advance_latency
+			};
+			for (off_t i = 0; i < LATENCY_NUM; ++i) {
+				for (off_t j = 0; j < BUCKET_NUM; ++j) {
+					histogram[i]->bucket[j] = stats_data.bucket[i][j].load(std::memory_order_relaxed);
+					histogram[i]->count += histogram[i]->bucket[j];
+				}
+				histogram[i]->total_ns = stats_data.total_ns[i].load(std::memory_order_relaxed);
+			}
+#endif
+			cache.io_count(result.storage_reads, result.storage_writes);
+			log.io_count(result.log_bytes, result.log_syncs);
+			result.storage_reads -= stats_data.base_storage_reads;
+			result.storage_writes -= stats_data.base_storage_writes;
+			result.flushed_bytes = result.storage_writes * BLOCK_SIZE;
+			result.log_bytes -= stats_data.base_log_bytes;
+			result.log_syncs -= stats_data.base_log_syncs;
+			return result;
+		}
+		// Reset all statistics to zero
+		void reset_stats() {
+			stats_data.reset();
+			cache.io_count(stats_data.base_storage_reads, stats_data.base_storage_writes);
+			log.io_count(stats_data.base_log_bytes, stats_data.base_log_syncs);
+		}
+		// Walk the tree stored at file_address without opening it: height, nodes and fill
+		// factor per level, fill-factor distribution of leaves and index nodes, how far the
+		// leaf chain is from physical order, and blocks that nothing refers to
+		// It reads one block at a time (keeping one buffer per level and a bitmap of the
+		// blocks), so files much larger than memory can be analyzed; it sees the file as
+		// of the last checkpoint. Throw runtime_error if the file cannot be read or was
+		// created with a different page size or Compact_Key setting
+		static BTree_Shape analyze(const char* file_address) {
+			BTree_Shape shape;
+			auto fp = fopen(file_address, "rb");
+			if (!fp)
+				throw runtime_error();
+			File_Head head;
+			char buff[BLOCK_SIZE] = { 0 };
+			auto len = fread(buff, 1, BLOCK_SIZE, fp);
+			memcpy(&head, buff, sizeof(head));
+			if (len < sizeof(head) || (head.block_size ? head.block_size : 4096) != BLOCK_SIZE
+				|| head.key_format != PACKED_KEY || head.inner_format != INNER_FORMAT
+				|| head.block_format != BLOCK_FORMAT || head.block_cnt < 1) {
+				fclose(fp);
+				throw runtime_error();
+			}
+			fseek(fp, 0, SEEK_END);
+			shape.file_blocks = (ftell(fp) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			shape.block_cnt = head.block_cnt;
+			shape.block_size = BLOCK_SIZE;
+			shape.size = head.size;
+			shape.leaf_capacity = BLOCK_PAIR_NUM;
+			shape.inner_capacity = BLOCK_KEY_NUM;
+			char log_address[BPTREE_ADDRESS_SIZE + 4];
+			snprintf(log_address, sizeof(log_address), "%s.log", file_address);
+			struct stat st;
+			if (!::stat(log_address, &st))
+				shape.log_bytes = st.st_size;
+			{
+				Shape_Walker walker(fp, shape, head.block_cnt);
+				walker.mark_fixed(0);
+				walker.mark_fixed(head.data_block_head);
+				walker.mark_fixed(head.data_block_rear);
+				if (head.root_pos)
+					walker.visit(head.root_pos, 0);
+				walker.walk_chain(head.data_block_head, head.data_block_rear);
+				if (SEPARATE_VALUE && head.value_block)
+					walker.mark_fixed(head.value_block);
+				walker.walk_free(head.free_head);
+				walker.walk_free_values(head.value_free);
+				shape.unreachable_blocks = walker.unmarked();
+			}
+			fclose(fp);
+			for (off_t i = 0; i < shape.height; ++i) {
+				auto capacity = i == shape.height - 1 ? BLOCK_PAIR_NUM : BLOCK_KEY_NUM;
+				shape.level_fill[i] = double(shape.level_entries[i]) / double(shape.level_nodes[i] * capacity);
+			}
+			if (shape.record_cnt != shape.size)
+				++shape.error_cnt;
+			return shape;
+		}
+		// Return the number of <K,V> pairs
+		off_t size() const {
+			std::lock_guard<Switch_Mutex> guard(size_lock);
+			if (!storage->is_open())
+				return 0;
+			return tree_data.size;
+		}
+		// Clear the BTree
+		void clear() {
+			std::lock_guard<Switch_Mutex> guard(write_lock);
+			if (!storage->is_open())
+				return;
+			cache.reset();
+			storage->close();
+			log.close();
+			remove(address);
+			remove(log_address);
+			File_Head new_file_head;
+			tree_data = new_file_head;
+			compaction.reset();
+			retired_values.reset();
+		}
+		// Return the value refer to the Key(key)
+		Value at(const Key& key) {
+			Stat_Timer timer(&stats_data, LATENCY_AT);
+			Value result;
+			off_t leaf_pos;
+			if (read_at(key, result, leaf_pos))
+				return result;
+			if (!leaf_pos)
+				throw container_is_empty();
+			throw index_out_of_bound();
+		}
+		
+		/**
+		 * Returns the number of elements with key
+		 *   that compares equivalent to the specified argument,
+		 * The default method of check the equivalence is !(a < b || b > a)
+		 */
+		off_t count(const Key& key) const {
+			return find(key) == cend() ? 0 : 1;
+		}
+		// Order statistics: each index node records how many elements are under each
+		// child, so these read only one block per level
+		// Return the number of elements whose key is less than key
+		off_t rank(const Key& key) const {
+			return rank_of(key);
+		}
+		// Return the number of elements whose key is in [lo, hi); in concurrent mode the
+		// two bounds are counted by separate descents
+		off_t count_range(const Key& lo, const Key& hi) const {
+			if (!key_less(lo, hi))
+				return 0;
+			auto cnt = rank_of(hi) - rank_of(lo);
+			return cnt > 0 ? cnt : 0;
+		}
+		// Return an iterator to the k-th smallest element (counting from 0),
+		// or end() if k is not less than size()
+		iterator select(off_t k) {
+			auto cur_pos = select_leaf(k);
+			if (!cur_pos)
+				return end();
+			iterator result;
+			result.cur_bptree = this;
+			result.move_to(cur_pos);
+			result.cur_pos = k;
+			latches.unlock_shared(cur_pos);
+			return result;
+		}
+		const_iterator select(off_t k) const {
+			auto cur_pos = select_leaf(k);
+			if (!cur_pos)
+				return cend();
+			const_iterator result;
+			result.cur_bptree = this;
+			result.move_to(cur_pos);
+			result.cur_pos = k;
+			latches.unlock_shared(cur_pos);
+			return result;
+		}
+		
+		/**
+		 * Finds an element with key equivalent to key.
+		 * key value of the element to search for.
+		 * Iterator to an element with key equivalent to key.
+		 *   If no such element is found, past-the-end (see end()) iterator is
+		 * returned.
+		 */
+		iterator find(const Key& key) {
+			Stat_Timer timer(&stats_data, LATENCY_FIND);
+			//查找正确的节点位置
+			off_t cur_pos, value_pos;
+			if (locate(key, cur_pos, value_pos)) {
+				iterator result;
+				result.cur_bptree = this;
+				result.move_to(cur_pos);
+				result.cur_pos = value_pos;
+				latches.unlock_shared(cur_pos);
+				return result;
+			}
+			if (cur_pos)
+				latches.unlock_shared(cur_pos);
+			return end();
+		}
+		const_iterator find(const Key& key) const {
+			Stat_Timer timer(&stats_data, LATENCY_FIND);
+			//查找正确的节点位置
+			off_t cur_pos, value_pos;
+			if (locate(key, cur_pos, value_pos)) {
+				const_iterator result;
+				result.cur_bptree = this;
+				result.move_to(cur_pos);
+				result.cur_pos = value_pos;
+				latches.unlock_shared(cur_pos);
+				return result;
+			}
+			if (cur_pos)
+				latches.unlock_shared(cur_pos);
+			return cend();
+		}
+		// Return an iterator to the first element whose key is not less than key
+		// (upper_bound: greater than key), or end() if there is none
+		iterator lower_bound(const Key& key) {
+			iterator result;
+			result.cur_bptree = this;
+			seek(result, key, false);
+			return result;
+		}
+		const_iterator lower_bound(const Key& key) const {
+			const_iterator result;
+			result.cur_bptree = this;
+			seek(result, key, false);
+			return result;
+		}
+		iterator upper_bound(const Key& key) {
+			iterator result;
+			result.cur_bptree = this;
+			seek(result, key, true);
+			return result;
+		}
+		const_iterator upper_bound(const Key& key) const {
+			const_iterator result;
+			result.cur_bptree = this;
+			seek(result, key, true);
+			return result;
+		}
+		// Return [lower_bound(key), upper_bound(key)) found by a single descent
+		pair<iterator, iterator> equal_range(const Key& key) {
+			auto first = lower_bound(key);
+			auto last = first;
+			if (!at_end(last) && key_equal(last.key(), key))
+				++last;
+			return pair<iterator, iterator>(first, last);
+		}
+		pair<const_iterator, const_iterator> equal_range(const Key& key) const {
+			auto first = lower_bound(key);
+			auto last = first;
+			if (!at_end(last) && key_equal(last.key(), key))
+				++last;
+			return pair<const_iterator, const_iterator>(first, last);
+		}
+		// Range scan: call visit(key, value) for every element whose key is in [lo, hi),
+		// in increasing order, or decreasing order if reverse is true, until visit
+		// returns false. The scan works on the leaf pages directly: it finds the bounds
+		// once per leaf and builds no iterator or value_type per element (a value stored
+		// out of line is read into a temporary). visit must not modify the tree; in
+		// concurrent mode each leaf is visited as a consistent snapshot
+		// Return the number of elements visited
+		template <class Visitor>
+		off_t scan(const Key& lo, const Key& hi, Visitor visit, bool reverse = false) const {
+			if (!key_less(lo, hi))
+				return 0;
+			const_iterator it;
+			it.cur_bptree = this;
+			off_t cnt = 0;
+			if (!reverse) {
+				seek_leaf(it, lo, false);
+				while (!at_end(it)) {
+					auto& data = *reinterpret_cast<const Leaf_Data*>(it.page + INIT_SIZE);
+					auto size = it.block_info.size;
+					auto last = size && key_less(data.key(size - 1), hi) ? size : leaf_lower_bound(data, size, hi);
+					for (; it.cur_pos < last; ++it.cur_pos) {
+						++cnt;
+						if (!visit_element(data, it.cur_pos, visit))
+							return cnt;
+					}
+					if (last < size)
+						break;
+					next_leaf(it);
+				}
+				return cnt;
+			}
+			seek_leaf(it, hi, false);
+			--it.cur_pos;
+			while (true) {
+				if (it.cur_pos < 0) {
+					if (it.block_info.pos == tree_data.data_block_head)
+						break;
+					prev_leaf(it);
+					continue;
+				}
+				auto& data = *reinterpret_cast<const Leaf_Data*>(it.page + INIT_SIZE);
+				auto first = key_less(data.key(0), lo) ? leaf_lower_bound(data, it.block_info.size, lo) : 0;
+				for (; it.cur_pos >= first; --it.cur_pos) {
+					++cnt;
+					if (!visit_element(data, it.cur_pos, visit))
+						return cnt;
+				}
+				if (first > 0)
+					break;
+			}
+			return cnt;
+		}
+	};
+
+	//同一目录下多棵同类型的独立树，每棵树有自己的文件与重做日志，树名记录在目录文件中以便再次打开
+	//树之间不共享文件句柄与缓存，不同的树可以由不同的线程使用
+	template <class Key, class Value, class Compare = std::less<Key> >
+	class BTree_Catalog {
+	public:
+		typedef BTree<Key, Value, Compare> tree_type;
+
+	private:
+		//名字的最大长度
+		constexpr static int NAME_SIZE = 64;
+
+		//目录项
+		class Entry {
+		public:
+			char name[NAME_SIZE];
+			//尚未打开时为空
+			tree_type* tree = nullptr;
+		};
+
+		char directory[BPTREE_ADDRESS_SIZE];
+		off_t cache_page_num;
+		StorageType storage_type;
+		Entry* entries = nullptr;
+		off_t entry_cnt = 0, entry_capacity = 0;
+		//保护目录项
+		mutable std::mutex mutex;
+
+		//拼出目录下文件的地址
+		void make_address(char* buff, const char* name, const char* suffix = "") const {
+			if (snprintf(buff, BPTREE_ADDRESS_SIZE, "%s/%s%s", directory, name, suffix) >= BPTREE_ADDRESS_SIZE)
+				throw runtime_error();
+		}
+		off_t lookup(const char* name) const {
+			for (off_t i = 0; i < entry_cnt; ++i)
+				if (!strcmp(entries[i].name, name))
+					return i;
+			return -1;
+		}
+		void add_entry(const char* name) {
+			if (entry_cnt == entry_capacity) {
+				entry_capacity = entry_capacity ? entry_capacity << 1 : 16;
+				auto new_entries = new Entry[entry_capacity];
+				for (off_t i = 0; i < entry_cnt; ++i)
+					new_entries[i] = entries[i];
+				delete[] entries;
+				entries = new_entries;
+			}
+			strcpy(entries[entry_cnt].name, name);
+			entries[entry_cnt].tree = nullptr;
+			++entry_cnt;
+		}
+		//名字只能由字母、数字、'_'、'-'和'.'组成，且不能以'.'开头
+		//树name存放在目录下的name.tree和name.tree.log中，不会与其他树或目录文件重名
+		static bool valid_name(const char* name) {
+			auto len = strlen(name);
+			if (len == 0 || len >= size_t(NAME_SIZE) || name[0] == '.')
+				return false;
+			for (size_t i = 0; i < len; ++i) {
+				auto c = name[i];
+				if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+					|| c == '_' || c == '-' || c == '.'))
+					return false;
+			}
+			return true;
+		}
+		//重写目录文件（先写临时文件再改名）
+		void write_catalog() const {
+			char catalog_address[BPTREE_ADDRESS_SIZE], temp_address[BPTREE_ADDRESS_SIZE + 4];
+			make_address(catalog_address, BPTREE_CATALOG_NAME);
+			snprintf(temp_address, sizeof(temp_address), "%s.tmp", catalog_address);
+			auto fp = fopen(temp_address, "w");
+			if (!fp)
+				throw runtime_error();
+			for (off_t i = 0; i < entry_cnt; ++i)
+				fprintf(fp, "%s\n", entries[i].name);
+			fflush(fp);
+			fsync(fileno(fp));
+			fclose(fp);
+			if (rename(temp_address, catalog_address))
+				throw runtime_error();
+		}
+
+	public:
+		// Open (or create) the catalog in directory; trees are opened lazily with
+		// cache_page_num cache pages and the given storage backend each
+		explicit BTree_Catalog(const char* catalog_directory, off_t cache_page_num = tree_type::DEFAULT_CACHE_SIZE,
+			StorageType type = StdioStorage) : cache_page_num(cache_page_num), storage_type(type) {
+			auto len = strlen(catalog_directory);
+			if (len == 0 || len >= size_t(BPTREE_ADDRESS_SIZE) - NAME_SIZE - 8)
+				throw runtime_error();
+			memcpy(directory, catalog_directory, len + 1);
+			if (mkdir(directory, 0755) && errno != EEXIST)
+				throw runtime_error();
+			char catalog_address[BPTREE_ADDRESS_SIZE];
+			make_address(catalog_address, BPTREE_CATALOG_NAME);
+			auto fp = fopen(catalog_address, "r");
+			if (!fp)
+				return;
+			char line[NAME_SIZE + 2];
+			while (fgets(line, sizeof(line), fp)) {
+				auto len = strlen(line);
+				while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+					line[--len] = 0;
+				if (valid_name(line) && lookup(line) == -1)
+					add_entry(line);
+			}
+			fclose(fp);
+		}
+		BTree_Catalog(const BTree_Catalog&) = delete;
+		BTree_Catalog& operator=(const BTree_Catalog&) = delete;
+		~BTree_Catalog() {
+			for (off_t i = 0; i < entry_cnt; ++i)
+				delete entries[i].tree;
+			delete[] entries;
+		}
+		// Return the tree called name, creating it if it does not exist
+		// The reference stays valid until the tree is dropped or the catalog is destroyed
+		tree_type& open(const char* name) {
+			std::lock_guard<std::mutex> guard(mutex);
+			if (!valid_name(name))
+				throw runtime_error();
+			auto idx = lookup(name);
+			if (idx == -1) {
+				add_entry(name);
+				idx = entry_cnt - 1;
+				write_catalog();
+			}
+			if (!entries[idx].tree) {
+				char tree_address[BPTREE_ADDRESS_SIZE];
+				make_address(tree_address, name, ".tree");
+				entries[idx].tree = new tree_type(tree_address, cache_page_num, storage_type);
+			}
+			return *entries[idx].tree;
+		}
+		// Check whether a tree called name exists
+		bool contains(const char* name) const {
+			std::lock_guard<std::mutex> guard(mutex);
+			return lookup(name) != -1;
+		}
+		// Close and delete the tree called name together with its files
+		// This invalidates every reference to the tree returned by open(name); no other
+		// thread may use the tree during the call, and it must not be used afterwards
+		// Return Fail if there is no such tree
+		OperationResult drop(const char* name) {
+			std::lock_guard<std::mutex> guard(mutex);
+			auto idx = lookup(name);
+			if (idx == -1)
+				return Fail;
+			char tree_address[BPTREE_ADDRESS_SIZE];
+			make_address(tree_address, name, ".tree");
+			if (!entries[idx].tree)
+				entries[idx].tree = new tree_type(tree_address, cache_page_num, storage_type);
+			entries[idx].tree->clear();
+			delete entries[idx].tree;
+			for (auto i = idx; i + 1 < entry_cnt; ++i)
+				entries[i] = entries[i + 1];
+			--entry_cnt;
+			write_catalog();
+			return Success;
+		}
+		// Return the number of trees in the catalog
+		off_t size() const {
+			std::lock_guard<std::mutex> guard(mutex);
+			return entry_cnt;
+		}
+		// Return the name of the index-th tree; the pointer is invalidated when trees are added or dropped
+		const char* name(off_t index) const {
+			std::lock_guard<std::mutex> guard(mutex);
+			if (index < 0 || index >= entry_cnt)
+				throw index_out_of_bound();
+			return entries[index].name;
+		}
+	};
+
+	//固定数量工作线程的并行循环：run(n, job)由所有工作线程和调用者一起执行job(0..n-1)，全部完成后返回
+	class Parallel_Pool {
+	private:
+		std::thread* workers = nullptr;
+		off_t worker_num = 0;
+		std::mutex mutex;
+		//同一时间只执行一个任务
+		std::mutex run_mutex;
+		std::condition_variable start_cv, done_cv;
+		std::function<void(off_t)> job;
+		off_t job_num = 0;
+		std::atomic<off_t> next_job{ 0 };
+		//尚未完成当前任务的工作线程数
+		off_t running = 0;
+		//每发布一个任务加一
+		off_t generation = 0;
+		bool stop = false;
+		//第一个抛出的异常，由run重新抛出
+		std::exception_ptr error;
+
+		void execute() {
+			for (off_t i; (i = next_job++) < job_num; ) {
+				try {
+					job(i);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> guard(mutex);
+					if (!error)
+						error = std::current_exception();
+				}
+			}
+		}
+		void work() {
+			off_t seen = 0;
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true) {
+				start_cv.wait(lock, [&] { return stop || generation != seen; });
+				if (stop)
+					return;
+				seen = generation;
+				lock.unlock();
+				execute();
+				lock.lock();
+				if (--running == 0)
+					done_cv.notify_all();
+			}
+		}
+
+	public:
+		explicit Parallel_Pool(off_t thread_num) {
+			worker_num = thread_num > 1 ? thread_num - 1 : 0;
+			workers = new std::thread[worker_num];
+			for (off_t i = 0; i < worker_num; ++i)
+				workers[i] = std::thread([this] { work(); });
+		}
+		Parallel_Pool(const Parallel_Pool&) = delete;
+		Parallel_Pool& operator=(const Parallel_Pool&) = delete;
+		~Parallel_Pool() {
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				stop = true;
+			}
+			start_cv.notify_all();
+			for (off_t i = 0; i < worker_num; ++i)
+				workers[i].join();
+			delete[] workers;
+		}
+		void run(off_t n, std::function<void(off_t)> new_job) {
+			std::lock_guard<std::mutex> run_guard(run_mutex);
+			{
+				std::lock_guard<std::mutex> guard(mutex);
+				job = std::move(new_job);
+				job_num = n;
+				next_job = 0;
+				running = worker_num;
+				error = nullptr;
+				++generation;
+			}
+			start_cv.notify_all();
+			execute();
+			std::unique_lock<std::mutex> lock(mutex);
+			done_cv.wait(lock, [this] { return running == 0; });
+			if (error)
+				std::rethrow_exception(error);
+		}
+	};
+
+	//按关键字的哈希分到shard_num棵独立的树上，第K棵存放在"<address>.shardK"中
+	//单点操作只访问一个分片，不同分片上的写者互不竞争；批量插入按分片拆开在线程池上执行，遍历时把各分片归并回关键字顺序
+	//分片数记录在"<address>.shards"中，再次打开时必须相同
+	template <class Key, class Value, class Compare = std::less<Key>, class Hash = std::hash<Key> >
+	class ShardedBTree {
+	public:
+		typedef BTree<Key, Value, Compare> tree_type;
+		typedef pair<const Key, Value> value_type;
+
+	private:
+		tree_type** shards = nullptr;
+		off_t shard_num = 0;
+		Parallel_Pool pool;
+
+		//关键字所在的分片
+		off_t shard_of(const Key& key) const {
+			auto h = (unsigned long long)Hash()(key) * 0x9E3779B97F4A7C15ull;
+			return off_t((h >> 32) % (unsigned long long)shard_num);
+		}
+		static bool key_less(const Key& lhs, const Key& rhs) {
+			return Compare()(lhs, rhs);
+		}
+		//检查或记录分片数
+		static void check_shard_num(const char* address, off_t shard_num) {
+			char meta_address[BPTREE_ADDRESS_SIZE];
+			if (snprintf(meta_address, sizeof(meta_address), "%s.shards", address) >= BPTREE_ADDRESS_SIZE)
+				throw runtime_error();
+			auto fp = fopen(meta_address, "r");
+			if (fp) {
+				long long recorded = 0;
+				auto ok = fscanf(fp, "%lld", &recorded) == 1 && recorded == shard_num;
+				fclose(fp);
+				if (!ok)
+					throw runtime_error();
+				return;
+			}
+			fp = fopen(meta_address, "w");
+			if (!fp)
+				throw runtime_error();
+			fprintf(fp, "%lld\n", (long long)shard_num);
+			fclose(fp);
+		}
+		static off_t default_thread_num(off_t shard_num) {
+			off_t hardware = std::thread::hardware_concurrency();
+			return hardware && hardware < shard_num ? hardware : shard_num;
+		}
+
+	public:
+		//有序迭代器：各分片迭代器的k路归并
+		class const_iterator {
+			friend class ShardedBTree;
+		private:
+			const ShardedBTree* owner = nullptr;
+			//每个分片当前的位置
+			typename tree_type::const_iterator* cur = nullptr;
+			//按当前关键字排列的分片小根堆
+			off_t* heap = nullptr;
+			off_t heap_size = 0;
+
+			bool heap_less(off_t a, off_t b) const {
+				return key_less(cur[heap[a]].key(), cur[heap[b]].key());
+			}
+			void sift_down(off_t p) {
+				while (true) {
+					auto l = p * 2 + 1, r = l + 1, m = p;
+					if (l < heap_size && heap_less(l, m))
+						m = l;
+					if (r < heap_size && heap_less(r, m))
+						m = r;
+					if (m == p)
+						return;
+					std::swap(heap[p], heap[m]);
+					p = m;
+				}
+			}
+			void sift_up(off_t p) {
+				while (p && heap_less(p, (p - 1) / 2)) {
+					std::swap(heap[p], heap[(p - 1) / 2]);
+					p = (p - 1) / 2;
+				}
+			}
+			void allocate(const ShardedBTree* sharded_tree) {
+				owner = sharded_tree;
+				cur = new typename tree_type::const_iterator[owner->shard_num];
+				heap = new off_t[owner->shard_num];
+				heap_size = 0;
+			}
+			void release() {
+				delete[] cur;
+				delete[] heap;
+				cur = nullptr;
+				heap = nullptr;
+				heap_size = 0;
+			}
+
+		public:
+			const_iterator() {}
+			const_iterator(const const_iterator& other) {
+				*this = other;
+			}
+			const_iterator& operator=(const const_iterator& other) {
+				if (this == &other)
+					return *this;
+				release();
+				if (!other.owner) {
+					owner = nullptr;
+					return *this;
+				}
+				allocate(other.owner);
+				for (off_t i = 0; i < owner->shard_num; ++i)
+					cur[i] = other.cur[i];
+				heap_size = other.heap_size;
+				for (off_t i = 0; i < heap_size; ++i)
+					heap[i] = other.heap[i];
+				return *this;
+			}
+			~const_iterator() {
+				release();
+			}
+			const_iterator& operator++() {
+				if (!heap_size)
+					throw invalid_iterator();
+				auto shard = heap[0];
+				++cur[shard];
+				if (owner->shards[shard]->at_end(cur[shard]))
+					heap[0] = heap[--heap_size];
+				sift_down(0);
+				return *this;
+			}
+			const_iterator operator++(int) {
+				auto tmp = *this;
+				++*this;
+				return tmp;
+			}
+			const value_type& operator*() const {
+				if (!heap_size)
+					throw invalid_iterator();
+				return *cur[heap[0]];
+			}
+			const value_type* operator->() const {
+				return &**this;
+			}
+			bool operator==(const const_iterator& rhs) const {
+				if (heap_size != rhs.heap_size)
+					return false;
+				return !heap_size || (heap[0] == rhs.heap[0] && cur[heap[0]] == rhs.cur[rhs.heap[0]]);
+			}
+			bool operator!=(const const_iterator& rhs) const {
+				return !(*this == rhs);
+			}
+		};
+
+		// Open (or create) shard_num shards under address; batches run on thread_num
+		// threads (by default one per shard, at most one per core)
+		ShardedBTree(const char* address, off_t shard_num, off_t thread_num = 0,
+			off_t cache_page_num = tree_type::DEFAULT_CACHE_SIZE, StorageType type = StdioStorage)
+			: shard_num(shard_num), pool(thread_num > 0 ? thread_num : default_thread_num(shard_num)) {
+			if (shard_num <= 0)
+				throw runtime_error();
+			check_shard_num(address, shard_num);
+			shards = new tree_type*[shard_num]();
+			char shard_address[BPTREE_ADDRESS_SIZE];
+			try {
+				for (off_t i = 0; i < shard_num; ++i) {
+					if (snprintf(shard_address, sizeof(shard_address), "%s.shard%lld", address, (long long)i) >= BPTREE_ADDRESS_SIZE)
+						throw runtime_error();
+					shards[i] = new tree_type(shard_address, cache_page_num, type);
+					shards[i]->set_concurrent(true);
+				}
+			}
+			catch (...) {
+				for (off_t i = 0; i < shard_num; ++i)
+					delete shards[i];
+				delete[] shards;
+				throw;
+			}
+		}
+		ShardedBTree(const ShardedBTree&) = delete;
+		ShardedBTree& operator=(const ShardedBTree&) = delete;
+		~ShardedBTree() {
+			pool.run(shard_num, [this](off_t i) {
+				delete shards[i];
+			});
+			delete[] shards;
+		}
+		// Return the number of shards
+		off_t shard_count() const {
+			return shard_num;
+		}
+		// Return the shard holding key
+		tree_type& shard(const Key& key) {
+			return *shards[shard_of(key)];
+		}
+		// Set the durability mode of every shard
+		void set_durability(DurabilityMode mode, off_t op_num = 64, off_t interval_ms = 10) {
+			for (off_t i = 0; i < shard_num; ++i)
+				shards[i]->set_durability(mode, op_num, interval_ms);
+		}
+		// Set the readahead window of every shard's sequential scans
+		void set_readahead(off_t leaf_num) {
+			for (off_t i = 0; i < shard_num; ++i)
+				shards[i]->set_readahead(leaf_num);
+		}
+		// Force the redo logs of all shards in parallel
+		void sync() {
+			pool.run(shard_num, [this](off_t i) {
+				shards[i]->sync();
+			});
+		}
+		// Checkpoint all shards in parallel
+		void checkpoint() {
+			pool.run(shard_num, [this](off_t i) {
+				shards[i]->checkpoint();
+			});
+		}
+		// Insert: Return Success if the key was not present
+		OperationResult insert(const Key& key, const Value& value) {
+			return shards[shard_of(key)]->insert(key, value).second;
+		}
+		// Insert a batch of Key-Value pairs; the batch is split by shard and each part
+		// is inserted with BTree::insert_batch on the thread pool
+		// Return the number of pairs successfully inserted
+		template <class ForwardIt>
+		off_t insert_batch(ForwardIt first, ForwardIt last, OperationResult* results = nullptr) {
+			auto n = off_t(std::distance(first, last));
+			if (n == 0)
+				return 0;
+			//按分片做计数排序，保持同一分片内的原有顺序
+			auto begin_of = new off_t[shard_num + 1]();
+			auto shard_id = new off_t[n];
+			auto it = first;
+			for (off_t i = 0; i < n; ++i, ++it) {
+				shard_id[i] = shard_of((*it).first);
+				++begin_of[shard_id[i] + 1];
+			}
+			for (off_t i = 0; i < shard_num; ++i)
+				begin_of[i + 1] += begin_of[i];
+			auto items = new pair<Key, Value>[n];
+			auto index = new off_t[n];
+			auto fill = new off_t[shard_num];
+			for (off_t i = 0; i < shard_num; ++i)
+				fill[i] = begin_of[i];
+			it = first;
+			for (off_t i = 0; i < n; ++i, ++it) {
+				auto p = fill[shard_id[i]]++;
+				items[p].first = (*it).first;
+				items[p].second = (*it).second;
+				index[p] = i;
+			}
+			auto part_results = new OperationResult[n];
+			auto inserted = new off_t[shard_num]();
+			pool.run(shard_num, [&](off_t i) {
+				if (begin_of[i] < begin_of[i + 1])
+					inserted[i] = shards[i]->insert_batch(items + begin_of[i], items + begin_of[i + 1], part_results + begin_of[i]);
+			});
+			off_t total = 0;
+			for (off_t i = 0; i < shard_num; ++i)
+				total += inserted[i];
+			if (results)
+				for (off_t i = 0; i < n; ++i)
+					results[index[i]] = part_results[i];
+			delete[] begin_of;
+			delete[] shard_id;
+			delete[] items;
+			delete[] index;
+			delete[] fill;
+			delete[] part_results;
+			delete[] inserted;
+			return total;
+		}
+		// Erase: Return Success if the key was present
+		OperationResult erase(const Key& key) {
+			return shards[shard_of(key)]->erase(key);
+		}
+		// Return the value refer to the Key(key)
+		Value at(const Key& key) {
+			return shards[shard_of(key)]->at(key);
+		}
+		off_t count(const Key& key) const {
+			return shards[shard_of(key)]->count(key);
+		}
+		// Keys are spread over the shards by hash, so these add up the counts of every shard
+		off_t rank(const Key& key) const {
+			off_t total = 0;
+			for (off_t i = 0; i < shard_num; ++i)
+				total += shards[i]->rank(key);
+			return total;
+		}
+		off_t count_range(const Key& lo, const Key& hi) const {
+			off_t total = 0;
+			for (off_t i = 0; i < shard_num; ++i)
+				total += shards[i]->count_range(lo, hi);
+			return total;
+		}
+		const_iterator cbegin() const {
+			const_iterator result;
+			result.allocate(this);
+			for (off_t i = 0; i < shard_num; ++i) {
+				if (shards[i]->empty())
+					continue;
+				result.cur[i] = shards[i]->cbegin();
+				if (!shards[i]->at_end(result.cur[i])) {
+					result.heap[result.heap_size] = i;
+					result.sift_up(result.heap_size++);
+				}
+			}
+			return result;
+		}
+		const_iterator cend() const {
+			const_iterator result;
+			result.allocate(this);
+			return result;
+		}
+		const_iterator begin() const {
+			return cbegin();
+		}
+		const_iterator end() const {
+			return cend();
+		}
+		bool empty() const {
+			return size() == 0;
+		}
+		// Return the number of <K,V> pairs in all shards
+		off_t size() const {
+			off_t total = 0;
+			for (off_t i = 0; i < shard_num; ++i)
+				total += shards[i]->size();
+			return total;
+		}
+		// Clear all shards
+		void clear() {
+			pool.run(shard_num, [this](off_t i) {
+				shards[i]->clear();
+			});
 		}
+	};
 
-		//读取结点信息
-		template <class DATA_TYPE>
-		static void read_block(Block_Head* info, DATA_TYPE* data, off_t pos)
-		{
-			char buff[BLOCK_SIZE] = { 0 };
-			mem_read(buff, BLOCK_SIZE, pos);
-			memcpy(info, buff, sizeof(Block_Head));
-			memcpy(data, buff + INIT_SIZE, sizeof(DATA_TYPE));
+	//VarBTree的关键字或值：一段字节串，只引用这些字节而不复制
+	class Slice {
+	public:
+		const char* data = nullptr;
+		off_t len = 0;
+		Slice() {}
+		Slice(const char* str) : data(str), len(off_t(strlen(str))) {}
+		Slice(const char* bytes, off_t size) : data(bytes), len(size) {}
+		// Compare bytewise; a proper prefix is less than the longer string
+		int compare(const Slice& rhs) const {
+			auto common = len < rhs.len ? len : rhs.len;
+			auto res = common ? memcmp(data, rhs.data, size_t(common)) : 0;
+			if (res)
+				return res;
+			return len < rhs.len ? -1 : (len > rhs.len ? 1 : 0);
 		}
-		//写入节点信息
-		template <class DATA_TYPE>
-		static void write_block(Block_Head* info, DATA_TYPE* data, off_t pos) {
-			char buff[BLOCK_SIZE] = { 0 };
-			memcpy(buff, info, sizeof(Block_Head));
-			memcpy(buff + INIT_SIZE, data, sizeof(DATA_TYPE));
-			mem_write(buff, BLOCK_SIZE, pos);
+		bool operator==(const Slice& rhs) const {
+			return compare(rhs) == 0;
 		}
+		bool operator!=(const Slice& rhs) const {
+			return compare(rhs) != 0;
+		}
+		bool operator<(const Slice& rhs) const {
+			return compare(rhs) < 0;
+		}
+	};
 
-		//创建文件
-		void check_file() {
-			if (!fp) {
-				//创建新的树
-				fp = fopen(BPTREE_ADDRESS, "wb+");
-				write_tree_data();
+	//变长字节串关键字与值的B+树，结点为槽页：槽目录从页首向后增长，记录堆从页尾向前增长，记录只占它需要的字节
+	//结点按字节数而不是个数分裂，索引结点只保存能区分两半的最短分隔串，碎片空间在页内整理
+	//与BTree共用重做日志、存储后端和块缓存，但只能单线程使用；删除后不调整不满的结点
+	template <off_t PAGE_SIZE = 4096>
+	class VarBTree {
+	private:
+		//块头
+		class Block_Head {
+		public:
+			//是否为叶子
+			bool block_type = false;
+			//槽的个数
+			off_t size = 0;
+			off_t pos = 0;
+			//叶子链表的前驱与后继（0表示没有）
+			off_t last = 0;
+			off_t next = 0;
+			//索引结点中小于所有关键字的孩子
+			off_t first_child = 0;
+			//记录堆的起始位置（堆从块尾向前增长）
+			off_t heap_begin = PAGE_SIZE;
+			//堆中仍在使用的字节数
+			off_t used = 0;
+		};
 
-				auto node_head = tree_data.block_cnt,
-					node_rear = tree_data.block_cnt + 1;
+		//槽：记录在块内的偏移以及关键字与值的长度
+		class Slot {
+		public:
+			unsigned int offset = 0;
+			unsigned int key_len = 0;
+			unsigned int value_len = 0;
+		};
 
-				tree_data.data_block_head = node_head;
-				tree_data.data_block_rear = node_rear;
+		//文件头
+		class File_Head {
+		public:
+			//存储BLOCK占用的空间
+			off_t block_cnt = 1;
+			//根结点的位置（0表示树为空）
+			off_t root_pos = 0;
+			//第一个叶子的位置
+			off_t first_leaf = 0;
+			//存储大小
+			off_t size = 0;
+			//块大小
+			off_t block_size = PAGE_SIZE;
+		};
 
-				create_leaf_node(0, 0, node_rear);
-				create_leaf_node(0, node_head, 0);
+		//块大小
+		constexpr static off_t BLOCK_SIZE = PAGE_SIZE;
+		//块头大小
+		constexpr static off_t INIT_SIZE = sizeof(Block_Head);
+		//槽的大小
+		constexpr static off_t SLOT_SIZE = sizeof(Slot);
+		//索引记录的值为孩子的位置
+		constexpr static off_t CHILD_SIZE = sizeof(off_t);
+		//默认缓存页数
+		constexpr static off_t DEFAULT_CACHE_SIZE = 1024;
+		//日志超过该大小时做检查点
+		constexpr static off_t LOG_CHECKPOINT_SIZE = 1 << 24;
+		//树的最大高度
+		constexpr static off_t MAX_HEIGHT = 64;
 
-				return;
-			}
-			char buff[BLOCK_SIZE] = { 0 };
-			mem_read(buff, BLOCK_SIZE, 0);
-			memcpy(&tree_data, buff, sizeof(tree_data));
-		}
-		
-		
-		//分裂叶子结点
-		Key split_leaf_node(off_t pos, Block_Head& origin_info, Leaf_Data& origin_data) {
-			//读入数据
-			off_t parent_pos;
-			Block_Head parent_info;
-			Normal_Data parent_data;
+	public:
+		// The largest key length plus value length of a record; it keeps at least
+		// four records (or index entries) in every node
+		constexpr static off_t MAX_RECORD = (BLOCK_SIZE - INIT_SIZE) / 4 - SLOT_SIZE - CHILD_SIZE;
 
-			//判断是否为根结点
-			if (pos == tree_data.root_pos) {
-				//创建根节点
-				auto root_pos = create_normal_node(0);
-				tree_data.root_pos = root_pos;
-				write_tree_data();
-				read_block(&parent_info, &parent_data, root_pos);
-				origin_info.parent = root_pos;
-				++parent_info.size;
-				parent_data.val[0].child = pos;
-				parent_pos = root_pos;
+	private:
+		static_assert(BLOCK_SIZE >= 256 && (BLOCK_SIZE & (BLOCK_SIZE - 1)) == 0,
+			"PAGE_SIZE must be a power of two of at least 256 bytes");
+
+		//块读写、日志与缓存
+		typedef Block_Io<BLOCK_SIZE> Io;
+		typedef typename Io::Log_Record Log_Record;
+		typedef typename Io::Redo_Log Redo_Log;
+		typedef typename Io::Storage Storage;
+		typedef typename Io::Page_Cache Page_Cache;
+		constexpr static off_t LOG_UPDATE = Io::LOG_UPDATE;
+		constexpr static off_t LOG_FORMAT = Io::LOG_FORMAT;
+		constexpr static off_t LOG_COMMIT = Io::LOG_COMMIT;
+
+		//从根到叶子经过的索引结点，pos[0]为叶子的父亲
+		class Tree_Path {
+		public:
+			off_t pos[MAX_HEIGHT];
+			off_t cnt = 0;
+		};
+
+		//分裂时把块中原有的记录与新记录合在一起，看作有序的第j个记录
+		class Split_Source {
+		public:
+			const char* page;
+			off_t index;
+			Slice key, value;
+			off_t count() const {
+				return head_of(page)->size + 1;
 			}
-			else {
-				read_block(&parent_info, &parent_data, origin_info.parent);
-				parent_pos = parent_info.pos;
+			Slice key_at(off_t j) const {
+				return j == index ? key : VarBTree::key_at(page, j < index ? j : j - 1);
 			}
-			if (split_parent(origin_info)) {
-				parent_pos = origin_info.parent;
-				read_block(&parent_info, &parent_data, parent_pos);
+			Slice value_at(off_t j) const {
+				return j == index ? value : VarBTree::value_at(page, j < index ? j : j - 1);
 			}
-			//创建一个新的子结点
-			auto new_pos = create_leaf_node(parent_pos,pos,origin_info.next);
-			
-			//修改后继结点的前驱
-			auto tmp_pos = origin_info.next;
-			Block_Head tmp_info;
-			Leaf_Data tmp_data;
-			read_block(&tmp_info, &tmp_data, tmp_pos);
-			tmp_info.last = new_pos;
-			write_block(&tmp_info, &tmp_data, tmp_pos);
-			origin_info.next = new_pos;
+			off_t bytes(off_t j) const {
+				return key_at(j).len + value_at(j).len + SLOT_SIZE;
+			}
+			//[low, high]中第一个使之前的记录占到一半字节的位置
+			off_t split_point(off_t low, off_t high) const {
+				off_t total = 0, prefix = 0;
+				for (off_t j = 0; j < count(); ++j)
+					total += bytes(j);
+				for (off_t j = 0; j < high; ++j) {
+					if (j >= low && prefix * 2 >= total)
+						return j;
+					prefix += bytes(j);
+				}
+				return high;
+			}
+		};
 
-			Block_Head new_info;
-			Leaf_Data new_data;
-			read_block(&new_info, &new_data, new_pos);
+		//私有变量
+		//文件头
+		File_Head tree_data;
 
-			//移动数据的位置
-			off_t mid_pos = origin_info.size >> 1;
-			for (off_t p = mid_pos, i = 0; p < origin_info.size; ++p, ++i) {
-				new_data.val[i].first = origin_data.val[p].first;
-				new_data.val[i].second = origin_data.val[p].second;
-				++new_info.size;
-			}
-			origin_info.size = mid_pos;
-			insert_new_index(parent_info, parent_data, pos, new_pos, origin_data.val[mid_pos].first);
+		//索引文件与重做日志的地址
+		char address[BPTREE_ADDRESS_SIZE];
+		char log_address[BPTREE_ADDRESS_SIZE + 4];
 
-			//写入
-			write_block(&origin_info, &origin_data, pos);
-			write_block(&new_info, &new_data, new_pos);
-			write_block(&parent_info, &parent_data, parent_pos);
+		//存储后端
+		Storage* storage;
 
-			return new_data.val[0].first;
+		//重做日志
+		mutable Redo_Log log;
+
+		//块缓存
+		mutable Page_Cache cache;
+
+		//持久化模式
+		DurabilityMode durability = PerOperation;
+		//组提交的操作数与时间间隔(ms)
+		off_t group_op_num = 64, group_interval = 10;
+		//上次写回后的修改次数
+		off_t pending_op_num = 0;
+		//上次写回的时间
+		std::chrono::steady_clock::time_point last_sync_time = std::chrono::steady_clock::now();
+
+		//私有函数
+		//块内各部分
+		static Block_Head* head_of(char* page) {
+			return reinterpret_cast<Block_Head*>(page);
+		}
+		static const Block_Head* head_of(const char* page) {
+			return reinterpret_cast<const Block_Head*>(page);
+		}
+		static Slot* slots_of(char* page) {
+			return reinterpret_cast<Slot*>(page + INIT_SIZE);
+		}
+		static const Slot* slots_of(const char* page) {
+			return reinterpret_cast<const Slot*>(page + INIT_SIZE);
+		}
+		static Slice key_at(const char* page, off_t index) {
+			auto& slot = slots_of(page)[index];
+			return Slice(page + slot.offset, slot.key_len);
+		}
+		static Slice value_at(const char* page, off_t index) {
+			auto& slot = slots_of(page)[index];
+			return Slice(page + slot.offset + slot.key_len, slot.value_len);
+		}
+		//索引结点中第index个关键字右侧的孩子，index为-1时为最左的孩子
+		static off_t child_at(const char* page, off_t index) {
+			if (index < 0)
+				return head_of(page)->first_child;
+			off_t child;
+			memcpy(&child, value_at(page, index).data, CHILD_SIZE);
+			return child;
 		}
 
-		//分裂父亲（返回新的父亲）
-		bool split_parent(Block_Head& child_info) {
-			//读入数据
-			off_t parent_pos, origin_pos = child_info.parent;
-			Block_Head parent_info, origin_info;
-			Normal_Data parent_data, origin_data;
-			read_block(&origin_info, &origin_data, origin_pos);
-			if (origin_info.size < BLOCK_KEY_NUM)
-				return false;
+		//二分查找：返回第一个关键字不小于key（upper为真时为大于key）的槽
+		static off_t search_slot(const char* page, const Slice& key, bool upper) {
+			off_t l = 0, r = head_of(page)->size;
+			while (l < r) {
+				auto mid = (l + r) >> 1;
+				auto res = key_at(page, mid).compare(key);
+				if (upper ? res <= 0 : res < 0)
+					l = mid + 1;
+				else
+					r = mid;
+			}
+			return l;
+		}
 
-			//判断是否为根结点
-			if (origin_pos == tree_data.root_pos) {
-				//创建根节点
-				auto root_pos = create_normal_node(0);
-				tree_data.root_pos = root_pos;
-				write_tree_data();
-				read_block(&parent_info, &parent_data, root_pos);
-				origin_info.parent = root_pos;
-				++parent_info.size;
-				parent_data.val[0].child = origin_pos;
-				parent_pos = root_pos;
+		//块内剩余的字节数（包括堆中的碎片）
+		static off_t free_space(const char* page) {
+			auto info = head_of(page);
+			return BLOCK_SIZE - INIT_SIZE - info->size * SLOT_SIZE - info->used;
+		}
+
+		//初始化空结点
+		static void init_page(char* page, bool leaf, off_t pos) {
+			memset(page, 0, BLOCK_SIZE);
+			Block_Head info;
+			info.block_type = leaf;
+			info.pos = pos;
+			memcpy(page, &info, sizeof(info));
+		}
+
+		//整理堆：把仍在使用的记录紧密排到块尾
+		static void compact(char* page) {
+			char buff[BLOCK_SIZE];
+			memcpy(buff, page, BLOCK_SIZE);
+			auto info = head_of(page);
+			auto slots = slots_of(page);
+			off_t top = BLOCK_SIZE;
+			for (off_t i = 0; i < info->size; ++i) {
+				auto len = off_t(slots[i].key_len + slots[i].value_len);
+				top -= len;
+				memcpy(page + top, buff + slots[i].offset, len);
+				slots[i].offset = (unsigned int)top;
 			}
-			else {
-				read_block(&parent_info, &parent_data, origin_info.parent);
-				parent_pos = parent_info.pos;
+			info->heap_begin = top;
+		}
+
+		//在第index个槽前插入记录，调用前需保证free_space足够
+		static void insert_record(char* page, off_t index, const Slice& key, const char* value, off_t value_len) {
+			auto info = head_of(page);
+			auto len = key.len + value_len;
+			if (info->heap_begin - INIT_SIZE - (info->size + 1) * SLOT_SIZE < len)
+				compact(page);
+			info->heap_begin -= len;
+			memcpy(page + info->heap_begin, key.data, key.len);
+			memcpy(page + info->heap_begin + key.len, value, value_len);
+			auto slots = slots_of(page);
+			memmove(slots + index + 1, slots + index, (info->size - index) * SLOT_SIZE);
+			slots[index].offset = (unsigned int)info->heap_begin;
+			slots[index].key_len = (unsigned int)key.len;
+			slots[index].value_len = (unsigned int)value_len;
+			++info->size;
+			info->used += len;
+		}
+
+		//删除第index个记录，它在堆中的空间留到整理时回收
+		static void erase_record(char* page, off_t index) {
+			auto info = head_of(page);
+			auto slots = slots_of(page);
+			info->used -= slots[index].key_len + slots[index].value_len;
+			memmove(slots + index, slots + index + 1, (info->size - index - 1) * SLOT_SIZE);
+			--info->size;
+			if (!info->size)
+				info->heap_begin = BLOCK_SIZE;
+		}
+
+		//设置文件地址
+		void set_address(const char* file_address) {
+			auto len = strlen(file_address);
+			if (len == 0 || len >= size_t(BPTREE_ADDRESS_SIZE))
+				throw runtime_error();
+			memcpy(address, file_address, len + 1);
+			memcpy(log_address, file_address, len);
+			memcpy(log_address + len, ".log", 5);
+		}
+
+		//打开已有的树，文件不存在时创建
+		void open_file() {
+			if (!storage->open(address)) {
+				check_file();
+				return;
 			}
-			if (split_parent(origin_info)) {
-				parent_pos = origin_info.parent;
-				read_block(&parent_info, &parent_data, parent_pos);
+			char buff[BLOCK_SIZE] = { 0 };
+			page_read(buff, 0);
+			memcpy(&tree_data, buff, sizeof(tree_data));
+			if (tree_data.block_size != BLOCK_SIZE) {
+				cache.reset();
+				delete storage;
+				throw runtime_error();
 			}
-			//创建一个新的子结点
-			auto new_pos = create_normal_node(parent_pos);
-			Block_Head new_info;
-			Normal_Data new_data;
-			read_block(&new_info, &new_data, new_pos);
+			log.open(log_address);
+			recover();
+		}
 
-			//移动数据的位置
-			off_t mid_pos = origin_info.size >> 1;
-			for (off_t p = mid_pos + 1, i = 0; p < origin_info.size; ++p,++i) {
-				if (origin_data.val[p].child == child_info.pos) {
-					child_info.parent = new_pos;
-				}
-				std::swap(new_data.val[i], origin_data.val[p]);
-				++new_info.size;
+		//创建文件
+		void check_file() {
+			if (!storage->is_open()) {
+				storage->create(address);
+				log.open(log_address);
+				log.truncate();
+				write_checkpoint();
 			}
-			origin_info.size = mid_pos + 1;
-			insert_new_index(parent_info, parent_data, origin_pos, new_pos, origin_data.val[mid_pos].key);
-			
-			//写入
-			write_block(&origin_info, &origin_data, origin_pos);
-			write_block(&new_info, &new_data, new_pos);
-			write_block(&parent_info, &parent_data, parent_pos);
-			return true;
 		}
 
-		//合并索引
-		void merge_normal(Block_Head& l_info, Normal_Data& l_data, Block_Head& r_info, Normal_Data& r_data) {
-			for (off_t p = l_info.size, i = 0; i < r_info.size; ++p, ++i) {
-				l_data.val[p] = r_data.val[i];
+		//通过缓存读取整块
+		void page_read(char* buff, off_t pos) const {
+			auto page = cache.pin(pos);
+			memcpy(buff, page, BLOCK_SIZE);
+			cache.unpin(pos);
+		}
+
+		//通过缓存写入整块（不记日志，只用于可以随时重建的信息）
+		void page_write(const char* buff, off_t pos) const {
+			auto page = cache.pin(pos, false);
+			memcpy(page, buff, BLOCK_SIZE);
+			cache.unpin(pos, true);
+		}
+
+		//通过缓存写入整块，并把变化的部分记入日志
+		void page_log_write(const char* buff, off_t pos) const {
+			auto page = cache.pin(pos);
+			off_t l = 0, r = BLOCK_SIZE;
+			while (l < r && buff[l] == page[l])
+				++l;
+			while (r > l && buff[r - 1] == page[r - 1])
+				--r;
+			if (l == r) {
+				cache.unpin(pos);
+				return;
 			}
-			l_data.val[l_info.size - 1].key = adjust_normal(r_info.parent, r_info.pos);
-			l_info.size += r_info.size;
-			write_block(&l_info, &l_data, l_info.pos);
+			auto lsn = log.append(LOG_UPDATE, pos, l, buff + l, r - l);
+			memcpy(page + l, buff + l, r - l);
+			cache.unpin(pos, true, lsn);
 		}
 
-	public:
-		typedef pair<const Key, Value> value_type;
+		//写入B+树基本数据
+		void write_tree_data() const {
+			char buff[BLOCK_SIZE] = { 0 };
+			memcpy(buff, &tree_data, sizeof(tree_data));
+			page_write(buff, 0);
+		}
 
-		class const_iterator;
-		class iterator {
-			friend class sjtu::BTree<Key, Value, Compare>::const_iterator;
-			friend iterator sjtu::BTree<Key, Value, Compare>::begin();
-			friend iterator sjtu::BTree<Key, Value, Compare>::end();
-			friend iterator sjtu::BTree<Key, Value, Compare>::find(const Key&);
-			friend pair<iterator, OperationResult> sjtu::BTree<Key, Value, Compare>::insert(const Key&, const Value&);
-		private:
-			// Your private members go here
-			//指向当前bpt
-			BTree* cur_bptree = nullptr;
-			//存储当前块的基本信息
-			Block_Head block_info;
-			//存储当前指向的元素位置
-			off_t cur_pos = 0;
+		//检查点：把所有修改写回数据文件后清空日志
+		void write_checkpoint() const {
+			write_tree_data();
+			cache.flush();
+			log.truncate();
+		}
 
-		public:
-			bool modify(const Value& value) {
-				Block_Head info;
-				Leaf_Data leaf_data;
-				read_block(&info, &leaf_data, block_info.pos);
-				leaf_data.val[cur_pos].second = value;
-				write_block(&info, &leaf_data, block_info.pos);
-				return true;
-			}
-			iterator() {
-				// TODO Default Constructor
-			}
-			iterator(const iterator& other) {
-				// TODO Copy Constructor
-				cur_bptree = other.cur_bptree;
-				block_info = other.block_info;
-				cur_pos = other.cur_pos;
-			}
-			// Return a new iterator which points to the n-next elements
-			iterator operator++(int) {
-				// Todo iterator++
-				auto tmp = *this;
-				++cur_pos;
-				if (cur_pos >= block_info.size) {
-					char buff[BLOCK_SIZE] = { 0 };
-					mem_read(buff, BLOCK_SIZE, block_info.next);
-					memcpy(&block_info, buff, sizeof(block_info));
-					cur_pos = 0;
+		//重放日志中已提交的修改
+		void recover() {
+			auto committed = log.scan(log.size(), [](const Log_Record&, const char*) {});
+			log.scan(committed, [this](const Log_Record& record, const char* data) {
+				if (record.type == LOG_UPDATE) {
+					auto page = cache.pin(record.pos);
+					memcpy(page + record.offset, data, record.len);
+					cache.unpin(record.pos, true);
 				}
-				return tmp;
-			}
-			iterator& operator++() {
-				// Todo ++iterator
-				++cur_pos;
-				if (cur_pos >= block_info.size) {
-					char buff[BLOCK_SIZE] = { 0 };
-					mem_read(buff, BLOCK_SIZE, block_info.next);
-					memcpy(&block_info, buff, sizeof(block_info));
-					cur_pos = 0;
+				else if (record.type == LOG_FORMAT) {
+					//页可能已在缓存中（或直接映射），不能依赖pin清零
+					auto page = cache.pin(record.pos, false);
+					memset(page, 0, BLOCK_SIZE);
+					cache.unpin(record.pos, true);
 				}
-				return *this;
-			}
-			iterator operator--(int) {
-				// Todo iterator--
-				auto temp = *this;
-				if (cur_pos == 0) {
-					char buff[BLOCK_SIZE] = { 0 };
-					mem_read(buff, BLOCK_SIZE, block_info.last);
-					memcpy(&block_info, buff, sizeof(block_info));
-					cur_pos = block_info.size - 1;
+				else if (record.type == LOG_COMMIT) {
+					memcpy(&tree_data, data, sizeof(tree_data));
 				}
-				else
-					--cur_pos;
-				return temp;
+			});
+			write_checkpoint();
+		}
+
+		//一次修改操作结束，写入提交记录，并按持久化模式决定是否落盘
+		void commit_operation() {
+			log.append(LOG_COMMIT, 0, 0, (const char*)&tree_data, sizeof(tree_data));
+			cache.commit();
+			if (log.size() >= LOG_CHECKPOINT_SIZE)
+				write_checkpoint();
+			++pending_op_num;
+			switch (durability) {
+			case PerOperation:
+				sync();
+				break;
+			case GroupCommit:
+				if (pending_op_num >= group_op_num
+					|| std::chrono::steady_clock::now() - last_sync_time >= std::chrono::milliseconds(group_interval))
+					sync();
+				break;
+			case Manual:
+				break;
 			}
-			iterator& operator--() {
-				// Todo --iterator
-				if (cur_pos == 0) {
-					char buff[BLOCK_SIZE] = { 0 };
-					mem_read(buff, BLOCK_SIZE, block_info.last);
-					memcpy(&block_info, buff, sizeof(block_info));
-					cur_pos = block_info.size - 1;
+		}
+
+		//获取新内存
+		off_t memory_allocation() {
+			++tree_data.block_cnt;
+			auto lsn = log.append(LOG_FORMAT, tree_data.block_cnt - 1, 0, nullptr, 0);
+			auto page = cache.pin(tree_data.block_cnt - 1, false);
+			memset(page, 0, BLOCK_SIZE);
+			cache.unpin(tree_data.block_cnt - 1, true, lsn);
+			return tree_data.block_cnt - 1;
+		}
+
+		//从根找到key所在的叶子，path不为空时记录经过的索引结点
+		off_t find_leaf(const Slice& key, Tree_Path* path = nullptr) const {
+			off_t cur_pos = tree_data.root_pos, depth = 0;
+			off_t trace[MAX_HEIGHT];
+			while (true) {
+				auto page = cache.pin(cur_pos);
+				if (head_of(page)->block_type) {
+					cache.unpin(cur_pos);
+					break;
 				}
-				else
-					--cur_pos;
-				
-				return *this;
-			}
-			// Overloaded of operator '==' and '!='
-			// Check whether the iterators are same
-			value_type operator*() const {
-				// Todo operator*, return the <K,V> of iterator
-				if (cur_pos >= block_info.size)
-					throw invalid_iterator();
-				char buff[BLOCK_SIZE] = { 0 };
-				mem_read(buff, BLOCK_SIZE, block_info.pos);
-				Leaf_Data leaf_data;
-				memcpy(&leaf_data, buff + INIT_SIZE, sizeof(leaf_data));
-				value_type result(leaf_data.val[cur_pos].first,leaf_data.val[cur_pos].second);
-				return result;
+				auto next_pos = child_at(page, search_slot(page, key, true) - 1);
+				cache.unpin(cur_pos);
+				if (depth == MAX_HEIGHT)
+					throw runtime_error();
+				trace[depth++] = cur_pos;
+				cur_pos = next_pos;
 			}
-			bool operator==(const iterator& rhs) const {
-				// Todo operator ==
-				return cur_bptree == rhs.cur_bptree
-					&& block_info.pos == rhs.block_info.pos
-					&& cur_pos == rhs.cur_pos;
+			if (path) {
+				path->cnt = depth;
+				for (off_t i = 0; i < depth; ++i)
+					path->pos[i] = trace[depth - 1 - i];
 			}
-			bool operator==(const const_iterator& rhs) const {
-				// Todo operator ==
-				return block_info.pos == rhs.block_info.pos
-					&& cur_pos == rhs.cur_pos;
+			return cur_pos;
+		}
+
+		//分裂叶子：原有记录与新记录按字节数平分到两个叶子，返回新的右叶子，
+		//sep中为分隔关键字：右叶子第一个关键字中大于左叶子最后一个关键字的最短前缀
+		off_t split_leaf(off_t pos, const char* origin, off_t index, const Slice& key, const Slice& value,
+			char* sep, off_t& sep_len) {
+			Split_Source source{ origin, index, key, value };
+			auto cnt = source.count();
+			auto mid = source.split_point(1, cnt - 1);
+			auto new_pos = memory_allocation();
+			char left[BLOCK_SIZE], right[BLOCK_SIZE];
+			init_page(left, true, pos);
+			init_page(right, true, new_pos);
+			for (off_t j = 0; j < mid; ++j)
+				insert_record(left, j, source.key_at(j), source.value_at(j).data, source.value_at(j).len);
+			for (off_t j = mid; j < cnt; ++j)
+				insert_record(right, j - mid, source.key_at(j), source.value_at(j).data, source.value_at(j).len);
+			auto origin_info = head_of(origin);
+			head_of(left)->last = origin_info->last;
+			head_of(left)->next = new_pos;
+			head_of(right)->last = pos;
+			head_of(right)->next = origin_info->next;
+			if (origin_info->next) {
+				char buff[BLOCK_SIZE];
+				page_read(buff, origin_info->next);
+				head_of(buff)->last = new_pos;
+				page_log_write(buff, origin_info->next);
 			}
-			bool operator!=(const iterator& rhs) const {
-				// Todo operator !=
-				return cur_bptree != rhs.cur_bptree
-					|| block_info.pos != rhs.block_info.pos
-					|| cur_pos != rhs.cur_pos;
+			auto a = source.key_at(mid - 1), b = source.key_at(mid);
+			off_t common = 0;
+			while (common < a.len && common < b.len && a.data[common] == b.data[common])
+				++common;
+			sep_len = common + 1;
+			memcpy(sep, b.data, sep_len);
+			page_log_write(left, pos);
+			page_log_write(right, new_pos);
+			return new_pos;
+		}
+
+		//分裂索引结点：中间的关键字上移到up中，返回新的右结点
+		off_t split_inner(off_t pos, const char* origin, off_t index, const Slice& key, off_t child,
+			char* up, off_t& up_len) {
+			Split_Source source{ origin, index, key, Slice((const char*)&child, CHILD_SIZE) };
+			auto cnt = source.count();
+			auto mid = source.split_point(1, cnt - 2);
+			auto new_pos = memory_allocation();
+			char left[BLOCK_SIZE], right[BLOCK_SIZE];
+			init_page(left, false, pos);
+			init_page(right, false, new_pos);
+			head_of(left)->first_child = head_of(origin)->first_child;
+			for (off_t j = 0; j < mid; ++j)
+				insert_record(left, j, source.key_at(j), source.value_at(j).data, CHILD_SIZE);
+			memcpy(&head_of(right)->first_child, source.value_at(mid).data, CHILD_SIZE);
+			for (off_t j = mid + 1; j < cnt; ++j)
+				insert_record(right, j - mid - 1, source.key_at(j), source.value_at(j).data, CHILD_SIZE);
+			up_len = source.key_at(mid).len;
+			memcpy(up, source.key_at(mid).data, up_len);
+			page_log_write(left, pos);
+			page_log_write(right, new_pos);
+			return new_pos;
+		}
+
+		//把分隔关键字key与其右侧的孩子child插入path第level层的索引结点，必要时向上分裂
+		void insert_index(const Tree_Path& path, off_t level, const Slice& key, off_t child) {
+			char buff[BLOCK_SIZE];
+			if (level == path.cnt) {
+				//根分裂，树长高一层
+				auto root_pos = memory_allocation();
+				init_page(buff, false, root_pos);
+				head_of(buff)->first_child = tree_data.root_pos;
+				insert_record(buff, 0, key, (const char*)&child, CHILD_SIZE);
+				page_log_write(buff, root_pos);
+				tree_data.root_pos = root_pos;
+				return;
 			}
-			bool operator!=(const const_iterator& rhs) const {
-				// Todo operator !=
-				return block_info.pos != rhs.block_info.pos
-					|| cur_pos != rhs.cur_pos;
+			auto pos = path.pos[level];
+			page_read(buff, pos);
+			auto index = search_slot(buff, key, true);
+			if (free_space(buff) >= key.len + CHILD_SIZE + SLOT_SIZE) {
+				insert_record(buff, index, key, (const char*)&child, CHILD_SIZE);
+				page_log_write(buff, pos);
+				return;
 			}
-		};
+			char up[MAX_RECORD];
+			off_t up_len;
+			auto new_pos = split_inner(pos, buff, index, key, child, up, up_len);
+			insert_index(path, level + 1, Slice(up, up_len), new_pos);
+		}
+
+	public:
+		//按关键字顺序访问记录的只读迭代器：当前叶子固定在缓存中，指向它期间key()与value()一直有效
+		//树的任何修改都使所有迭代器失效
 		class const_iterator {
-			// it should has similar member method as iterator.
-			//  and it should be able to construct from an iterator.
-			friend class sjtu::BTree<Key, Value, Compare>::iterator;
-			friend const_iterator sjtu::BTree<Key, Value, Compare>::cbegin() const;
-			friend const_iterator sjtu::BTree<Key, Value, Compare>::cend() const;
-			friend const_iterator sjtu::BTree<Key, Value, Compare>::find(const Key&) const;
+			friend class VarBTree;
 		private:
-			// Your private members go here
-			//存储当前块的基本信息
-			Block_Head block_info;
-			//存储当前指向的元素位置
+			//指向当前bpt
+			const VarBTree* cur_bptree = nullptr;
+			//当前叶子的位置（0表示末尾）
+			off_t block_pos = 0;
+			//当前指向的元素位置
 			off_t cur_pos = 0;
-		public:
-			const_iterator() {
-				// TODO
+			//当前叶子在缓存中固定的页
+			const char* page = nullptr;
+			//固定页时缓存的版本
+			off_t page_epoch = 0;
+
+			//固定pos处的叶子作为当前块
+			void move_to(off_t pos) {
+				release();
+				block_pos = pos;
+				if (pos) {
+					page_epoch = cur_bptree->cache.get_epoch();
+					page = cur_bptree->cache.pin(pos);
+				}
 			}
-			const_iterator(const const_iterator& other) {
-				// TODO
-				block_info = other.block_info;
-				cur_pos = other.cur_pos;
+			//跳过删除后留下的空叶子
+			void skip_empty() {
+				while (block_pos && cur_pos >= head_of(page)->size) {
+					move_to(head_of(page)->next);
+					cur_pos = 0;
+				}
 			}
-			const_iterator(const iterator& other) {
-				// TODO
-				block_info = other.block_info;
+			//释放当前固定的页（缓存被清空后不再释放）
+			void release() {
+				if (page && page_epoch == cur_bptree->cache.get_epoch())
+					cur_bptree->cache.unpin(block_pos);
+				page = nullptr;
+			}
+			//复制另一个迭代器的位置
+			void assign(const const_iterator& other) {
+				release();
+				cur_bptree = other.cur_bptree;
+				block_pos = other.block_pos;
 				cur_pos = other.cur_pos;
+				page_epoch = other.page_epoch;
+				if (other.page && page_epoch == cur_bptree->cache.get_epoch())
+					page = cur_bptree->cache.add_pin(block_pos);
 			}
-			// And other methods in iterator, please fill by yourself.
-			// Return a new iterator which points to the n-next elements
-			const_iterator operator++(int) {
-				// Todo iterator++
-				auto tmp = *this;
-				++cur_pos;
-				if (cur_pos >= block_info.size) {
-					char buff[BLOCK_SIZE] = { 0 };
-					mem_read(buff, BLOCK_SIZE, block_info.next);
-					memcpy(&block_info, buff, sizeof(block_info));
-					cur_pos = 0;
-				}
-				return tmp;
+
+		public:
+			const_iterator() {}
+			const_iterator(const const_iterator& other) {
+				assign(other);
 			}
-			const_iterator& operator++() {
-				// Todo ++iterator
-				++cur_pos;
-				if (cur_pos >= block_info.size) {
-					char buff[BLOCK_SIZE] = { 0 };
-					mem_read(buff, BLOCK_SIZE, block_info.next);
-					memcpy(&block_info, buff, sizeof(block_info));
-					cur_pos = 0;
-				}
+			const_iterator& operator=(const const_iterator& other) {
+				if (this != &other)
+					assign(other);
 				return *this;
 			}
-			const_iterator operator--(int) {
-				// Todo iterator--
+			~const_iterator() {
+				release();
+			}
+			const_iterator operator++(int) {
 				auto tmp = *this;
-				if (cur_pos == 0) {
-					char buff[BLOCK_SIZE] = { 0 };
-					mem_read(buff, BLOCK_SIZE, block_info.last);
-					memcpy(&block_info, buff, sizeof(block_info));
-					cur_pos = block_info.size - 1;
-				}
-				else
-					--cur_pos;
+				++*this;
 				return tmp;
 			}
-			const_iterator& operator--() {
-				// Todo --iterator
-				if (cur_pos == 0) {
-					char buff[BLOCK_SIZE] = { 0 };
-					mem_read(buff, BLOCK_SIZE, block_info.last);
-					memcpy(&block_info, buff, sizeof(block_info));
-					cur_pos = block_info.size - 1;
-				}
-				else
-					--cur_pos;
-
+			const_iterator& operator++() {
+				if (!block_pos)
+					throw invalid_iterator();
+				++cur_pos;
+				skip_empty();
 				return *this;
 			}
-			// Overloaded of operator '==' and '!='
-			// Check whether the iterators are same
-			value_type operator*() const {
-				// Todo operator*, return the <K,V> of iterator
-				if (cur_pos >= block_info.size)
+			// The key and the value of the current record
+			Slice key() const {
+				if (!block_pos)
 					throw invalid_iterator();
-				char buff[BLOCK_SIZE] = { 0 };
-				mem_read(buff, BLOCK_SIZE, block_info.pos);
-				Leaf_Data leaf_data;
-				memcpy(&leaf_data, buff + INIT_SIZE, sizeof(leaf_data));
-				value_type result(leaf_data.val[cur_pos].first, leaf_data.val[cur_pos].second);
-				return result;
+				return key_at(page, cur_pos);
 			}
-			bool operator==(const iterator& rhs) const {
-				// Todo operator ==
-				return block_info.pos == rhs.block_info.pos
-					&& cur_pos == rhs.cur_pos;
+			Slice value() const {
+				if (!block_pos)
+					throw invalid_iterator();
+				return value_at(page, cur_pos);
 			}
 			bool operator==(const const_iterator& rhs) const {
-				// Todo operator ==
-				return block_info.pos == rhs.block_info.pos
-					&& cur_pos == rhs.cur_pos;
-			}
-			bool operator!=(const iterator& rhs) const {
-				// Todo operator !=
-				return block_info.pos != rhs.block_info.pos
-					|| cur_pos != rhs.cur_pos;
+				return block_pos == rhs.block_pos && cur_pos == rhs.cur_pos;
 			}
 			bool operator!=(const const_iterator& rhs) const {
-				// Todo operator !=
-				return block_info.pos != rhs.block_info.pos
-					|| cur_pos != rhs.cur_pos;
+				return block_pos != rhs.block_pos || cur_pos != rhs.cur_pos;
 			}
 		};
-		// Default Constructor and Copy Constructor
-		BTree() {
-			// Todo Default
-			fp = fopen(BPTREE_ADDRESS, "rb+");
-			if (!fp) {
-				//创建新的树
-				fp = fopen(BPTREE_ADDRESS, "wb+");
-				write_tree_data();
-				
-				auto node_head = tree_data.block_cnt,
-					node_rear = tree_data.block_cnt + 1;
-
-				tree_data.data_block_head = node_head;
-				tree_data.data_block_rear = node_rear;
 
-				create_leaf_node(0, 0, node_rear);
-				create_leaf_node(0, node_head, 0);
-
-				return;
-			}
-			char buff[BLOCK_SIZE] = { 0 };
-			mem_read(buff, BLOCK_SIZE, 0);
-			memcpy(&tree_data, buff, sizeof(tree_data));
+		// Open the tree stored at file_address (created if it does not exist);
+		// its redo log is file_address with ".log" appended
+		explicit VarBTree(const char* file_address, off_t cache_page_num = DEFAULT_CACHE_SIZE, StorageType type = StdioStorage)
+			: storage(Io::create_storage(type)), cache(cache_page_num, &log, storage) {
+			set_address(file_address);
+			open_file();
 		}
-		BTree(const BTree& other) {
-			// Todo Copy
-			fp = fopen(BPTREE_ADDRESS, "rb+");
-			tree_data.block_cnt = other.tree_data.block_cnt;
-			tree_data.data_block_head = other.tree_data.data_block_head;
-			tree_data.data_block_rear = other.tree_data.data_block_rear;
-			tree_data.root_pos = other.tree_data.root_pos;
-			tree_data.size = other.tree_data.size;
+		VarBTree(const VarBTree&) = delete;
+		VarBTree& operator=(const VarBTree&) = delete;
+		~VarBTree() {
+			if (storage->is_open())
+				write_checkpoint();
+			delete storage;
 		}
-		BTree& operator=(const BTree& other) {
-			// Todo Assignment
-			fp = fopen(BPTREE_ADDRESS, "rb+");
-			tree_data.block_cnt = other.tree_data.block_cnt;
-			tree_data.data_block_head = other.tree_data.data_block_head;
-			tree_data.data_block_rear = other.tree_data.data_block_rear;
-			tree_data.root_pos = other.tree_data.root_pos;
-			tree_data.size = other.tree_data.size;
-			return *this;
+		// Set the durability mode; in GroupCommit mode the redo log is forced
+		// every op_num modifications or every interval_ms milliseconds
+		void set_durability(DurabilityMode mode, off_t op_num = 64, off_t interval_ms = 10) {
+			durability = mode;
+			group_op_num = op_num;
+			group_interval = interval_ms;
+			if (storage->is_open() && pending_op_num)
+				sync();
 		}
-		~BTree() {
-			// Todo Destructor
-			fclose(fp);
+		// Make every finished modification durable by forcing the redo log
+		void sync() {
+			pending_op_num = 0;
+			last_sync_time = std::chrono::steady_clock::now();
+			if (!storage->is_open())
+				return;
+			log.force();
 		}
-		// Insert: Insert certain Key-Value into the database
-		// Return a pair, the first of the pair is the iterator point to the new
-		// element, the second of the pair is Success if it is successfully inserted
-		pair<iterator, OperationResult> insert(const Key& key, const Value& value) {
-			// TODO insert function
+		// Write back all dirty blocks and the file head, then empty the redo log
+		void checkpoint() {
+			if (!storage->is_open())
+				return;
+			write_checkpoint();
+		}
+		// Insert a record; Fail if the key already exists. Throw runtime_error
+		// if the key and the value together are longer than MAX_RECORD
+		OperationResult insert(const Slice& key, const Slice& value) {
+			if (key.len + value.len > MAX_RECORD)
+				throw runtime_error();
 			check_file();
-			if (empty()) {
-				auto root_pos = create_leaf_node(0, tree_data.data_block_head, tree_data.data_block_rear);
-				
-				Block_Head temp_info;
-				Leaf_Data temp_data;
-				read_block(&temp_info, &temp_data, tree_data.data_block_head);
-				temp_info.next = root_pos;
-				write_block(&temp_info, &temp_data, tree_data.data_block_head);
-
-				read_block(&temp_info, &temp_data, tree_data.data_block_rear);
-				temp_info.last = root_pos;
-				write_block(&temp_info, &temp_data, tree_data.data_block_rear);
-
-				read_block(&temp_info, &temp_data, root_pos);
-				++temp_info.size;
-				temp_data.val[0].first = key;
-				temp_data.val[0].second = value;
-				write_block(&temp_info, &temp_data, root_pos);
-
+			char buff[BLOCK_SIZE];
+			if (!tree_data.root_pos) {
+				auto root_pos = memory_allocation();
+				init_page(buff, true, root_pos);
+				insert_record(buff, 0, key, value.data, value.len);
+				page_log_write(buff, root_pos);
+				tree_data.root_pos = tree_data.first_leaf = root_pos;
 				++tree_data.size;
-				tree_data.root_pos = root_pos;
-				write_tree_data();
-
-				pair<iterator, OperationResult> result(begin(), Success);
-				return result;
+				commit_operation();
+				return Success;
 			}
-
-			//查找正确的节点位置
-			char buff[BLOCK_SIZE] = { 0 };
-			off_t cur_pos = tree_data.root_pos, cur_parent = 0;
-			while (true) {
-				mem_read(buff, BLOCK_SIZE, cur_pos);
-				Block_Head temp;
-				memcpy(&temp, buff, sizeof(temp));
-				//判断父亲是否更新
-				if (cur_parent != temp.parent) {
-					temp.parent = cur_parent;
-					memcpy(buff, &temp, sizeof(temp));
-					mem_write(buff, BLOCK_SIZE, cur_pos);
-				}
-				if (temp.block_type) {
-					break;
-				}
-				Normal_Data normal_data;
-				memcpy(&normal_data, buff + INIT_SIZE, sizeof(normal_data));
-				off_t child_pos = temp.size - 1;
-				while (child_pos > 0) {
-					if (normal_data.val[child_pos - 1].key <= key) break;
-					--child_pos;
-				}
-				cur_parent = cur_pos;
-				cur_pos = normal_data.val[child_pos].child;
-				cur_pos = cur_pos;
+			Tree_Path path;
+			auto leaf_pos = find_leaf(key, &path);
+			page_read(buff, leaf_pos);
+			auto index = search_slot(buff, key, false);
+			if (index < head_of(buff)->size && key_at(buff, index) == key)
+				return Fail;
+			if (free_space(buff) >= key.len + value.len + SLOT_SIZE) {
+				insert_record(buff, index, key, value.data, value.len);
+				page_log_write(buff, leaf_pos);
 			}
-
-			Block_Head info;
-			memcpy(&info, buff, sizeof(info));
-			Leaf_Data leaf_data;
-			memcpy(&leaf_data, buff + INIT_SIZE, sizeof(leaf_data));
-			for (off_t value_pos = 0;; ++value_pos) {
-				if (value_pos < info.size && (!(leaf_data.val[value_pos].first < key || leaf_data.val[value_pos].first > key))) {
-                    return pair<iterator, OperationResult>(end(), Fail);
-				}
-				if (value_pos >= info.size || leaf_data.val[value_pos].first > key) {
-					//在此结点之前插入
-					if (info.size >= BLOCK_PAIR_NUM) {
-						auto cur_key = split_leaf_node(cur_pos, info, leaf_data);
-						if (key > cur_key) {
-							cur_pos = info.next;
-							value_pos -= info.size;
-							read_block(&info, &leaf_data, cur_pos);
-						}
-					}
-					
-					for (off_t p = info.size - 1; p >= value_pos; --p)
-					{
-						leaf_data.val[p + 1].first = leaf_data.val[p].first;
-						leaf_data.val[p + 1].second = leaf_data.val[p].second;
-						if (p == value_pos)
-							break;
-					}
-					leaf_data.val[value_pos].first = key;
-					leaf_data.val[value_pos].second = value;
-					++info.size;
-					write_block(&info, &leaf_data, cur_pos);
-					iterator ans;
-					ans.block_info = info;
-					ans.cur_bptree = this;
-					ans.cur_pos = value_pos;
-					//修改树的基本参数
-					++tree_data.size;
-					write_tree_data();
-					pair<iterator, OperationResult> re(ans, Success);
-					return re;
-				}
+			else {
+				char sep[MAX_RECORD];
+				off_t sep_len;
+				auto new_pos = split_leaf(leaf_pos, buff, index, key, value, sep, sep_len);
+				insert_index(path, 0, Slice(sep, sep_len), new_pos);
 			}
-			return pair<iterator, OperationResult>(end(), Fail);
+			++tree_data.size;
+			commit_operation();
+			return Success;
 		}
-		// Erase: Erase the Key-Value
-		// Return Success if it is successfully erased
-		// Return Fail if the key doesn't exist in the database
-		OperationResult erase(const Key& key) {
-			return Fail; 
+		// Erase the record with the key; Fail if it does not exist
+		OperationResult erase(const Slice& key) {
+			if (!tree_data.root_pos)
+				return Fail;
+			char buff[BLOCK_SIZE];
+			auto leaf_pos = find_leaf(key);
+			page_read(buff, leaf_pos);
+			auto index = search_slot(buff, key, false);
+			if (index == head_of(buff)->size || key_at(buff, index) != key)
+				return Fail;
+			erase_record(buff, index);
+			page_log_write(buff, leaf_pos);
+			--tree_data.size;
+			commit_operation();
+			return Success;
 		}
-		iterator begin() {
-			check_file();
-			iterator result;
-			char buff[BLOCK_SIZE] = { 0 };
-			mem_read(buff, BLOCK_SIZE, tree_data.data_block_head);
-			Block_Head block_head;
-			memcpy(&block_head, buff, sizeof(block_head));
-			result.block_info = block_head;
+		// Copy the value of key into buff (at most capacity bytes) and return
+		// its full length, or -1 if there is no such key
+		off_t get(const Slice& key, char* buff, off_t capacity) const {
+			if (!tree_data.root_pos)
+				return -1;
+			auto leaf_pos = find_leaf(key);
+			auto page = cache.pin(leaf_pos);
+			auto index = search_slot(page, key, false);
+			off_t len = -1;
+			if (index < head_of(page)->size && key_at(page, index) == key) {
+				auto value = value_at(page, index);
+				len = value.len;
+				memcpy(buff, value.data, len < capacity ? len : capacity);
+			}
+			cache.unpin(leaf_pos);
+			return len;
+		}
+		// Return the number of records with the key (0 or 1)
+		off_t count(const Slice& key) const {
+			return find(key) == cend() ? 0 : 1;
+		}
+		// Iterator to the record with the key, or cend() if there is none
+		const_iterator find(const Slice& key) const {
+			if (!tree_data.root_pos)
+				return cend();
+			const_iterator result;
 			result.cur_bptree = this;
-			result.cur_pos = 0;
-			++result;
-			return result;
+			result.move_to(find_leaf(key));
+			result.cur_pos = search_slot(result.page, key, false);
+			if (result.cur_pos < head_of(result.page)->size && key_at(result.page, result.cur_pos) == key)
+				return result;
+			return cend();
 		}
 		const_iterator cbegin() const {
 			const_iterator result;
-			char buff[BLOCK_SIZE] = { 0 };
-			mem_read(buff, BLOCK_SIZE, tree_data.data_block_head);
-			Block_Head block_head;
-			memcpy(&block_head, buff, sizeof(block_head));
-			result.block_info = block_head;
-			result.cur_pos = 0;
-			++result;
-			return result;
-		}
-		// Return a iterator to the end(the next element after the last)
-		iterator end() {
-			check_file();
-			iterator result;
-			char buff[BLOCK_SIZE] = { 0 };
-			mem_read(buff, BLOCK_SIZE, tree_data.data_block_rear);
-			Block_Head block_head;
-			memcpy(&block_head, buff, sizeof(block_head));
-			result.block_info = block_head;
 			result.cur_bptree = this;
-			result.cur_pos = 0;
+			if (tree_data.root_pos) {
+				result.move_to(tree_data.first_leaf);
+				result.skip_empty();
+			}
 			return result;
 		}
 		const_iterator cend() const {
 			const_iterator result;
-			char buff[BLOCK_SIZE] = { 0 };
-			mem_read(buff, BLOCK_SIZE, tree_data.data_block_rear);
-			Block_Head block_head;
-			memcpy(&block_head, buff, sizeof(block_head));
-			result.block_info = block_head;
-			result.cur_pos = 0;
+			result.cur_bptree = this;
 			return result;
 		}
-		// Check whether this BTree is empty
+		const_iterator begin() const {
+			return cbegin();
+		}
+		const_iterator end() const {
+			return cend();
+		}
 		bool empty() const {
-			if (!fp)
-				return true;
 			return tree_data.size == 0;
 		}
-		// Return the number of <K,V> pairs
+		// Return the number of records
 		off_t size() const {
-			if (!fp)
-				return 0;
 			return tree_data.size;
 		}
-		// Clear the BTree
+		// Return the number of levels (0 for an empty tree)
+		off_t height() const {
+			off_t depth = 0;
+			for (auto pos = tree_data.root_pos; pos; ++depth) {
+				auto page = cache.pin(pos);
+				auto next_pos = head_of(page)->block_type ? 0 : head_of(page)->first_child;
+				cache.unpin(pos);
+				pos = next_pos;
+			}
+			return depth;
+		}
+		// Clear the tree and remove its files
 		void clear() {
-			if (!fp)
+			if (!storage->is_open())
 				return;
-			remove(BPTREE_ADDRESS);
+			cache.reset();
+			storage->close();
+			log.close();
+			remove(address);
+			remove(log_address);
 			File_Head new_file_head;
 			tree_data = new_file_head;
-			fp = nullptr;
-		}
-		// Return the value refer to the Key(key)
-		Value at(const Key& key) {
-			if (empty()) {
-				throw container_is_empty();
-			}
-			//查找正确的节点位置
-			char buff[BLOCK_SIZE] = { 0 };
-			off_t cur_pos = tree_data.root_pos, cur_parent = 0;
-			while (true) {
-				mem_read(buff, BLOCK_SIZE, cur_pos);
-				Block_Head temp;
-				memcpy(&temp, buff, sizeof(temp));
-				//判断父亲是否更新
-				if (cur_parent != temp.parent) {
-					temp.parent = cur_parent;
-					memcpy(buff, &temp, sizeof(temp));
-					mem_write(buff, BLOCK_SIZE, cur_pos);
-				}
-				if (temp.block_type) break;
-				
-				Normal_Data normal_data;
-				memcpy(&normal_data, buff + INIT_SIZE, sizeof(normal_data));
-				off_t child_pos = temp.size - 1;
-				for (; child_pos > 0; --child_pos) {
-					if (normal_data.val[child_pos - 1].key <= key) {
-						break;
-					}
-				}
-				cur_pos = normal_data.val[child_pos].child;
-			}
-			Block_Head info;
-			memcpy(&info, buff, sizeof(info));
-			Leaf_Data leaf_data;
-			memcpy(&leaf_data, buff + INIT_SIZE, sizeof(leaf_data));
-			for (off_t value_pos = 0;; ++value_pos) {
-				if (value_pos < info.size && (!(leaf_data.val[value_pos].first<key || leaf_data.val[value_pos].first>key))) {
-					return leaf_data.val[value_pos].second;
-				}
-				if (value_pos >= info.size || leaf_data.val[value_pos].first > key) {
-					throw index_out_of_bound();
-				}
-			}
-		}
-		
-		/**
-		 * Returns the number of elements with key
-		 *   that compares equivalent to the specified argument,
-		 * The default method of check the equivalence is !(a < b || b > a)
-		 */
-		off_t count(const Key& key) const {
-			return find(key) == cend() ? 0 : 1;
-		}
-		
-		/**
-		 * Finds an element with key equivalent to key.
-		 * key value of the element to search for.
-		 * Iterator to an element with key equivalent to key.
-		 *   If no such element is found, past-the-end (see end()) iterator is
-		 * returned.
-		 */
-		iterator find(const Key& key) {
-			if (empty()) {
-				return end();
-			}
-			//查找正确的节点位置
-			char buff[BLOCK_SIZE] = { 0 };
-			off_t cur_pos = tree_data.root_pos, cur_parent = 0;
-			while (true) {
-				mem_read(buff, BLOCK_SIZE, cur_pos);
-				Block_Head temp;
-				memcpy(&temp, buff, sizeof(temp));
-				//判断父亲是否更新
-				if (cur_parent != temp.parent) {
-					temp.parent = cur_parent;
-					memcpy(buff, &temp, sizeof(temp));
-					mem_write(buff, BLOCK_SIZE, cur_pos);
-				}
-				if (temp.block_type) {
-					break;
-				}
-				Normal_Data normal_data;
-				memcpy(&normal_data, buff + INIT_SIZE, sizeof(normal_data));
-				off_t child_pos = temp.size - 1;
-				for (; child_pos > 0; --child_pos) {
-					if (!(normal_data.val[child_pos - 1].key > key)) {
-						break;
-					}
-				}
-				cur_pos = normal_data.val[child_pos].child;
-			}
-			Block_Head info;
-			memcpy(&info, buff, sizeof(info));
-			sizeof(Normal_Data);
-			Leaf_Data leaf_data;
-			memcpy(&leaf_data, buff + INIT_SIZE, sizeof(leaf_data));
-			for (off_t value_pos = 0;; ++value_pos) {
-				if (value_pos < info.size && (!(leaf_data.val[value_pos].first<key || leaf_data.val[value_pos].first>key))) {
-					iterator result;
-					result.cur_bptree = this;
-					result.block_info = info;
-					result.cur_pos = value_pos;
-					return result;
-				}
-				if (value_pos >= info.size || leaf_data.val[value_pos].first > key) {
-					return end();
-				}
-			}
-			return end();
-		}
-		const_iterator find(const Key& key) const {
-			if (empty()) {
-				return cend();
-			}
-			//查找正确的节点位置
-			char buff[BLOCK_SIZE] = { 0 };
-			off_t cur_pos = tree_data.root_pos, cur_parent = 0;
-			while (true) {
-				mem_read(buff, BLOCK_SIZE, cur_pos);
-				Block_Head temp;
-				memcpy(&temp, buff, sizeof(temp));
-				//判断父亲是否更新
-				if (cur_parent != temp.parent) {
-					temp.parent = cur_parent;
-					memcpy(buff, &temp, sizeof(temp));
-					mem_write(buff, BLOCK_SIZE, cur_pos);
-				}
-				if (temp.block_type) {
-					break;
-				}
-				Normal_Data normal_data;
-				memcpy(&normal_data, buff + INIT_SIZE, sizeof(normal_data));
-				off_t child_pos = temp.size - 1;
-				for (; child_pos > 0; --child_pos) {
-					if (!(normal_data.val[child_pos - 1].key > key)) {
-						break;
-					}
-				}
-				cur_pos = normal_data.val[child_pos].child;
-			}
-			Block_Head info;
-			memcpy(&info, buff, sizeof(info));
-			Leaf_Data leaf_data;
-			memcpy(&leaf_data, buff + INIT_SIZE, sizeof(leaf_data));
-			for (off_t value_pos = 0;; ++value_pos) {
-				if (value_pos < info.size && (!(leaf_data.val[value_pos].first<key || leaf_data.val[value_pos].first>key))) {
-					const_iterator result;
-					result.block_info = info;
-					result.cur_pos = value_pos;
-					return result;
-				}
-				if (value_pos >= info.size || leaf_data.val[value_pos].first > key) {
-					return cend();
-				}
-			}
-			return cend();
 		}
 	};
-	template <typename Key, typename Value, typename Compare> FILE* BTree<Key, Value, Compare>::fp = nullptr;
 }  // namespace sjtu
@@ -0,0 +1,552 @@
+// YCSB-style benchmark for sjtu::BTree
+// Build: g++ -O2 -std=c++17 -pthread benchmark.cpp -o benchmark
+//
+// Usage: benchmark [options]
+//   --records N        records loaded before the read and mixed workloads (default 100000)
+//   --ops N            operations per workload (default 100000)
+//   --key-size K       key size in bytes: 8, 32 or 128 (default 8)
+//   --value-size V     value size in bytes: 8, 128 or 1024 (default 8)
+//   --cache N          cache pages (default 1024)
+//   --storage S        stdio, mmap or pread (default stdio)
+//   --durability D     per-op, group or manual (default group)
+//   --scan-length L    records read by each bounded scan (default 100)
+//   --zipf T           Zipfian constant (default 0.99)
+//   --load ORDER       seq or rand: order of the initial load (default rand)
+//   --workload LIST    comma-separated workloads to run after the load (default all)
+//   --file PATH        tree file (default bench.sjtu, removed afterwards); point it at
+//                      tmpfs or an NVMe file system to compare devices
+//   --async-threads N  threads serving the async workloads (default 16)
+//   --queue-depth Q    requests the async workloads keep in flight (default 64)
+//   --page-matrix      instead of the workloads, load the same records with page sizes
+//                      from 512 to 65536 bytes (8-byte keys and values, the same cache
+//                      memory) and report tree height and find latency for each
+//
+// Workloads:
+//   find-uniform, find-zipf   find() of loaded keys, uniform or Zipfian popularity
+//   at-uniform, at-zipf       at() of loaded keys
+//   scan-full                 iterate the whole tree; one op is one record
+//   scan-bounded              scan() --scan-length records from a Zipfian start
+//   ycsb-a                    50% read, 50% update (Zipfian)
+//   ycsb-b                    95% read, 5% update (Zipfian)
+//   ycsb-c                    100% read (Zipfian)
+//   ycsb-d                    95% read of recently inserted keys, 5% insert
+//   ycsb-e                    95% bounded scan, 5% insert
+//   ycsb-f                    50% read, 50% read-modify-write (Zipfian)
+//   find-async                find_async() of uniform loaded keys, --queue-depth in flight
+//   insert-async              insert_async() of new keys, --queue-depth in flight
+//                             (latency of an async op is from submission to its result)
+// The load itself is reported as seq-insert or rand-insert.
+//
+// Each line reports throughput, p50/p99/p999 latency in microseconds and the blocks
+// read from and written back to the storage backend per operation.
+#include "BTree.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <future>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace {
+	//定长关键字：前8字节为大端序的编号，其余为填充，按字节比较
+	template <int N>
+	class Fixed_Key {
+	public:
+		unsigned char data[N];
+		bool operator<(const Fixed_Key& rhs) const {
+			return memcmp(data, rhs.data, N) < 0;
+		}
+	};
+
+	//定长值
+	template <int N>
+	class Fixed_Value {
+	public:
+		long long id;
+		char padding[N - sizeof(long long)];
+	};
+
+	void make_key(long long id, long long& key) {
+		key = id;
+	}
+	template <int N>
+	void make_key(long long id, Fixed_Key<N>& key) {
+		for (int i = 0; i < 8; ++i)
+			key.data[i] = (unsigned char)(id >> (56 - 8 * i));
+		memset(key.data + 8, 'k', N - 8);
+	}
+	void make_value(long long id, long long& value) {
+		value = id;
+	}
+	template <int N>
+	void make_value(long long id, Fixed_Value<N>& value) {
+		value.id = id;
+		memset(value.padding, 'v', sizeof(value.padding));
+	}
+	long long value_id(long long value) {
+		return value;
+	}
+	template <int N>
+	long long value_id(const Fixed_Value<N>& value) {
+		return value.id;
+	}
+
+	//运行参数
+	class Options {
+	public:
+		long long records = 100000;
+		long long ops = 100000;
+		int key_size = 8;
+		int value_size = 8;
+		long long cache = 1024;
+		sjtu::StorageType storage = sjtu::StdioStorage;
+		sjtu::DurabilityMode durability = sjtu::GroupCommit;
+		long long scan_length = 100;
+		double zipf = 0.99;
+		bool seq_load = false;
+		std::string workloads = "find-uniform,find-zipf,at-uniform,at-zipf,scan-full,scan-bounded,"
+			"ycsb-a,ycsb-b,ycsb-c,ycsb-d,ycsb-e,ycsb-f,find-async,insert-async";
+		std::string file = "bench.sjtu";
+		bool page_matrix = false;
+		long long async_threads = 16;
+		long long queue_depth = 64;
+	};
+
+	//Zipf分布（Gray等人的方法，与YCSB相同），返回[0, n)中的名次，0最热
+	class Zipfian {
+	private:
+		long long n;
+		double theta, alpha, zetan, eta;
+
+		static double zeta(long long n, double theta) {
+			double sum = 0;
+			for (long long i = 1; i <= n; ++i)
+				sum += 1.0 / std::pow(double(i), theta);
+			return sum;
+		}
+
+	public:
+		Zipfian(long long item_num, double constant) : n(item_num), theta(constant) {
+			zetan = zeta(n, theta);
+			alpha = 1.0 / (1.0 - theta);
+			eta = (1.0 - std::pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta(2, theta) / zetan);
+		}
+		template <class Rng>
+		long long next(Rng& rng) {
+			auto u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+			auto uz = u * zetan;
+			if (uz < 1.0)
+				return 0;
+			if (uz < 1.0 + std::pow(0.5, theta))
+				return 1;
+			auto rank = (long long)(double(n) * std::pow(eta * u - eta + 1.0, alpha));
+			return rank < n ? rank : n - 1;
+		}
+	};
+
+	//把名次打散到整个关键字空间，使热点不集中在相邻的关键字上
+	long long scramble(long long rank, long long n) {
+		unsigned long long hash = 0xcbf29ce484222325ull;
+		for (int i = 0; i < 8; ++i) {
+			hash ^= (unsigned long long)(rank >> (8 * i)) & 0xff;
+			hash *= 0x100000001b3ull;
+		}
+		return (long long)(hash % (unsigned long long)n);
+	}
+
+	//一组操作的耗时与块读写统计
+	class Recorder {
+	private:
+		std::vector<long long> latency;
+		std::chrono::steady_clock::time_point begin_time, op_time;
+		off_t begin_reads = 0, begin_writes = 0;
+
+	public:
+		template <class Tree>
+		void start(const Tree& tree, long long ops) {
+			latency.clear();
+			latency.reserve(size_t(ops));
+			tree.io_count(begin_reads, begin_writes);
+			begin_time = std::chrono::steady_clock::now();
+		}
+		void op_begin() {
+			op_time = std::chrono::steady_clock::now();
+		}
+		void op_end() {
+			op_end(op_time);
+		}
+		void op_end(std::chrono::steady_clock::time_point since) {
+			latency.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - since).count());
+		}
+		template <class Tree>
+		void report(const char* name, const Tree& tree) {
+			auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_time).count();
+			off_t reads, writes;
+			tree.io_count(reads, writes);
+			auto ops = double(latency.size() ? latency.size() : 1);
+			std::sort(latency.begin(), latency.end());
+			auto percentile = [this](double p) {
+				if (latency.empty())
+					return 0.0;
+				auto idx = size_t(p * double(latency.size()));
+				return double(latency[idx < latency.size() ? idx : latency.size() - 1]) / 1000.0;
+			};
+			printf("%-14s %10zu %12.0f %9.2f %9.2f %9.2f %9.3f %9.3f\n", name, latency.size(),
+				double(latency.size()) / seconds, percentile(0.5), percentile(0.99), percentile(0.999),
+				double(reads - begin_reads) / ops, double(writes - begin_writes) / ops);
+			fflush(stdout);
+		}
+	};
+
+	void print_header() {
+		printf("%-14s %10s %12s %9s %9s %9s %9s %9s\n", "workload", "ops", "ops/s",
+			"p50(us)", "p99(us)", "p999(us)", "reads/op", "writes/op");
+	}
+
+	//对一种关键字、值与页大小运行基准
+	template <class Key, class Value, off_t PAGE_SIZE = 4096>
+	class Bench {
+	private:
+		typedef sjtu::BTree<Key, Value, std::less<Key>, PAGE_SIZE> Tree;
+
+		const Options& opt;
+		Tree tree;
+		std::mt19937_64 rng{ 20240601 };
+		Zipfian zipf;
+		//已插入的关键字编号为[0, key_cnt)
+		long long key_cnt = 0;
+		Recorder recorder;
+		Key key, scan_end;
+		Value value;
+
+		long long uniform_id() {
+			return std::uniform_int_distribution<long long>(0, key_cnt - 1)(rng);
+		}
+		long long zipf_id() {
+			return scramble(zipf.next(rng), key_cnt);
+		}
+		//最近插入的关键字更热
+		long long latest_id() {
+			auto id = key_cnt - 1 - zipf.next(rng);
+			return id < 0 ? 0 : id;
+		}
+
+		void do_find(long long id) {
+			make_key(id, key);
+			auto it = tree.find(key);
+			if (it == tree.cend() || value_id(it->second) != id)
+				fail("find");
+		}
+		void do_at(long long id) {
+			make_key(id, key);
+			if (value_id(tree.at(key)) != id)
+				fail("at");
+		}
+		void do_update(long long id) {
+			make_key(id, key);
+			make_value(id, value);
+			auto it = tree.find(key);
+			if (it == tree.end() || !it.modify(value))
+				fail("update");
+		}
+		void do_read_modify_write(long long id) {
+			make_key(id, key);
+			auto it = tree.find(key);
+			if (it == tree.end())
+				fail("read-modify-write");
+			value = it->second;
+			if (!it.modify(value))
+				fail("read-modify-write");
+		}
+		void do_insert() {
+			make_key(key_cnt, key);
+			make_value(key_cnt, value);
+			if (tree.insert(key, value).second != sjtu::Success)
+				fail("insert");
+			++key_cnt;
+		}
+		long long do_scan(long long id, long long length) {
+			make_key(id, key);
+			make_key(id + length, scan_end);
+			long long cnt = 0;
+			tree.scan(key, scan_end, [&](const Key&, const Value&) {
+				return ++cnt < length;
+			});
+			return cnt;
+		}
+		//保持queue_depth个异步请求在途：submit(id)提交，check(id, result)检查结果
+		template <class Result, class Next, class Submit, class Check>
+		void pipeline(Next next_id, Submit submit, Check check) {
+			auto depth = size_t(opt.queue_depth > 0 ? opt.queue_depth : 1);
+			std::vector<std::future<Result> > window(depth);
+			std::vector<std::chrono::steady_clock::time_point> sent(depth);
+			std::vector<long long> ids(depth);
+			tree.set_async(opt.async_threads);
+			for (long long i = 0; i < opt.ops + (long long)depth; ++i) {
+				auto slot = size_t(i) % depth;
+				if (i >= (long long)depth) {
+					check(ids[slot], window[slot].get());
+					recorder.op_end(sent[slot]);
+				}
+				if (i < opt.ops) {
+					ids[slot] = next_id();
+					sent[slot] = std::chrono::steady_clock::now();
+					window[slot] = submit(ids[slot]);
+				}
+			}
+			tree.set_async(0);
+		}
+		void run_async(bool insert) {
+			if (insert)
+				pipeline<sjtu::OperationResult>([this] { return key_cnt++; }, [this](long long id) {
+					make_key(id, key);
+					make_value(id, value);
+					return tree.insert_async(key, value);
+				}, [](long long, sjtu::OperationResult result) {
+					if (result != sjtu::Success)
+						fail("insert_async");
+				});
+			else
+				pipeline<sjtu::pair<Value, sjtu::OperationResult> >([this] { return uniform_id(); }, [this](long long id) {
+					make_key(id, key);
+					return tree.find_async(key);
+				}, [](long long id, const sjtu::pair<Value, sjtu::OperationResult>& result) {
+					if (result.second != sjtu::Success || value_id(result.first) != id)
+						fail("find_async");
+				});
+		}
+		static void fail(const char* what) {
+			fprintf(stderr, "benchmark: %s returned a wrong result\n", what);
+			exit(1);
+		}
+
+	public:
+		Bench(const Options& options, long long cache_pages)
+			: opt(options), tree(options.file.c_str(), cache_pages, options.storage),
+			zipf(options.records > 2 ? options.records : 2, options.zipf) {
+			tree.set_durability(opt.durability);
+		}
+		~Bench() {
+			tree.clear();
+		}
+		Tree& get_tree() {
+			return tree;
+		}
+
+		//载入records个记录
+		void load(bool report = true) {
+			std::vector<long long> order(size_t(opt.records));
+			for (long long i = 0; i < opt.records; ++i)
+				order[size_t(i)] = i;
+			if (!opt.seq_load)
+				std::shuffle(order.begin(), order.end(), rng);
+			recorder.start(tree, opt.records);
+			for (auto id : order) {
+				make_key(id, key);
+				make_value(id, value);
+				recorder.op_begin();
+				if (tree.insert(key, value).second != sjtu::Success)
+					fail("insert");
+				recorder.op_end();
+			}
+			key_cnt = opt.records;
+			if (report)
+				recorder.report(opt.seq_load ? "seq-insert" : "rand-insert", tree);
+		}
+
+		//运行一种负载，名字无法识别时返回false
+		bool run(const std::string& name) {
+			std::uniform_int_distribution<int> percent(0, 99);
+			recorder.start(tree, opt.ops);
+			if (name == "find-async" || name == "insert-async")
+				run_async(name == "insert-async");
+			else if (name == "scan-full") {
+				auto it = tree.cbegin();
+				recorder.op_begin();
+				for (; it != tree.cend(); ++it) {
+					recorder.op_end();
+					recorder.op_begin();
+				}
+			}
+			else {
+				for (long long i = 0; i < opt.ops; ++i) {
+					auto dice = percent(rng);
+					recorder.op_begin();
+					if (name == "find-uniform")
+						do_find(uniform_id());
+					else if (name == "find-zipf" || name == "ycsb-c")
+						do_find(zipf_id());
+					else if (name == "at-uniform")
+						do_at(uniform_id());
+					else if (name == "at-zipf")
+						do_at(zipf_id());
+					else if (name == "scan-bounded")
+						do_scan(zipf_id(), opt.scan_length);
+					else if (name == "ycsb-a" || name == "ycsb-b") {
+						if (dice < (name == "ycsb-a" ? 50 : 95))
+							do_find(zipf_id());
+						else
+							do_update(zipf_id());
+					}
+					else if (name == "ycsb-d") {
+						if (dice < 95)
+							do_find(latest_id());
+						else
+							do_insert();
+					}
+					else if (name == "ycsb-e") {
+						if (dice < 95)
+							do_scan(zipf_id(), 1 + std::uniform_int_distribution<long long>(0, opt.scan_length - 1)(rng));
+						else
+							do_insert();
+					}
+					else if (name == "ycsb-f") {
+						if (dice < 50)
+							do_find(zipf_id());
+						else
+							do_read_modify_write(zipf_id());
+					}
+					else
+						return false;
+					recorder.op_end();
+				}
+			}
+			recorder.report(name.c_str(), tree);
+			return true;
+		}
+	};
+
+	template <class Key, class Value>
+	int run_workloads(const Options& opt) {
+		Bench<Key, Value> bench(opt, opt.cache);
+		print_header();
+		bench.load();
+		size_t begin = 0;
+		while (begin < opt.workloads.size()) {
+			auto end = opt.workloads.find(',', begin);
+			if (end == std::string::npos)
+				end = opt.workloads.size();
+			auto name = opt.workloads.substr(begin, end - begin);
+			if (!name.empty() && !bench.run(name)) {
+				fprintf(stderr, "benchmark: unknown workload %s\n", name.c_str());
+				return 1;
+			}
+			begin = end + 1;
+		}
+		return 0;
+	}
+
+	template <class Value>
+	int run_with_value(const Options& opt) {
+		switch (opt.key_size) {
+		case 8:
+			return run_workloads<long long, Value>(opt);
+		case 32:
+			return run_workloads<Fixed_Key<32>, Value>(opt);
+		case 128:
+			return run_workloads<Fixed_Key<128>, Value>(opt);
+		}
+		fprintf(stderr, "benchmark: --key-size must be 8, 32 or 128\n");
+		return 1;
+	}
+
+	//在同样的缓存内存下比较不同页大小
+	template <off_t PAGE_SIZE>
+	void page_matrix_row(const Options& opt) {
+		auto cache_pages = opt.cache * 4096 / PAGE_SIZE;
+		if (cache_pages < sjtu::Block_Io<PAGE_SIZE>::MIN_CACHE_SIZE)
+			cache_pages = sjtu::Block_Io<PAGE_SIZE>::MIN_CACHE_SIZE;
+		Bench<long long, long long, PAGE_SIZE> bench(opt, cache_pages);
+		bench.load(false);
+		printf("page %-6ld height %ld, cache %ld pages\n", long(PAGE_SIZE),
+			long(bench.get_tree().height()), long(cache_pages));
+		bench.run("find-uniform");
+		bench.run("find-zipf");
+		bench.run("scan-bounded");
+	}
+
+	int run_page_matrix(const Options& opt) {
+		print_header();
+		page_matrix_row<512>(opt);
+		page_matrix_row<1024>(opt);
+		page_matrix_row<4096>(opt);
+		page_matrix_row<16384>(opt);
+		page_matrix_row<65536>(opt);
+		return 0;
+	}
+
+	void usage() {
+		fprintf(stderr, "usage: benchmark [--records N] [--ops N] [--key-size 8|32|128] [--value-size 8|128|1024]\n"
+			"                 [--cache N] [--storage stdio|mmap|pread] [--durability per-op|group|manual]\n"
+			"                 [--scan-length L] [--zipf T] [--load seq|rand] [--workload LIST]\n"
+			"                 [--file PATH] [--page-matrix] [--async-threads N] [--queue-depth Q]\n");
+		exit(1);
+	}
+}
+
+int main(int argc, char** argv) {
+	Options opt;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--page-matrix") {
+			opt.page_matrix = true;
+			continue;
+		}
+		if (i + 1 == argc)
+			usage();
+		std::string val = argv[++i];
+		if (arg == "--records")
+			opt.records = atoll(val.c_str());
+		else if (arg == "--ops")
+			opt.ops = atoll(val.c_str());
+		else if (arg == "--key-size")
+			opt.key_size = atoi(val.c_str());
+		else if (arg == "--value-size")
+			opt.value_size = atoi(val.c_str());
+		else if (arg == "--cache")
+			opt.cache = atoll(val.c_str());
+		else if (arg == "--storage" && (val == "stdio" || val == "mmap" || val == "pread"))
+			opt.storage = val == "mmap" ? sjtu::MmapStorage : val == "pread" ? sjtu::PreadStorage : sjtu::StdioStorage;
+		else if (arg == "--durability" && val == "per-op")
+			opt.durability = sjtu::PerOperation;
+		else if (arg == "--durability" && val == "group")
+			opt.durability = sjtu::GroupCommit;
+		else if (arg == "--durability" && val == "manual")
+			opt.durability = sjtu::Manual;
+		else if (arg == "--scan-length")
+			opt.scan_length = atoll(val.c_str());
+		else if (arg == "--zipf")
+			opt.zipf = atof(val.c_str());
+		else if (arg == "--load" && (val == "seq" || val == "rand"))
+			opt.seq_load = val == "seq";
+		else if (arg == "--workload")
+			opt.workloads = val;
+		else if (arg == "--async-threads")
+			opt.async_threads = atoll(val.c_str());
+		else if (arg == "--queue-depth")
+			opt.queue_depth = atoll(val.c_str());
+		else if (arg == "--file")
+			opt.file = val;
+		else
+			usage();
+	}
+	if (opt.records < 1 || opt.ops < 0 || opt.scan_length < 1 || opt.zipf <= 0 || opt.zipf >= 1)
+		usage();
+	if (opt.page_matrix)
+		return run_page_matrix(opt);
+	switch (opt.value_size) {
+	case 8:
+		return run_with_value<long long>(opt);
+	case 128:
+		return run_with_value<Fixed_Value<128> >(opt);
+	case 1024:
+		return run_with_value<Fixed_Value<1024> >(opt);
+	}
+	fprintf(stderr, "benchmark: --value-size must be 8, 128 or 1024\n");
+	return 1;
+}
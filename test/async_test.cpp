@@ -0,0 +1,110 @@
+// Async request test for sjtu::BTree::set_async
+// Build: g++ -O2 -std=c++17 -pthread -I.. async_test.cpp -o async_test
+//
+// With PreadStorage and a small cache, thousands of insert_async and find_async
+// requests are kept in flight on several threads and their futures are checked against
+// a std::map, on a new file and again on a cold reopened one. set_async(0) must finish
+// the requests already submitted before it returns, after which requests run on the
+// calling thread
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <future>
+#include <vector>
+#include <chrono>
+
+typedef sjtu::BTree<long long, long long> Tree;
+typedef std::map<long long, long long> Ref;
+
+// Whether the request has finished
+template <class Result>
+bool ready(std::future<Result>& result) {
+	return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+// Look up keys drawn from [0, 2 * range), where the keys of the tree come from
+static void check_finds(Tree& tree, const Ref& ref, std::mt19937_64& rng, long long range) {
+	std::vector<long long> keys;
+	std::vector<std::future<sjtu::pair<long long, sjtu::OperationResult> > > results;
+	for (int i = 0; i < 20000; ++i) {
+		keys.push_back((long long)(rng() % (2 * range)));
+		results.push_back(tree.find_async(keys.back()));
+	}
+	for (size_t i = 0; i < keys.size(); ++i) {
+		auto result = results[i].get();
+		auto found = ref.find(keys[i]);
+		if (found == ref.end())
+			CHECK(result.second == sjtu::Fail);
+		else
+			CHECK(result.second == sjtu::Success && result.first == found->second);
+	}
+}
+
+int main() {
+	const char* file = "async_test.sjtu";
+	const long long range = 100000;
+	const off_t cache_page_num = 256;
+	Ref ref;
+	std::mt19937_64 rng(20);
+	{
+		Fresh_Tree<Tree> tree(file, cache_page_num, sjtu::PreadStorage);
+		tree.set_async(8);
+		// every key once, all requests in flight before the first result is read
+		std::vector<long long> keys;
+		std::vector<std::future<sjtu::OperationResult> > results;
+		for (int i = 0; i < 30000; ++i) {
+			auto key = (long long)(rng() % range) * 2;
+			if (!ref.emplace(key, key + 1).second)
+				continue;
+			keys.push_back(key);
+			results.push_back(tree.insert_async(key, key + 1));
+		}
+		for (auto& result : results)
+			CHECK(result.get() == sjtu::Success);
+		check_equal(tree, ref);
+		// duplicates fail, whichever thread runs them
+		results.clear();
+		for (size_t i = 0; i < keys.size(); i += 3)
+			results.push_back(tree.insert_async(keys[i], 0));
+		for (auto& result : results)
+			CHECK(result.get() == sjtu::Fail);
+		check_finds(tree, ref, rng, range);
+		// stopping the threads finishes what was submitted
+		results.clear();
+		keys.clear();
+		for (int i = 0; i < 5000; ++i) {
+			auto key = (long long)(rng() % range) * 2 + 1;
+			if (!ref.emplace(key, key + 1).second)
+				continue;
+			keys.push_back(key);
+			results.push_back(tree.insert_async(key, key + 1));
+		}
+		tree.set_async(0);
+		for (auto& result : results)
+			CHECK(ready(result) && result.get() == sjtu::Success);
+		check_equal(tree, ref);
+		// without threads a request is done before it returns
+		auto result = tree.insert_async(-1, 0);
+		CHECK(ready(result) && result.get() == sjtu::Success);
+		ref[-1] = 0;
+		auto found = tree.find_async(-1);
+		CHECK(ready(found) && found.get().second == sjtu::Success);
+	}
+	{
+		// the leaf reads of a cold file overlap
+		Tree tree(file, cache_page_num, sjtu::PreadStorage);
+		tree.set_async(16);
+		check_finds(tree, ref, rng, range);
+		std::vector<std::future<sjtu::OperationResult> > results;
+		for (auto& element : ref)
+			if (element.first % 7 == 0)
+				results.push_back(tree.insert_async(element.first, 0));
+		for (auto& result : results)
+			CHECK(result.get() == sjtu::Fail);
+		tree.set_async(0);
+		check_equal(tree, ref);
+		tree.clear();
+	}
+	std::cout << "async_test passed" << std::endl;
+	return 0;
+}
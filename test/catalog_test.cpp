@@ -0,0 +1,121 @@
+// Catalog test for sjtu::BTree_Catalog
+// Build: g++ -O2 -std=c++17 -pthread -I.. catalog_test.cpp -o catalog_test
+//
+// Trees are created in a catalog and written from two threads at once, then the
+// catalog is reopened: the names must persist, in creation order, and every tree must
+// hold its records. Dropping a tree (opened or not) removes it and its files, a second
+// drop fails, and names that could leave the directory are rejected
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+typedef sjtu::BTree_Catalog<long long, long long> Catalog;
+typedef std::map<long long, long long> Ref;
+
+static const char* const directory = "catalog_test.dir";
+static const char* const names[] = { "orders", "users", "tmp.v2", "x-1" };
+
+static std::string tree_file(const char* name) {
+	return std::string(directory) + "/" + name + ".tree";
+}
+static bool exists(const std::string& file) {
+	return access(file.c_str(), F_OK) == 0;
+}
+// Remove the catalog directory left by an earlier run
+static void remove_catalog() {
+	for (auto name : names)
+		remove_tree(tree_file(name).c_str());
+	remove((std::string(directory) + "/" + sjtu::BPTREE_CATALOG_NAME).c_str());
+	rmdir(directory);
+}
+
+static void fill(Catalog& catalog, const char* name, Ref& ref, unsigned seed) {
+	auto& tree = catalog.open(name);
+	tree.set_durability(sjtu::Manual);
+	std::mt19937_64 rng(seed);
+	for (int i = 0; i < 30000; ++i) {
+		auto key = (long long)(rng() % 50000);
+		if (rng() % 4 == 0) {
+			auto expected = ref.erase(key) ? sjtu::Success : sjtu::Fail;
+			CHECK(tree.erase(key) == expected);
+		}
+		else {
+			auto expected = ref.emplace(key, key + seed).second ? sjtu::Success : sjtu::Fail;
+			CHECK(tree.insert(key, key + seed).second == expected);
+		}
+	}
+}
+
+static void check_rejected(Catalog& catalog, const char* name) {
+	bool thrown = false;
+	try {
+		catalog.open(name);
+	}
+	catch (sjtu::runtime_error&) {
+		thrown = true;
+	}
+	CHECK(thrown && !catalog.contains(name));
+}
+
+int main() {
+	Ref ref[4];
+	remove_catalog();
+	{
+		Catalog catalog(directory);
+		CHECK(catalog.size() == 0);
+		check_rejected(catalog, "../x");
+		check_rejected(catalog, "a/b");
+		check_rejected(catalog, "");
+		check_rejected(catalog, ".hidden");
+		check_rejected(catalog, std::string(64, 'n').c_str());
+		CHECK(catalog.size() == 0);
+		CHECK(!exists(std::string(directory) + "/" + sjtu::BPTREE_CATALOG_NAME));
+		fill(catalog, names[0], ref[0], 1);
+		// two trees of the catalog written at the same time; the second is created
+		// by its thread while the first one is being written
+		std::thread other([&] {
+			fill(catalog, names[1], ref[1], 2);
+		});
+		fill(catalog, names[2], ref[2], 3);
+		other.join();
+		catalog.open(names[3]).insert(7, 7);
+		ref[3][7] = 7;
+		CHECK(catalog.size() == 4);
+		for (int i = 0; i < 4; ++i)
+			check_equal(catalog.open(names[i]), ref[i]);
+	}
+	{
+		Catalog catalog(directory);
+		CHECK(catalog.size() == 4);
+		// names[1] and names[2] were created by racing threads, in either order
+		CHECK(!strcmp(catalog.name(0), names[0]) && !strcmp(catalog.name(3), names[3]));
+		for (int i = 0; i < 4; ++i)
+			CHECK(catalog.contains(names[i]));
+		CHECK(!catalog.contains("nobody"));
+		for (int i = 0; i < 3; ++i)
+			check_equal(catalog.open(names[i]), ref[i]);
+		// names[2] is open, names[3] has not been opened since the catalog was
+		CHECK(catalog.drop(names[2]) == sjtu::Success);
+		CHECK(catalog.drop(names[2]) == sjtu::Fail);
+		CHECK(catalog.drop(names[3]) == sjtu::Success);
+		CHECK(catalog.drop("nobody") == sjtu::Fail);
+		CHECK(!exists(tree_file(names[2])) && !exists(tree_file(names[3])));
+		CHECK(catalog.size() == 2 && !catalog.contains(names[2]) && !catalog.contains(names[3]));
+	}
+	{
+		Catalog catalog(directory);
+		CHECK(catalog.size() == 2 && !strcmp(catalog.name(0), names[0]) && !strcmp(catalog.name(1), names[1]));
+		for (int i = 0; i < 2; ++i)
+			check_equal(catalog.open(names[i]), ref[i]);
+		// a dropped name can be used again, for an empty tree
+		CHECK(catalog.open(names[2]).empty() && catalog.size() == 3);
+		for (auto name : names)
+			catalog.drop(name);
+		CHECK(catalog.size() == 0);
+	}
+	remove_catalog();
+	std::cout << "catalog_test passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,57 @@
+// Helpers shared by the tests in this directory
+#ifndef SJTU_TEST_CHECK_HPP
+#define SJTU_TEST_CHECK_HPP
+
+#include "BTree.hpp"
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+// Print the failed condition and exit with status 1
+#define CHECK(cond) do { if (!(cond)) { \
+	std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+	std::exit(1); } } while (0)
+
+// Remove a tree file and its redo log
+inline void remove_tree(const char* file) {
+	remove(file);
+	remove((std::string(file) + ".log").c_str());
+}
+
+// A tree opened on a new file (the files of an earlier run are removed first), in
+// Manual durability mode so that the tests are not bound by fsync
+template <class Tree>
+class Fresh_Tree : public Tree {
+	static const char* removed(const char* file) {
+		remove_tree(file);
+		return file;
+	}
+
+public:
+	template <class... Args>
+	explicit Fresh_Tree(const char* file, Args... args) : Tree(removed(file), args...) {
+		this->set_durability(sjtu::Manual);
+	}
+};
+
+// Whether a stored value equals the expected one; tests overload it for their value types
+template <class Stored, class Expected>
+bool same_value(const Stored& stored, const Expected& expected) {
+	return stored == expected;
+}
+
+// The tree holds exactly the pairs of ref, in the same order
+template <class Tree, class Map>
+void check_equal(const Tree& tree, const Map& ref) {
+	CHECK(tree.size() == off_t(ref.size()));
+	auto it = tree.cbegin();
+	for (auto& element : ref) {
+		CHECK(it != tree.cend() && it->first == element.first);
+		CHECK(same_value(it->second, element.second));
+		++it;
+	}
+	CHECK(it == tree.cend());
+}
+
+#endif
@@ -0,0 +1,163 @@
+// Online compaction test for sjtu::BTree
+// Build: g++ -O2 -std=c++17 -pthread -I.. compact_test.cpp -o compact_test
+//
+// A tree is filled in random order and mostly erased, then compacted to the end of a
+// pass while writes keep coming. The contents must match a std::map, BTree::analyze()
+// must find no errors or lost blocks, the leaf chain must follow file order and the
+// file must shrink. Value blocks, which compaction leaves in place, are mixed in, and
+// readers run in concurrent mode during a second series of passes
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <sys/stat.h>
+
+struct Small {
+	long long v;
+};
+// Stored in value blocks of a tree with a 64-byte inline limit
+struct Big {
+	long long v;
+	char pad[300];
+};
+static bool same_value(const Small& stored, long long expected) {
+	return stored.v == expected;
+}
+static bool same_value(const Big& stored, long long expected) {
+	return stored.v == expected;
+}
+
+static long long file_size(const char* file) {
+	struct stat st;
+	return ::stat(file, &st) ? 0 : (long long)st.st_size;
+}
+
+template <class Tree, class Value>
+void run(const char* file, long long n, sjtu::StorageType type, bool shrink) {
+	std::map<long long, long long> ref;
+	std::mt19937_64 rng(3);
+	Fresh_Tree<Tree> tree(file, 256, type);
+	auto insert = [&](long long key) {
+		Value value;
+		value.v = key;
+		if (tree.insert(key, value).second == sjtu::Success)
+			ref[key] = key;
+	};
+	for (long long i = 0; i < n; ++i)
+		insert(rng() % (n * 4));
+	std::vector<long long> keys;
+	for (auto& element : ref)
+		keys.push_back(element.first);
+	std::shuffle(keys.begin(), keys.end(), rng);
+	for (size_t i = 0; i < keys.size() * 4 / 5; ++i) {
+		CHECK(tree.erase(keys[i]) == sjtu::Success);
+		ref.erase(keys[i]);
+	}
+	tree.checkpoint();
+	auto before = Tree::analyze(file);
+	auto size_before = file_size(file);
+	for (int step = 0; !tree.compact(50); ++step) {
+		if (step % 7 == 0) {
+			insert(rng() % (n * 4));
+			auto first = ref.begin();
+			CHECK(tree.erase(first->first) == sjtu::Success);
+			ref.erase(first);
+		}
+	}
+	tree.checkpoint();
+	auto after = Tree::analyze(file);
+	CHECK(after.error_cnt == 0 && after.unreachable_blocks == 0);
+	CHECK(after.record_cnt == off_t(ref.size()));
+	CHECK(after.block_cnt <= before.block_cnt);
+	CHECK(after.chain_sequential >= before.chain_sequential);
+	if (shrink) {
+		// mmap files only shrink by whole extents
+		CHECK(after.block_cnt < before.block_cnt);
+		CHECK(type == sjtu::MmapStorage ? file_size(file) <= size_before : file_size(file) < size_before);
+		CHECK(after.chain_sequential * 10 >= after.chain_leaves * 9);
+	}
+	check_equal(tree, ref);
+
+	// readers in concurrent mode while further passes run
+	tree.set_concurrent(true);
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 2; ++r) {
+		readers.emplace_back([&, r] {
+			std::mt19937_64 reader_rng(r);
+			while (!stop) {
+				if (r == 0) {
+					auto expected = ref.begin();
+					std::advance(expected, reader_rng() % ref.size());
+					auto found = tree.find(expected->first);
+					CHECK(found != tree.end() && found->second.v == expected->second);
+				}
+				else {
+					off_t cnt = 0;
+					long long prev = -1;
+					for (auto scan = tree.cbegin(); scan != tree.cend(); ++scan, ++cnt) {
+						CHECK(scan->first > prev);
+						prev = scan->first;
+					}
+					CHECK(cnt == off_t(ref.size()));
+				}
+			}
+		});
+	}
+	for (int pass = 0; pass < 3; ++pass)
+		while (!tree.compact(5));
+	stop = true;
+	for (auto& reader : readers)
+		reader.join();
+	tree.set_concurrent(false);
+	tree.checkpoint();
+	after = Tree::analyze(file);
+	CHECK(after.error_cnt == 0 && after.unreachable_blocks == 0);
+
+	// compact an emptied tree
+	for (auto& element : ref)
+		CHECK(tree.erase(element.first) == sjtu::Success);
+	while (!tree.compact());
+	tree.checkpoint();
+	after = Tree::analyze(file);
+	CHECK(after.error_cnt == 0 && after.unreachable_blocks == 0 && after.record_cnt == 0);
+	tree.clear();
+}
+
+// Leaves left half full by sequential inserts are spread three into two
+void coalesce() {
+	typedef sjtu::BTree<long long, long long> Tree;
+	const char* file = "compact_test_coalesce.sjtu";
+	Fresh_Tree<Tree> tree(file);
+	for (long long key = 0; key < 200000; ++key)
+		tree.insert(key, key);
+	tree.checkpoint();
+	auto before = Tree::analyze(file);
+	while (!tree.compact());
+	tree.checkpoint();
+	auto after = Tree::analyze(file);
+	CHECK(after.error_cnt == 0 && after.unreachable_blocks == 0 && after.record_cnt == before.record_cnt);
+	CHECK(after.leaf_cnt * 10 < before.leaf_cnt * 9);
+	long long key = 0;
+	for (auto it = tree.cbegin(); it != tree.cend(); ++it, ++key)
+		CHECK(it->first == key && it->second == key);
+	CHECK(key == 200000);
+	tree.clear();
+}
+
+int main() {
+	typedef sjtu::BTree<long long, Small> Plain;
+	typedef sjtu::BTree<long long, Big, std::less<long long>, 4096, 0, 0, 64> Separated;
+	run<Plain, Small>("compact_test_stdio.sjtu", 60000, sjtu::StdioStorage, true);
+	run<Plain, Small>("compact_test_mmap.sjtu", 60000, sjtu::MmapStorage, true);
+	run<Plain, Small>("compact_test_pread.sjtu", 60000, sjtu::PreadStorage, true);
+	run<sjtu::BTree<long long, Small, std::less<long long>, 512>, Small>("compact_test_512.sjtu", 40000,
+		sjtu::StdioStorage, true);
+	run<Separated, Big>("compact_test_values.sjtu", 8000, sjtu::StdioStorage, false);
+	coalesce();
+	std::cout << "compact_test passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,154 @@
+// Multithreaded stress test for sjtu::BTree in concurrent mode
+// Build: g++ -O2 -std=c++17 -pthread -I.. concurrent_test.cpp -o concurrent_test
+//
+// Keys that are multiples of 4 are loaded first and never erased. Two writer threads
+// insert and erase the keys of their own residue class (1 and 3 mod 4), each keeping a
+// std::map of what it wrote, while reader threads use find, at, count, rank,
+// count_range, scan and iteration in both directions. Readers must always see every
+// stable key, only correct values and strictly ordered scans. Afterwards the tree must
+// equal the union of the writers' maps, before and after reopening the file
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+// Stored in value blocks of a tree with a 64-byte inline limit
+struct Big {
+	long long v;
+	char pad[200];
+	Big(long long v = 0) : v(v) {
+		pad[0] = pad[199] = char(v);
+	}
+	bool operator==(const Big& other) const {
+		return v == other.v && pad[0] == other.pad[0] && pad[199] == other.pad[199];
+	}
+};
+
+static long long value_of(long long key) {
+	return key * 3 + 1;
+}
+
+template <class Tree, class Value>
+void run(const char* file, sjtu::StorageType type, long long stable_num, long long writer_ops) {
+	const long long range = stable_num * 4;
+	std::map<long long, long long> written[2], ref;
+	{
+		Fresh_Tree<Tree> tree(file, 256, type);
+		std::mt19937_64 rng(1);
+		std::vector<long long> stable;
+		for (long long i = 0; i < stable_num; ++i)
+			stable.push_back(i * 4);
+		std::shuffle(stable.begin(), stable.end(), rng);
+		for (auto key : stable)
+			CHECK(tree.insert(key, Value(value_of(key))).second == sjtu::Success);
+		tree.set_concurrent(true);
+
+		std::atomic<int> writing(2);
+		std::vector<std::thread> threads;
+		for (int w = 0; w < 2; ++w) {
+			threads.emplace_back([&, w] {
+				std::mt19937_64 writer_rng(10 + w);
+				auto& mine = written[w];
+				for (long long op = 0; op < writer_ops; ++op) {
+					long long key = (long long)(writer_rng() % stable_num) * 4 + 1 + w * 2;
+					if (writer_rng() % 3) {
+						auto result = tree.insert(key, Value(value_of(key))).second;
+						CHECK((result == sjtu::Success) == !mine.count(key));
+						mine[key] = value_of(key);
+					}
+					else {
+						auto result = tree.erase(key);
+						CHECK((result == sjtu::Success) == (mine.erase(key) == 1));
+					}
+				}
+				--writing;
+			});
+		}
+		for (int r = 0; r < 4; ++r) {
+			threads.emplace_back([&, r] {
+				std::mt19937_64 reader_rng(100 + r);
+				while (writing) {
+					long long key = reader_rng() % range;
+					auto found = tree.find(key);
+					if (key % 4 == 0)
+						CHECK(found != tree.end() && found->first == key);
+					if (found != tree.end())
+						CHECK(found->first == key && found->second == Value(value_of(key)));
+					if (key % 4 == 0) {
+						CHECK(tree.at(key) == Value(value_of(key)));
+						CHECK(tree.count(key) == 1);
+						// at least the stable keys below key, at most every key below it
+						auto rank = tree.rank(key);
+						CHECK(rank >= key / 4 && rank <= key);
+					}
+					if (r == 0) {
+						long long lo = reader_rng() % range, hi = lo + 4000;
+						long long prev = lo - 1;
+						off_t stable_seen = 0;
+						tree.scan(lo, hi, [&](const long long& k, const Value& v) {
+							CHECK(k > prev && k < hi && v == Value(value_of(k)));
+							prev = k;
+							stable_seen += k % 4 == 0;
+							return true;
+						});
+						CHECK(stable_seen == (std::min(hi, range) + 3) / 4 - (lo + 3) / 4);
+						// the two bounds are counted by separate descents, so writers may move them
+						auto cnt = tree.count_range(lo, hi);
+						CHECK(cnt >= 0 && cnt <= hi - lo);
+					}
+					else if (r == 1) {
+						long long prev = -1;
+						off_t stable_seen = 0;
+						for (auto it = tree.cbegin(); it != tree.cend(); ++it) {
+							CHECK(it->first > prev && it->second == Value(value_of(it->first)));
+							prev = it->first;
+							stable_seen += it->first % 4 == 0;
+						}
+						CHECK(stable_seen == stable_num);
+					}
+					else if (r == 2) {
+						auto it = tree.cend();
+						long long prev = range;
+						for (int step = 0; step < 3000 && it != tree.cbegin(); ++step) {
+							--it;
+							CHECK(it->first < prev && it->second == Value(value_of(it->first)));
+							prev = it->first;
+						}
+					}
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		tree.set_concurrent(false);
+
+		ref = written[0];
+		ref.insert(written[1].begin(), written[1].end());
+		for (long long i = 0; i < stable_num; ++i)
+			ref[i * 4] = value_of(i * 4);
+		check_equal(tree, ref);
+		tree.checkpoint();
+		auto shape = Tree::analyze(file);
+		CHECK(shape.error_cnt == 0 && shape.unreachable_blocks == 0);
+	}
+	Tree tree(file, 256, type);
+	check_equal(tree, ref);
+	tree.clear();
+}
+
+int main() {
+	typedef sjtu::BTree<long long, long long> Plain;
+	typedef sjtu::BTree<long long, Big, std::less<long long>, 4096, 0, 0, 64> Separated;
+	run<Plain, long long>("concurrent_test_stdio.sjtu", sjtu::StdioStorage, 20000, 40000);
+	run<Plain, long long>("concurrent_test_mmap.sjtu", sjtu::MmapStorage, 20000, 40000);
+	run<Plain, long long>("concurrent_test_pread.sjtu", sjtu::PreadStorage, 20000, 40000);
+	// small fan-outs split and merge nodes on every level while readers descend
+	run<sjtu::BTree<long long, long long, std::less<long long>, 4096, 4, 4>, long long>(
+		"concurrent_test_small.sjtu", sjtu::StdioStorage, 2000, 8000);
+	run<Separated, Big>("concurrent_test_values.sjtu", sjtu::PreadStorage, 10000, 20000);
+	std::cout << "concurrent_test passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,86 @@
+// Erase and rebalancing test for sjtu::BTree
+// Build: g++ -O2 -std=c++17 -pthread -I.. erase_test.cpp -o erase_test
+//
+// Random inserts and erases are checked against a std::map. Small fan-outs make
+// borrowing and merging happen on every level; after each round the file is
+// checkpointed and BTree::analyze() must find no broken links, no lost blocks and
+// no node but the root below half full. Values larger than a page span several value blocks and
+// must survive the reuse of freed blocks
+#include "check.hpp"
+#include <map>
+#include <random>
+
+// Three pages of a 4096-byte tree
+struct Huge {
+	long long word[1500];
+};
+
+static void make_value(long long key, long long& value) {
+	value = key * 7 + 1;
+}
+static void make_value(long long key, Huge& value) {
+	for (int i = 0; i < 1500; ++i)
+		value.word[i] = key + i;
+}
+static bool same_value(const Huge& lhs, const Huge& rhs) {
+	return lhs.word[0] == rhs.word[0] && lhs.word[777] == rhs.word[777] && lhs.word[1499] == rhs.word[1499];
+}
+
+template <class Tree>
+void check_shape(Tree& tree, const char* file, off_t size) {
+	tree.checkpoint();
+	auto shape = Tree::analyze(file);
+	CHECK(shape.error_cnt == 0);
+	CHECK(shape.unreachable_blocks == 0);
+	CHECK(shape.record_cnt == size);
+	if (shape.leaf_cnt > 1) {
+		// at least half full, which is just below 0.5 for an odd capacity
+		for (int i = 0; i < 4; ++i)
+			CHECK(shape.leaf_fill[i] == 0);
+	}
+	// only the root may have fewer children
+	off_t sparse_inner = 0;
+	for (int i = 0; i < 4; ++i)
+		sparse_inner += shape.inner_fill[i];
+	CHECK(sparse_inner <= 1);
+}
+
+template <class Tree, class Value>
+void run(const char* name, long long range, int round_num, int op_num) {
+	std::string file = std::string(name) + ".sjtu";
+	std::map<long long, Value> ref;
+	std::mt19937_64 rng(21);
+	Fresh_Tree<Tree> tree(file.c_str());
+	for (int round = 0; round < round_num; ++round) {
+		// grow, then shrink to almost nothing every other round
+		bool shrink = round % 2;
+		for (int i = 0; i < op_num; ++i) {
+			long long key = rng() % range;
+			if (shrink ? rng() % 10 < 9 : rng() % 10 < 3) {
+				auto expected = ref.erase(key) ? sjtu::Success : sjtu::Fail;
+				CHECK(tree.erase(key) == expected);
+			}
+			else {
+				Value value;
+				make_value(key, value);
+				auto expected = ref.emplace(key, value).second ? sjtu::Success : sjtu::Fail;
+				CHECK(tree.insert(key, value).second == expected);
+			}
+		}
+		check_equal(tree, ref);
+		check_shape(tree, file.c_str(), off_t(ref.size()));
+	}
+	for (auto& element : ref)
+		CHECK(tree.erase(element.first) == sjtu::Success);
+	CHECK(tree.size() == 0 && tree.cbegin() == tree.cend());
+	check_shape(tree, file.c_str(), 0);
+	tree.clear();
+}
+
+int main() {
+	run<sjtu::BTree<long long, long long, std::less<long long>, 4096, 4, 4>, long long>("erase_test_small", 5000, 8, 20000);
+	run<sjtu::BTree<long long, long long>, long long>("erase_test", 200000, 6, 100000);
+	run<sjtu::BTree<long long, Huge>, Huge>("erase_test_huge", 3000, 6, 4000);
+	std::cout << "erase_test passed" << std::endl;
+	return 0;
+}
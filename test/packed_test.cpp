@@ -0,0 +1,145 @@
+// Packed key test for sjtu::BTree
+// Build: g++ -O2 -std=c++17 -pthread -I.. packed_test.cpp -o packed_test
+//
+// Compact_Key<long long> is switched on, so each leaf stores its keys as a base plus
+// 32-bit deltas. Keys are drawn from dense clusters, from the whole (negative and
+// positive) range and from clusters just over a delta apart, so inserts and batches
+// have to split leaves at the insertion point and the bulk loader has to start new
+// leaves early. Everything is checked against a std::map, through compaction and
+// reopening, and a tree with unpacked keys must refuse to open the file
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <vector>
+#include <utility>
+
+namespace sjtu {
+	template <>
+	class Compact_Key<long long> : public std::true_type {};
+}
+
+typedef sjtu::BTree<long long, long long> Tree;
+// Same key size, but keys are stored whole
+typedef sjtu::BTree<unsigned long long, long long> Plain_Tree;
+
+static long long random_key(std::mt19937_64& rng) {
+	switch (rng() % 4) {
+	case 0:
+		// dense ids
+		return 1000000 + (long long)(rng() % 100000);
+	case 1:
+		// anywhere, including negative keys
+		return (long long)rng();
+	case 2:
+		// clusters 2^32 + 1 apart: neighbors never fit in one delta
+		return (long long)(rng() % 64) * ((1LL << 32) + 1) - (1LL << 36) + (long long)(rng() % 16);
+	default:
+		return -(long long)(rng() % 1000);
+	}
+}
+
+template <class Tree>
+void check_shape(Tree& tree, const char* file, off_t size) {
+	tree.checkpoint();
+	auto shape = Tree::analyze(file);
+	CHECK(shape.error_cnt == 0 && shape.unreachable_blocks == 0 && shape.record_cnt == size);
+}
+
+void run(const char* file, off_t cache_page_num) {
+	std::map<long long, long long> ref;
+	std::mt19937_64 rng(19);
+	{
+		Fresh_Tree<Tree> tree(file, cache_page_num);
+		for (int round = 0; round < 3; ++round) {
+			for (int i = 0; i < 20000; ++i) {
+				auto key = random_key(rng);
+				if (rng() % 4 == 0) {
+					auto expected = ref.erase(key) ? sjtu::Success : sjtu::Fail;
+					CHECK(tree.erase(key) == expected);
+				}
+				else {
+					auto expected = ref.emplace(key, key ^ 0x5555).second ? sjtu::Success : sjtu::Fail;
+					CHECK(tree.insert(key, key ^ 0x5555).second == expected);
+				}
+			}
+			check_equal(tree, ref);
+			// batches mix keys that fit the leaves they land in with keys that do not
+			std::vector<std::pair<long long, long long> > batch;
+			for (int i = 0; i < 5000; ++i) {
+				auto key = random_key(rng);
+				batch.push_back({ key, key ^ 0x5555 });
+			}
+			std::vector<sjtu::OperationResult> results(batch.size());
+			off_t inserted = tree.insert_batch(batch.begin(), batch.end(), results.data());
+			off_t expected_inserted = 0;
+			for (size_t i = 0; i < batch.size(); ++i) {
+				bool fresh = ref.emplace(batch[i].first, batch[i].second).second;
+				CHECK(results[i] == (fresh ? sjtu::Success : sjtu::Fail));
+				expected_inserted += fresh;
+			}
+			CHECK(inserted == expected_inserted);
+			check_equal(tree, ref);
+			for (int i = 0; i < 1000; ++i) {
+				auto key = random_key(rng);
+				auto lower = ref.lower_bound(key);
+				auto found = tree.lower_bound(key);
+				CHECK(lower == ref.end() ? found == tree.end() : found != tree.end() && found->first == lower->first);
+				CHECK(tree.rank(key) == off_t(std::distance(ref.begin(), lower)));
+			}
+			while (!tree.compact());
+			check_equal(tree, ref);
+			check_shape(tree, file, off_t(ref.size()));
+		}
+	}
+	{
+		Tree tree(file, cache_page_num);
+		check_equal(tree, ref);
+		bool thrown = false;
+		try {
+			Plain_Tree plain(file);
+		}
+		catch (sjtu::runtime_error&) {
+			thrown = true;
+		}
+		CHECK(thrown);
+		// bulk load the same keys: far-apart neighbors start new leaves
+		tree.clear();
+		CHECK(tree.bulk_load(ref.begin(), ref.end(), 0.9) == sjtu::Success);
+		check_equal(tree, ref);
+		check_shape(tree, file, off_t(ref.size()));
+		for (auto it = ref.begin(); it != ref.end(); ) {
+			if (rng() % 3) {
+				CHECK(tree.erase(it->first) == sjtu::Success);
+				it = ref.erase(it);
+			}
+			else
+				++it;
+		}
+		check_shape(tree, file, off_t(ref.size()));
+	}
+	Tree tree(file, cache_page_num);
+	check_equal(tree, ref);
+	tree.clear();
+	// and the other way round: a packed tree does not open a file of unpacked keys
+	remove_tree(file);
+	{
+		Plain_Tree plain(file);
+		plain.insert(1, 1);
+	}
+	bool thrown = false;
+	try {
+		Tree packed(file);
+	}
+	catch (sjtu::runtime_error&) {
+		thrown = true;
+	}
+	CHECK(thrown);
+	remove_tree(file);
+}
+
+int main() {
+	run("packed_test.sjtu", 1024);
+	run("packed_test_small_cache.sjtu", 32);
+	std::cout << "packed_test passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,109 @@
+// Order-statistics test for sjtu::BTree
+// Build: g++ -O2 -std=c++17 -pthread -I.. rank_test.cpp -o rank_test
+//
+// rank(), count_range() and select() are checked against a sorted copy of a
+// std::map after inserts, batch inserts, erases, compaction, reopening and a bulk
+// load, so the subtree counts kept in the index nodes must stay exact through
+// every kind of structural change
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+template <class Tree>
+void check(Tree& tree, const std::map<long long, long long>& ref, std::mt19937_64& rng, long long range,
+	const char* file) {
+	std::vector<long long> keys;
+	for (auto& element : ref)
+		keys.push_back(element.first);
+	check_equal(tree, ref);
+	for (int q = 0; q < 2000; ++q) {
+		long long key = (long long)(rng() % (range + 2)) - 1;
+		CHECK(tree.rank(key) == std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+		long long lo = (long long)(rng() % (range + 2)) - 1;
+		long long hi = lo + (long long)(rng() % (range / 4 + 1));
+		CHECK(tree.count_range(lo, hi) ==
+			std::lower_bound(keys.begin(), keys.end(), hi) - std::lower_bound(keys.begin(), keys.end(), lo));
+		CHECK(tree.count_range(hi, lo) == 0);
+		if (!keys.empty()) {
+			off_t i = rng() % keys.size();
+			auto it = tree.select(i);
+			CHECK(it != tree.end() && it->first == keys[i] && it->second == ref.at(keys[i]));
+			++it;
+			CHECK(i + 1 < off_t(keys.size()) ? it->first == keys[i + 1] : it == tree.end());
+		}
+	}
+	CHECK(tree.select(keys.size()) == tree.end());
+	CHECK(tree.select(-1) == tree.end());
+	tree.checkpoint();
+	auto shape = Tree::analyze(file);
+	CHECK(shape.error_cnt == 0 && shape.unreachable_blocks == 0);
+}
+
+template <class Tree>
+void run(const char* file, long long n, long long range) {
+	std::map<long long, long long> ref;
+	std::mt19937_64 rng(4);
+	{
+		Fresh_Tree<Tree> tree(file);
+		CHECK(tree.rank(5) == 0 && tree.count_range(0, 10) == 0 && tree.select(0) == tree.end());
+		for (int round = 0; round < 3; ++round) {
+			for (long long i = 0; i < n; ++i) {
+				long long key = rng() % range;
+				if (tree.insert(key, key).second == sjtu::Success)
+					ref[key] = key;
+			}
+			check(tree, ref, rng, range, file);
+			std::vector<std::pair<long long, long long> > batch;
+			for (long long i = 0; i < n / 2; ++i) {
+				long long key = rng() % range;
+				batch.push_back({ key, key });
+			}
+			tree.insert_batch(batch.begin(), batch.end());
+			for (auto& element : batch)
+				ref[element.first] = element.second;
+			check(tree, ref, rng, range, file);
+			std::vector<long long> keys;
+			for (auto& element : ref)
+				keys.push_back(element.first);
+			std::shuffle(keys.begin(), keys.end(), rng);
+			for (size_t i = 0; i < keys.size() * 2 / 3; ++i) {
+				CHECK(tree.erase(keys[i]) == sjtu::Success);
+				ref.erase(keys[i]);
+			}
+			check(tree, ref, rng, range, file);
+			while (!tree.compact(20));
+			check(tree, ref, rng, range, file);
+		}
+	}
+	Tree tree(file);
+	check(tree, ref, rng, range, file);
+	tree.clear();
+	std::vector<std::pair<long long, long long> > sorted;
+	for (long long i = 0; i < n * 2; ++i)
+		sorted.push_back({ i * 3, i });
+	CHECK(tree.bulk_load(sorted.begin(), sorted.end(), 0.7) == sjtu::Success);
+	ref.clear();
+	for (auto& element : sorted)
+		ref[element.first] = element.second;
+	check(tree, ref, rng, n * 6, file);
+	for (long long i = 0; i < n; ++i) {
+		long long key = rng() % (n * 6);
+		if (tree.insert(key, key).second == sjtu::Success)
+			ref[key] = key;
+	}
+	check(tree, ref, rng, n * 6, file);
+	tree.clear();
+}
+
+int main() {
+	run<sjtu::BTree<long long, long long> >("rank_test.sjtu", 40000, 200000);
+	run<sjtu::BTree<long long, long long, std::less<long long>, 512> >("rank_test_512.sjtu", 20000, 100000);
+	// small fan-outs give a deep tree with counts on every level
+	run<sjtu::BTree<long long, long long, std::less<long long>, 4096, 4, 4> >("rank_test_small.sjtu", 5000, 30000);
+	run<sjtu::BTree<long long, long long, std::less<long long>, 4096, 0, 0, 4> >("rank_test_values.sjtu", 5000,
+		30000);
+	std::cout << "rank_test passed" << std::endl;
+	return 0;
+}
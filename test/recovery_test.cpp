@@ -0,0 +1,103 @@
+// Crash recovery regression test for sjtu::BTree
+// Build: g++ -O2 -std=c++17 -pthread -I.. recovery_test.cpp -o recovery_test
+//
+// A child process loads a tree and checkpoints it, then erases most keys and inserts
+// new and previously erased keys, so freed node and value blocks are reused within
+// one log; it exits without closing the tree. The parent reopens the file, which
+// replays the log, and compares the tree with a std::map that went through the same
+// operations, for every storage backend
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Stored in value blocks; later generations leave zeros where earlier ones did not
+struct Big {
+	long long word[40];
+};
+
+static void make_value(long long key, int generation, long long& value) {
+	value = generation ? key << 8 : key * 1000003 + 1;
+}
+static void make_value(long long key, int generation, Big& value) {
+	for (int i = 0; i < 40; ++i)
+		value.word[i] = generation && i % 2 ? 0 : key * 31 + i + generation;
+}
+static bool same_value(const Big& lhs, const Big& rhs) {
+	for (int i = 0; i < 40; ++i)
+		if (lhs.word[i] != rhs.word[i])
+			return false;
+	return true;
+}
+
+// Apply the operations of one seed to tree (when not null) and to ref
+template <class Tree, class Value>
+void run_ops(unsigned seed, Tree* tree, std::map<long long, Value>& ref, bool crash) {
+	std::mt19937_64 rng(seed);
+	const long long range = 1000000;
+	for (int i = 0; i < 8000; ++i) {
+		long long key = rng() % range;
+		Value value;
+		make_value(key, 0, value);
+		if (ref.emplace(key, value).second && tree)
+			tree->insert(key, value);
+	}
+	if (tree)
+		tree->checkpoint();
+	std::vector<long long> erased;
+	for (auto& element : ref)
+		if (rng() % 3)
+			erased.push_back(element.first);
+	for (auto key : erased) {
+		ref.erase(key);
+		if (tree)
+			tree->erase(key);
+	}
+	for (int i = 0; i < 8000; ++i) {
+		long long key = i % 2 ? erased[rng() % erased.size()] : (long long)(rng() % range);
+		Value value;
+		make_value(key, 1, value);
+		if (ref.emplace(key, value).second && tree)
+			tree->insert(key, value);
+	}
+	if (crash)
+		_exit(0);
+}
+
+template <class Value>
+void run(sjtu::StorageType type, unsigned seed) {
+	typedef sjtu::BTree<long long, Value> Tree;
+	const char* file = "recovery_test.sjtu";
+	remove_tree(file);
+	std::map<long long, Value> ref;
+	auto pid = fork();
+	CHECK(pid >= 0);
+	if (!pid) {
+		// no destructor: the child "crashes" without a checkpoint
+		auto tree = new Tree(file, 64, type);
+		tree->set_durability(sjtu::PerOperation);
+		run_ops(seed, tree, ref, true);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	run_ops<Tree>(seed, nullptr, ref, false);
+	Tree tree(file, 64, type);
+	check_equal(tree, ref);
+	tree.clear();
+}
+
+int main() {
+	sjtu::StorageType types[] = { sjtu::StdioStorage, sjtu::MmapStorage, sjtu::PreadStorage };
+	for (auto type : types) {
+		for (unsigned seed = 1; seed <= 2; ++seed) {
+			run<long long>(type, seed);
+			run<Big>(type, seed);
+		}
+	}
+	remove_tree("recovery_test.sjtu");
+	std::cout << "recovery_test passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,155 @@
+// Sharded tree test for sjtu::ShardedBTree
+// Build: g++ -O2 -std=c++17 -pthread -I.. sharded_test.cpp -o sharded_test
+//
+// Random inserts, erases and batches are checked against a std::map through the
+// merging iterator, together with the summed rank and count_range. The iterator is
+// copied and compared mid-scan, and one tree has a shard that runs out early and a
+// shard that stays empty. Reopening with a different shard count must throw
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <vector>
+#include <utility>
+
+typedef sjtu::ShardedBTree<long long, long long> Tree;
+typedef std::map<long long, long long> Ref;
+
+// Remove the shard count file and the files of up to 16 shards
+static void remove_sharded(const char* file) {
+	remove((std::string(file) + ".shards").c_str());
+	for (int i = 0; i < 16; ++i)
+		remove_tree((std::string(file) + ".shard" + std::to_string(i)).c_str());
+}
+
+// Keys are drawn from [0, key_range); the bounds go a little past both ends
+static void check_order(const Tree& tree, const Ref& ref, std::mt19937_64& rng, long long key_range) {
+	for (int i = 0; i < 1000; ++i) {
+		auto lo = (long long)(rng() % (key_range + key_range / 5)) - key_range / 10;
+		auto hi = lo + (long long)(rng() % (key_range / 5));
+		auto rank = off_t(std::distance(ref.begin(), ref.lower_bound(lo)));
+		CHECK(tree.rank(lo) == rank);
+		CHECK(tree.count_range(lo, hi) == off_t(std::distance(ref.lower_bound(lo), ref.lower_bound(hi))));
+	}
+}
+
+// Copies are independent of the original and compare equal at the same record
+static void check_copy(const Tree& tree, const Ref& ref) {
+	auto it = tree.cbegin();
+	auto expected = ref.begin();
+	for (size_t i = 0; i < ref.size() / 2; ++i, ++expected)
+		++it;
+	Tree::const_iterator copy(it);
+	CHECK(copy == it && copy->first == expected->first);
+	auto old = copy++;
+	CHECK(old == it && copy != it);
+	++it;
+	CHECK(copy == it && it->first == std::next(expected)->first);
+	Tree::const_iterator assigned;
+	assigned = tree.cbegin();
+	CHECK(assigned == tree.cbegin() && assigned->first == ref.begin()->first);
+	assigned = copy;
+	while (copy != tree.cend())
+		++copy;
+	CHECK(assigned == it && assigned != copy && copy == tree.cend());
+}
+
+static void run_random(const char* file) {
+	Ref ref;
+	std::mt19937_64 rng(12);
+	remove_sharded(file);
+	{
+		Tree tree(file, 4);
+		tree.set_durability(sjtu::Manual);
+		CHECK(tree.empty() && tree.cbegin() == tree.cend());
+		for (int round = 0; round < 4; ++round) {
+			for (int i = 0; i < 20000; ++i) {
+				auto key = (long long)(rng() % 100000);
+				if (rng() % 3 == 0) {
+					auto expected = ref.erase(key) ? sjtu::Success : sjtu::Fail;
+					CHECK(tree.erase(key) == expected);
+				}
+				else {
+					auto expected = ref.emplace(key, key * 3).second ? sjtu::Success : sjtu::Fail;
+					CHECK(tree.insert(key, key * 3) == expected);
+				}
+			}
+			// the batch also repeats its own keys; results come back in input order
+			std::vector<std::pair<long long, long long> > batch;
+			for (int i = 0; i < 5000; ++i) {
+				auto key = (long long)(rng() % 100000);
+				batch.push_back({ key, key * 3 });
+				if (i % 7 == 0)
+					batch.push_back({ key, key * 3 });
+			}
+			std::vector<sjtu::OperationResult> results(batch.size());
+			off_t inserted = tree.insert_batch(batch.begin(), batch.end(), results.data());
+			off_t expected_inserted = 0;
+			for (size_t i = 0; i < batch.size(); ++i) {
+				bool fresh = ref.emplace(batch[i].first, batch[i].second).second;
+				CHECK(results[i] == (fresh ? sjtu::Success : sjtu::Fail));
+				expected_inserted += fresh;
+			}
+			CHECK(inserted == expected_inserted);
+			check_equal(tree, ref);
+			check_order(tree, ref, rng, 100000);
+			check_copy(tree, ref);
+		}
+		for (auto& element : ref)
+			CHECK(tree.count(element.first) == 1 && tree.at(element.first) == element.second);
+		CHECK(tree.count(-1) == 0);
+	}
+	{
+		Tree tree(file, 4);
+		check_equal(tree, ref);
+	}
+	bool thrown = false;
+	try {
+		Tree tree(file, 3);
+	}
+	catch (sjtu::runtime_error&) {
+		thrown = true;
+	}
+	CHECK(thrown);
+	{
+		Tree tree(file, 4);
+		check_equal(tree, ref);
+		tree.clear();
+	}
+	remove_sharded(file);
+}
+
+// One shard holds only the smallest keys and another holds none, so the merge has to
+// drop a shard from its heap long before the end and skip an empty shard at the start
+static void run_uneven(const char* file) {
+	Ref ref;
+	remove_sharded(file);
+	{
+		Tree tree(file, 3);
+		tree.set_durability(sjtu::Manual);
+		auto short_shard = &tree.shard(0);
+		auto empty_shard = short_shard;
+		for (long long key = 1; empty_shard == short_shard; ++key)
+			empty_shard = &tree.shard(key);
+		for (long long key = 0; key < 3000; ++key) {
+			auto shard = &tree.shard(key);
+			if (shard == empty_shard || (shard == short_shard && key >= 100))
+				continue;
+			CHECK(tree.insert(key, -key) == sjtu::Success);
+			ref[key] = -key;
+		}
+		CHECK(empty_shard->empty() && !short_shard->empty());
+		check_equal(tree, ref);
+		check_copy(tree, ref);
+		std::mt19937_64 rng(3);
+		check_order(tree, ref, rng, 3000);
+		tree.clear();
+	}
+	remove_sharded(file);
+}
+
+int main() {
+	run_random("sharded_test.sjtu");
+	run_uneven("sharded_test_uneven.sjtu");
+	std::cout << "sharded_test passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,77 @@
+// Statistics test for sjtu::BTree::stats()
+// Build: g++ -O2 -std=c++17 -pthread -I.. stats_test.cpp -o stats_test
+//        (and again with -DBPTREE_STATS=0)
+//
+// After reset_stats() a known number of inserts, finds and erases must show up in the
+// counts of the latency histograms, and the leaf splits must match the number of leaves
+// analyze() finds. With BPTREE_STATS=0 those fields stay 0, while the block reads and
+// writes of the cache and the redo log are still counted
+#include "check.hpp"
+#include <random>
+#include <algorithm>
+#include <vector>
+
+typedef sjtu::BTree<long long, long long> Tree;
+
+static void check_histogram(const sjtu::BTree_Stats::Histogram& histogram, off_t count) {
+#if BPTREE_STATS
+	off_t total = 0;
+	for (auto cnt : histogram.bucket)
+		total += cnt;
+	CHECK(histogram.count == count && total == count);
+	CHECK(!count || (histogram.mean_ns() > 0 && histogram.percentile_ns(0.99) >= histogram.percentile_ns(0.5)));
+#else
+	(void)count;
+	CHECK(histogram.count == 0 && histogram.total_ns == 0);
+#endif
+}
+
+int main() {
+	const char* file = "stats_test.sjtu";
+	const off_t n = 50000;
+	std::vector<long long> keys;
+	for (long long i = 0; i < n; ++i)
+		keys.push_back(i * 7);
+	std::shuffle(keys.begin(), keys.end(), std::mt19937_64(17));
+	{
+		Fresh_Tree<Tree> tree(file);
+		tree.insert(-1, -1);
+		tree.reset_stats();
+		auto stats = tree.stats();
+		CHECK(stats.insert_latency.count == 0 && stats.leaf_splits == 0 && stats.log_bytes == 0);
+		for (auto key : keys)
+			CHECK(tree.insert(key, key).second == sjtu::Success);
+		// inserts that fail are timed as well
+		for (off_t i = 0; i < 100; ++i)
+			CHECK(tree.insert(keys[i], 0).second == sjtu::Fail);
+		for (off_t i = 0; i < n / 2; ++i)
+			CHECK(tree.find(keys[i]) != tree.end());
+		stats = tree.stats();
+		check_histogram(stats.insert_latency, n + 100);
+		check_histogram(stats.find_latency, n / 2);
+		check_histogram(stats.erase_latency, 0);
+		CHECK(stats.log_bytes > 0);
+		tree.checkpoint();
+		auto shape = Tree::analyze(file);
+		CHECK(shape.error_cnt == 0 && shape.record_cnt == n + 1);
+#if BPTREE_STATS
+		// every leaf but the first came from a split, and nothing was merged
+		CHECK(stats.leaf_splits == shape.leaf_cnt - 1 && stats.leaf_splits > 0);
+		CHECK(stats.inner_splits > 0 && stats.leaf_merges == 0 && stats.leaf_writes > 0);
+#else
+		CHECK(stats.leaf_splits == 0 && stats.inner_splits == 0 && stats.leaf_writes == 0);
+#endif
+		tree.reset_stats();
+		stats = tree.stats();
+		CHECK(stats.insert_latency.count == 0 && stats.find_latency.count == 0);
+		CHECK(stats.leaf_splits == 0 && stats.storage_writes == 0 && stats.log_bytes == 0);
+		for (off_t i = 0; i < n / 4; ++i)
+			CHECK(tree.erase(keys[i]) == sjtu::Success);
+		stats = tree.stats();
+		check_histogram(stats.insert_latency, 0);
+		check_histogram(stats.erase_latency, n / 4);
+		tree.clear();
+	}
+	std::cout << "stats_test passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,164 @@
+// Variable-length record test for sjtu::VarBTree
+// Build: g++ -O2 -std=c++17 -pthread -I.. var_test.cpp -o var_test
+//
+// Random inserts and erases of byte-string keys and values (with shared prefixes,
+// zero bytes, the empty key and records of exactly MAX_RECORD bytes) are checked
+// against a std::map. get() is called with buffers shorter than the value, and the
+// file is reopened after most records are erased, so iteration has to step over the
+// empty leaves that erase leaves in place
+#include "check.hpp"
+#include <map>
+#include <random>
+#include <string>
+
+typedef std::map<std::string, std::string> Ref;
+
+static sjtu::Slice slice(const std::string& str) {
+	return sjtu::Slice(str.data(), off_t(str.size()));
+}
+static std::string text(const sjtu::Slice& slice) {
+	return std::string(slice.data, size_t(slice.len));
+}
+
+// Keys share prefixes so that separators have to be shortened, and may contain zeros
+static std::string random_key(std::mt19937_64& rng) {
+	std::string key;
+	switch (rng() % 4) {
+	case 0:
+		key = "user:" + std::to_string(rng() % 5000);
+		break;
+	case 1:
+		key = "order/2024/" + std::to_string(rng() % 100000);
+		break;
+	case 2:
+		key = std::string(size_t(rng() % 3), '\0') + std::to_string(rng() % 1000);
+		break;
+	default:
+		for (auto len = rng() % 24; len; --len)
+			key += char(rng() % 4);
+	}
+	return key;
+}
+static std::string random_value(std::mt19937_64& rng, off_t limit) {
+	auto len = rng() % 4 ? rng() % 16 : rng() % (limit + 1);
+	std::string value;
+	for (size_t i = 0; i < len; ++i)
+		value += char(rng() % 256);
+	return value;
+}
+
+template <class Tree>
+void check_records(const Tree& tree, const Ref& ref) {
+	CHECK(tree.size() == off_t(ref.size()));
+	auto it = tree.cbegin();
+	for (auto& element : ref) {
+		CHECK(it != tree.cend());
+		CHECK(text(it.key()) == element.first && text(it.value()) == element.second);
+		++it;
+	}
+	CHECK(it == tree.cend());
+}
+
+// get() copies at most capacity bytes and always returns the full length
+template <class Tree>
+void check_get(const Tree& tree, const Ref& ref, std::mt19937_64& rng) {
+	char buff[Tree::MAX_RECORD + 8];
+	for (auto& element : ref) {
+		if (rng() % 8)
+			continue;
+		auto len = off_t(element.second.size());
+		auto capacity = len ? off_t(rng() % len) : 0;
+		memset(buff, 0x5a, sizeof(buff));
+		CHECK(tree.get(slice(element.first), buff, capacity) == len);
+		CHECK(std::string(buff, size_t(capacity)) == element.second.substr(0, size_t(capacity)));
+		CHECK(buff[capacity] == 0x5a);
+		CHECK(tree.get(slice(element.first), buff, len) == len);
+		CHECK(std::string(buff, size_t(len)) == element.second);
+	}
+	CHECK(tree.get(slice("no such key"), buff, sizeof(buff)) == -1);
+}
+
+template <off_t PAGE_SIZE>
+void run(const char* file, long long op_num) {
+	typedef sjtu::VarBTree<PAGE_SIZE> Tree;
+	const off_t max_record = Tree::MAX_RECORD;
+	Ref ref;
+	std::mt19937_64 rng(14);
+	{
+		Fresh_Tree<Tree> tree(file);
+		CHECK(tree.empty() && tree.cbegin() == tree.cend() && tree.height() == 0);
+		// the empty key, and the longest record that fits
+		CHECK(tree.insert(slice(""), slice("empty")) == sjtu::Success);
+		ref[""] = "empty";
+		std::string longest(size_t(max_record - 4), 'v');
+		CHECK(tree.insert(slice("long"), slice(longest)) == sjtu::Success);
+		ref["long"] = longest;
+		bool thrown = false;
+		try {
+			tree.insert(slice("longer"), slice(longest));
+		}
+		catch (sjtu::runtime_error&) {
+			thrown = true;
+		}
+		CHECK(thrown && tree.count(slice("longer")) == 0);
+		for (long long op = 0; op < op_num; ++op) {
+			auto key = random_key(rng);
+			if (rng() % 3 == 0) {
+				auto expected = ref.erase(key) ? sjtu::Success : sjtu::Fail;
+				CHECK(tree.erase(slice(key)) == expected);
+			}
+			else {
+				auto value = random_value(rng, max_record - off_t(key.size()));
+				auto expected = ref.emplace(key, value).second ? sjtu::Success : sjtu::Fail;
+				CHECK(tree.insert(slice(key), slice(value)) == expected);
+			}
+			if (op % (op_num / 4) == 0) {
+				check_records(tree, ref);
+				check_get(tree, ref, rng);
+			}
+		}
+		check_records(tree, ref);
+		check_get(tree, ref, rng);
+		CHECK(tree.height() > 2);
+		auto found = tree.find(slice("long"));
+		CHECK(found != tree.cend() && text(found.value()) == longest);
+		CHECK(tree.find(slice("no such key")) == tree.cend());
+		// erase most records; the leaves they leave empty stay in the chain
+		for (auto it = ref.begin(); it != ref.end(); ) {
+			if (rng() % 50) {
+				CHECK(tree.erase(slice(it->first)) == sjtu::Success);
+				it = ref.erase(it);
+			}
+			else
+				++it;
+		}
+		check_records(tree, ref);
+	}
+	{
+		Tree tree(file);
+		check_records(tree, ref);
+		check_get(tree, ref, rng);
+		for (auto& element : ref)
+			CHECK(tree.erase(slice(element.first)) == sjtu::Success);
+		ref.clear();
+		CHECK(tree.empty() && tree.cbegin() == tree.cend());
+		// reinsert into the emptied nodes
+		for (long long op = 0; op < op_num / 4; ++op) {
+			auto key = random_key(rng);
+			auto value = random_value(rng, max_record - off_t(key.size()));
+			auto expected = ref.emplace(key, value).second ? sjtu::Success : sjtu::Fail;
+			CHECK(tree.insert(slice(key), slice(value)) == expected);
+		}
+		check_records(tree, ref);
+	}
+	Tree tree(file);
+	check_records(tree, ref);
+	tree.clear();
+}
+
+int main() {
+	run<512>("var_test_512.sjtu", 60000);
+	run<4096>("var_test.sjtu", 60000);
+	std::cout << "var_test passed" << std::endl;
+	return 0;
+}